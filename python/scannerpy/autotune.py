@@ -0,0 +1,289 @@
+import copy
+import hashlib
+from random import choice
+from string import ascii_uppercase
+from timeit import default_timer as now
+
+from common import *
+
+# IO items of each task, and number of tasks, run by a calibration pass
+CALIBRATION_ITEMS_PER_TASK = 4
+CALIBRATION_TASKS = 4
+
+# Upper bound on calibration passes for one job
+MAX_PASSES = 16
+
+# A change must speed up a calibration pass by this factor to be kept, so
+# timing noise does not steer the search
+MIN_IMPROVEMENT = 1.05
+
+# (min, max) of each tuned parameter
+BOUNDS = {
+    'pipeline_instances_per_node': (1, 64),
+    'work_item_size': (16, 4096),
+    'tasks_in_queue_per_pu': (1, 32),
+    'load_sparsity_threshold': (1, 128),
+    'batch': (1, 256),
+}
+
+
+def ops_digest(ops):
+    """
+    Digest of a job's ops that ignores their batch sizes, which autotuning
+    picks.
+    """
+    h = hashlib.sha1()
+    for op in ops:
+        op = copy.deepcopy(op)
+        op.batch = -1
+        h.update(op.SerializeToString())
+    return h.hexdigest()
+
+
+def truncate_task(db, task, num_items):
+    """
+    Copy of task that only covers its first num_items IO items.
+    """
+    t = db.protobufs.Task()
+    t.CopyFrom(task)
+    for sample in t.samples:
+        fn = sample.sampling_function
+        if fn == 'All':
+            args = db.protobufs.AllSamplerArgs()
+            args.ParseFromString(sample.sampling_args)
+            num_rows = db.table(sample.table_name).num_rows()
+            strided = db.protobufs.StridedRangeSamplerArgs()
+            strided.stride = 1
+            for i in range(num_items):
+                s = i * args.sample_size
+                if s >= num_rows:
+                    break
+                strided.warmup_starts.append(max(0, s - args.warmup_size))
+                strided.starts.append(s)
+                strided.ends.append(min(s + args.sample_size, num_rows))
+            sample.sampling_function = 'StridedRange'
+            sample.sampling_args = strided.SerializeToString()
+        elif fn == 'StridedRange':
+            args = db.protobufs.StridedRangeSamplerArgs()
+            args.ParseFromString(sample.sampling_args)
+            del args.warmup_starts[num_items:]
+            del args.starts[num_items:]
+            del args.ends[num_items:]
+            sample.sampling_args = args.SerializeToString()
+        elif fn == 'Stencil':
+            args = db.protobufs.StencilSamplerArgs()
+            args.ParseFromString(sample.sampling_args)
+            del args.starts[num_items:]
+            del args.ends[num_items:]
+            sample.sampling_args = args.SerializeToString()
+        elif fn == 'Gather':
+            args = db.protobufs.GatherSamplerArgs()
+            args.ParseFromString(sample.sampling_args)
+            del args.samples[num_items:]
+            sample.sampling_args = args.SerializeToString()
+    return t
+
+
+def steady_state_rate(profiler, rows):
+    """
+    Rows per second saved between the first and last saved IO item of a job,
+    which leaves out starting the job and filling its pipeline, or None if it
+    saved fewer than two items.
+    """
+    ends = profiler.task_end_times('save')
+    if len(ends) < 2 or ends[-1] == ends[0]:
+        return None
+    # Calibration items are all about the same size, so the rows saved in the
+    # window are those of every item but the first
+    window_rows = rows * (len(ends) - 1) / float(len(ends))
+    return window_rows / ((ends[-1] - ends[0]) / 1.0e9)
+
+
+class Autotuner:
+    """
+    Picks job parameters by timing short calibration passes.
+
+    A pass runs the first few IO items of a few of the job's tasks as a
+    scratch job, which is deleted afterwards along with its tables, and its
+    rate is taken from when the workers saved items. Parameters are tuned one
+    at a time by doubling or halving them while that makes the pass faster,
+    and the parameters of the stage the profiler shows is busiest go first.
+    """
+
+    def __init__(self, db, ops, tasks, compression_options, params):
+        self._db = db
+        self._ops = ops
+        self._compression = compression_options
+        self._params = dict(params)
+        self._params['show_progress'] = False
+        self._params['profiling'] = True
+        # Scratch tables would be recorded, and loaded columns would hide
+        # the cost of their ops
+        self._params['memoize'] = False
+        self._tasks = [truncate_task(db, t, CALIBRATION_ITEMS_PER_TASK)
+                       for t in tasks[:CALIBRATION_TASKS]]
+        self._digest = ops_digest(ops)
+        self._passes = 0
+        self._best_rate = 0.0
+
+    def saved(self):
+        """
+        Parameters tuned for the most recent job with the same ops, or None.
+        """
+        db = self._db
+        for job in reversed(db._load_db_metadata().jobs):
+            path = 'jobs/{}/tuned_parameters.bin'.format(job.id)
+            info = db._storage.get_file_info('{}/{}'.format(db._db_path, path))
+            if not info.file_exists:
+                continue
+            tuned = db._load_descriptor(db.protobufs.TunedJobParameters, path)
+            if tuned.ops_digest == self._digest:
+                return tuned
+        return None
+
+    def tune(self):
+        """
+        Runs calibration passes and returns the best TunedJobParameters.
+        """
+        config = self._db.protobufs.TunedJobParameters()
+        config.ops_digest = self._digest
+        config.pipeline_instances_per_node = \
+            self._params['pipeline_instances_per_node'] or 0
+        config.work_item_size = self._params['work_item_size']
+        config.tasks_in_queue_per_pu = self._params['tasks_in_queue_per_pu']
+        config.load_sparsity_threshold = \
+            self._params['load_sparsity_threshold']
+        config.op_batches.extend([op.batch for op in self._ops])
+
+        self._best_rate, utilization = self._measure(config)
+        if self._best_rate == 0:
+            raise ScannerException(
+                'Autotuning failed: the job failed with its initial '
+                'parameters')
+
+        knobs = self._knobs()
+        busiest = max(utilization.keys() or ['eval'],
+                      key=lambda k: utilization[k] if k in utilization else 0)
+        if busiest in ['load', 'save']:
+            order = ['tasks_in_queue_per_pu', 'load_sparsity_threshold',
+                     'pipeline_instances_per_node', 'work_item_size', 'batch']
+        else:
+            order = ['pipeline_instances_per_node', 'batch', 'work_item_size',
+                     'tasks_in_queue_per_pu', 'load_sparsity_threshold']
+        for kind in order:
+            for (getter, setter) in knobs[kind]:
+                self._climb(config, getter, setter, BOUNDS[kind])
+
+        config.rows_per_second = self._best_rate
+        return config
+
+    def apply(self, tuned, ops, params):
+        """
+        Sets the tuned parameters in ops and the run() arguments in params.
+        """
+        params['pipeline_instances_per_node'] = \
+            tuned.pipeline_instances_per_node or None
+        params['work_item_size'] = tuned.work_item_size
+        params['tasks_in_queue_per_pu'] = tuned.tasks_in_queue_per_pu
+        params['load_sparsity_threshold'] = tuned.load_sparsity_threshold
+        for op, batch in zip(ops, tuned.op_batches):
+            op.batch = batch
+
+    def _knobs(self):
+        # (getter, setter) pairs on a TunedJobParameters for each kind of
+        # parameter
+        def field(name):
+            return (lambda c: getattr(c, name),
+                    lambda c, v: setattr(c, name, v))
+
+        knobs = {kind: [field(kind)] for kind in BOUNDS if kind != 'batch'}
+        knobs['batch'] = []
+        has_gpu_op = False
+        for i, op in enumerate(self._ops[1:-1], 1):
+            has_gpu_op |= op.device_type == self._db.protobufs.GPU
+            # Only tune batch sizes that the user left unset
+            if op.batch != -1:
+                continue
+            op_info = self._db._get_op_info(op.name)
+            if op.device_type in op_info.batch_devices:
+                knobs['batch'].append(
+                    (lambda c, i=i: max(c.op_batches[i], 1),
+                     lambda c, v, i=i: c.op_batches.__setitem__(i, v)))
+        # GPU jobs default to one instance per GPU, which is left to the
+        # workers
+        if has_gpu_op:
+            knobs['pipeline_instances_per_node'] = []
+        return knobs
+
+    def _climb(self, config, getter, setter, bounds):
+        # Doubles the parameter while that keeps helping, otherwise halves it
+        # while that keeps helping. An unset instance count, which lets the
+        # workers run one instance per CPU, is instead compared to counts
+        # going up from one.
+        (lo, hi) = bounds
+        start = getter(config) or 0
+        for step in ([2.0, 0.5] if start else [2.0]):
+            value = start
+            last_rate = self._best_rate if start else 0.0
+            best = None
+            while self._passes < MAX_PASSES:
+                prev = value
+                value = max(int(value * step), 1) if value else 1
+                # Halving stops moving once it reaches 1
+                if value < lo or value > hi or value in [start, prev]:
+                    break
+                candidate = copy.deepcopy(config)
+                setter(candidate, value)
+                rate, _ = self._measure(candidate)
+                if rate < last_rate * MIN_IMPROVEMENT:
+                    break
+                last_rate = rate
+                if rate >= self._best_rate * MIN_IMPROVEMENT:
+                    best = (value, rate)
+            if best is not None:
+                setter(config, best[0])
+                self._best_rate = best[1]
+                return
+
+    def _measure(self, config):
+        # Runs a calibration pass with config and returns its steady-state rows
+        # per second and the utilization of each stage, or 0 if the job failed
+        db = self._db
+        ops = [copy.deepcopy(op) for op in self._ops]
+        params = dict(self._params)
+        self.apply(config, ops, params)
+        tasks = []
+        for i, task in enumerate(self._tasks):
+            t = db.protobufs.Task()
+            t.CopyFrom(task)
+            t.output_table_name = '__autotune_{}_{}'.format(self._passes, i)
+            tasks.append(t)
+        self._passes += 1
+
+        job_name = '__autotune_' + \
+            ''.join(choice(ascii_uppercase) for _ in range(12))
+        start = now()
+        try:
+            job_id = db._run_job(job_name, ops, tasks, self._compression,
+                                 False, params)
+        except ScannerException:
+            job_id = None
+        seconds = now() - start
+
+        rate = 0.0
+        utilization = {}
+        if job_id is not None:
+            rows = sum(db.table(t.output_table_name).num_rows() for t in tasks)
+            profiler = db.profiler(job_id)
+            rate = steady_state_rate(profiler, rows) or rows / seconds
+            utilization = profiler.stage_utilization()
+        for t in tasks:
+            if db.has_table(t.output_table_name):
+                db._delete_table(t.output_table_name)
+        db_meta = db._load_db_metadata()
+        for i, job in enumerate(db_meta.jobs):
+            if job.name == job_name:
+                del db_meta.jobs[i]
+                break
+        db._save_descriptor(db_meta, 'db_metadata.bin')
+        return rate, utilization
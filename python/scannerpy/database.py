@@ -20,6 +20,7 @@ from threading import Thread
 # Scanner imports
 from common import *
 from profiler import Profiler
+from autotune import Autotuner
 from config import Config
 from op import OpGenerator, Op, OpColumn
 from sampler import TableSampler
@@ -849,6 +850,111 @@ class Database:
             raise ScannerException('Invalid size suffix in "{}"'.format(s))
         return int(prefix) * mults[suffix]
 
+    def _resumable_job(self, tasks):
+        """
+        Name of the job that wrote the existing output tables of tasks, or
+        None if there are none or they were written by different jobs.
+        """
+        job_ids = set()
+        for task in tasks:
+            if self.has_table(task.output_table_name):
+                job_ids.add(self.table(task.output_table_name)._job_id)
+        if len(job_ids) != 1:
+            return None
+        job_id = job_ids.pop()
+        for job in self._load_db_metadata().jobs:
+            if job.id == job_id:
+                return job.name
+        return None
+
+    def _run_job(self, job_name, ops, tasks, compression_options, resume,
+                 params):
+        """
+        Runs ops over tasks with the run() arguments in params and returns the
+        id of the new job.
+        """
+        job_params = self.protobufs.JobParameters()
+        job_params.job_name = job_name
+        job_params.resume = resume
+        job_params.task_set.tasks.extend(tasks)
+        job_params.task_set.ops.extend(ops)
+        job_params.task_set.compression.extend(compression_options)
+        job_params.pipeline_instances_per_node = \
+            params['pipeline_instances_per_node'] or -1
+        job_params.work_item_size = params['work_item_size']
+        job_params.show_progress = params['show_progress']
+        job_params.profiling = params['profiling']
+        job_params.tasks_in_queue_per_pu = params['tasks_in_queue_per_pu']
+        job_params.load_sparsity_threshold = params['load_sparsity_threshold']
+        job_params.batch_coalesce_timeout_ms = params['batch_coalesce_ms']
+        job_params.memoize = params['memoize']
+        placements = {
+            'none': self.protobufs.PLACEMENT_NONE,
+            'numa': self.protobufs.PLACEMENT_NUMA,
+            'cores': self.protobufs.PLACEMENT_CORES
+        }
+        if params['thread_placement'] not in placements:
+            raise ScannerException(
+                'Unknown thread placement {}, expected one of {}'
+                .format(params['thread_placement'],
+                        ', '.join(sorted(placements))))
+        job_params.thread_placement = placements[params['thread_placement']]
+
+        job_params.memory_pool_config.pinned_cpu = False
+        cpu_pool = params['cpu_pool']
+        if cpu_pool is not None:
+            job_params.memory_pool_config.cpu.use_pool = True
+            if cpu_pool[0] == 'p':
+                job_params.memory_pool_config.pinned_cpu = True
+                cpu_pool = cpu_pool[1:]
+            size = self._parse_size_string(cpu_pool)
+            job_params.memory_pool_config.cpu.free_space = size
+
+        huge_page_modes = {
+            'none': self.protobufs.MemoryPoolConfig.HUGE_PAGES_NONE,
+            'transparent':
+                self.protobufs.MemoryPoolConfig.HUGE_PAGES_TRANSPARENT,
+            'explicit': self.protobufs.MemoryPoolConfig.HUGE_PAGES_EXPLICIT
+        }
+        if params['huge_pages'] not in huge_page_modes:
+            raise ScannerException(
+                'Unknown huge page mode {}, expected one of {}'
+                .format(params['huge_pages'],
+                        ', '.join(sorted(huge_page_modes))))
+        job_params.memory_pool_config.cpu_huge_pages = \
+            huge_page_modes[params['huge_pages']]
+        job_params.memory_pool_config.prefault_cpu_pool = \
+            params['prefault_pool']
+
+        if params['gpu_pool'] is not None:
+            job_params.memory_pool_config.gpu.use_pool = True
+            size = self._parse_size_string(params['gpu_pool'])
+            job_params.memory_pool_config.gpu.free_space = size
+
+        for pool, cache in [(job_params.memory_pool_config.cpu,
+                             params['cpu_block_cache']),
+                            (job_params.memory_pool_config.gpu,
+                             params['gpu_block_cache'])]:
+            if cache is not None:
+                size = self._parse_size_string(cache)
+                pool.block_cache_size = size if size > 0 else -1
+
+        # Run the job
+        self._try_rpc(lambda: self._master.NewJob(job_params))
+
+        # Invalidate db metadata because of job run
+        self._cached_db_metadata = None
+
+        db_meta = self._load_db_metadata()
+        job_id = None
+        for job in db_meta.jobs:
+            if job.name == job_name:
+                job_id = job.id
+        if job_id is None:
+            raise ScannerException('Internal error: job id not found after run')
+
+        return job_id
+
     def run(self, jobs,
             force=False,
             work_item_size=250,
@@ -858,7 +964,16 @@ class Database:
             show_progress=True,
             profiling=False,
             load_sparsity_threshold=8,
-            tasks_in_queue_per_pu=4):
+            tasks_in_queue_per_pu=4,
+            thread_placement='none',
+            huge_pages='none',
+            prefault_pool=False,
+            cpu_block_cache=None,
+            gpu_block_cache=None,
+            resume=False,
+            autotune=False,
+            batch_coalesce_ms=0,
+            memoize=False):
         """
         Runs a computation over a set of inputs.
 
@@ -879,6 +994,40 @@ class Database:
             gpu_pool: TODO(wcrichto)
             pipeline_instances_per_node: TODO(wcrichto)
             show_progress: TODO(wcrichto)
+            thread_placement: 'none' to leave threads to the OS, 'numa' to
+                              pin each pipeline instance to one NUMA node and
+                              its memory, or 'cores' to pin each instance to
+                              its own slice of cores.
+            huge_pages: 'none', 'transparent' or 'explicit' (hugetlbfs) huge
+                        pages for the CPU pool and large CPU allocations.
+            prefault_pool: If True, fault in the whole CPU pool up front.
+            cpu_block_cache: How much freed block memory to keep for reuse
+                             when there is no CPU pool, e.g. '1G'. None
+                             keeps the default of 512M and '0M' turns the
+                             cache off.
+            gpu_block_cache: Same as cpu_block_cache for each GPU without a
+                             pool. The default is 256M.
+            resume: If the output tables were left behind by an earlier run
+                    of the same computation that died or was killed, only
+                    compute the IO items that run did not save.
+            autotune: If True, pick pipeline_instances_per_node,
+                      work_item_size, tasks_in_queue_per_pu,
+                      load_sparsity_threshold and the batch size of ops
+                      without one by timing short calibration runs on the
+                      first items of a few tasks, using the given values as
+                      the starting point. The choice is saved with the job
+                      and reused by later jobs with the same ops.
+            batch_coalesce_ms: If positive, batched ops without a stencil
+                               fill their batches with rows from later work
+                               items, waiting at most this many milliseconds
+                               for them. Only use with kernels that do not
+                               keep state from one row to the next.
+            memoize: If True, op outputs that earlier memoized jobs saved for
+                     the same input tables, sampling, ops and op arguments
+                     are loaded from their tables instead of computed, and
+                     the op outputs this job saves are recorded for later
+                     jobs. Only jobs that sample every table with all() are
+                     memoized.
 
         Returns:
             Either the output Collection if output_collection is specified
@@ -926,8 +1075,10 @@ class Database:
                         t.name().split(':')[-1])
                     tasks.append(t_task)
 
+        resume_job_name = self._resumable_job(tasks) if resume else None
         for task in tasks:
-            if self.has_table(task.output_table_name):
+            if self.has_table(task.output_table_name) and \
+               resume_job_name is None:
                 if force:
                     self._delete_table(task.output_table_name)
                 else:
@@ -935,46 +1086,38 @@ class Database:
                                            .format(task.output_table_name))
         self._save_descriptor(self._load_db_metadata(), 'db_metadata.bin')
 
-        job_params = self.protobufs.JobParameters()
-        job_name = ''.join(choice(ascii_uppercase) for _ in range(12))
-        job_params.job_name = job_name
-        job_params.task_set.tasks.extend(tasks)
-        job_params.task_set.ops.extend(ops)
-        job_params.task_set.compression.extend(compression_options)
-        job_params.pipeline_instances_per_node = pipeline_instances_per_node or -1
-        job_params.work_item_size = work_item_size
-        job_params.show_progress = show_progress
-        job_params.profiling = profiling
-        job_params.tasks_in_queue_per_pu = tasks_in_queue_per_pu
-        job_params.load_sparsity_threshold = load_sparsity_threshold
-
-        job_params.memory_pool_config.pinned_cpu = False
-        if cpu_pool is not None:
-            job_params.memory_pool_config.cpu.use_pool = True
-            if cpu_pool[0] == 'p':
-                job_params.memory_pool_config.pinned_cpu = True
-                cpu_pool = cpu_pool[1:]
-            size = self._parse_size_string(cpu_pool)
-            job_params.memory_pool_config.cpu.free_space = size
-
-        if gpu_pool is not None:
-            job_params.memory_pool_config.gpu.use_pool = True
-            size = self._parse_size_string(gpu_pool)
-            job_params.memory_pool_config.gpu.free_space = size
-
-        # Run the job
-        self._try_rpc(lambda: self._master.NewJob(job_params))
-
-        # Invalidate db metadata because of job run
-        self._cached_db_metadata = None
-
-        db_meta = self._load_db_metadata()
-        job_id = None
-        for job in db_meta.jobs:
-            if job.name == job_name:
-                job_id = job.id
-        if job_id is None:
-            raise ScannerException('Internal error: job id not found after run')
+        job_name = resume_job_name or \
+            ''.join(choice(ascii_uppercase) for _ in range(12))
+        params = {
+            'work_item_size': work_item_size,
+            'cpu_pool': cpu_pool,
+            'gpu_pool': gpu_pool,
+            'pipeline_instances_per_node': pipeline_instances_per_node,
+            'show_progress': show_progress,
+            'profiling': profiling,
+            'load_sparsity_threshold': load_sparsity_threshold,
+            'tasks_in_queue_per_pu': tasks_in_queue_per_pu,
+            'thread_placement': thread_placement,
+            'huge_pages': huge_pages,
+            'prefault_pool': prefault_pool,
+            'cpu_block_cache': cpu_block_cache,
+            'gpu_block_cache': gpu_block_cache,
+            'batch_coalesce_ms': batch_coalesce_ms,
+            'memoize': memoize
+        }
+        tuned = None
+        if autotune:
+            tuner = Autotuner(self, ops, tasks, compression_options, params)
+            tuned = tuner.saved()
+            if tuned is None:
+                tuned = tuner.tune()
+            tuner.apply(tuned, ops, params)
+
+        job_id = self._run_job(job_name, ops, tasks, compression_options,
+                               resume_job_name is not None, params)
+        if tuned is not None:
+            self._save_descriptor(
+                tuned, 'jobs/{}/tuned_parameters.bin'.format(job_id))
 
         # Return a new collection if the input was a collection, otherwise
         # return a table list
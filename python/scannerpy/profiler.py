@@ -31,10 +31,12 @@ class Profiler:
             'jobs/{}/descriptor.bin'.format(job_id))
 
         self._profilers = {}
+        self._placements = {}
         for n in range(job.num_nodes):
             path = '{}/jobs/{}/profile_{}.bin'.format(db._db_path, job_id, n)
-            time, profs = self._parse_profiler_file(path)
+            time, profs, placement = self._parse_profiler_file(path)
             self._profilers[n] = (time, profs)
+            self._placements[n] = placement
 
     def write_trace(self, path):
         """
@@ -54,6 +56,9 @@ class Profiler:
         traces = []
         next_tid = 0
         for proc, (_, worker_profiler_groups) in self._profilers.iteritems():
+            numa_nodes = {
+                (p['worker_type'], p['worker_num']): p['numa_node']
+                for p in self._placements[proc]}
             for worker_type, profs in [('load', worker_profiler_groups['load']),
                                        ('decode', worker_profiler_groups['decode']),
                                        ('eval', worker_profiler_groups['eval']),
@@ -63,6 +68,7 @@ class Profiler:
                     next_tid += 1
                     worker_num = prof['worker_num']
                     tag = prof['worker_tag']
+                    numa_node = numa_nodes.get((worker_type, worker_num), -1)
                     traces.append({
                         'name': 'thread_name',
                         'ph': 'M',
@@ -71,7 +77,9 @@ class Profiler:
                         'args': {
                             'name': '{}_{:02d}_{:02d}'.format(
                                 worker_type, proc, worker_num) + (
-                                    "_" + str(tag) if tag else "")
+                                    "_" + str(tag) if tag else "") + (
+                                    " (node {})".format(numa_node)
+                                    if numa_node >= 0 else "")
                         }})
                     for interval in prof['intervals']:
                         trace = {
@@ -87,9 +95,123 @@ class Profiler:
                         if interval[0] in colors:
                             trace['cname'] = colors[interval[0]]
                         traces.append(trace)
+            for prof in worker_profiler_groups['memory']:
+                traces += self._memory_counter_events(proc, prof['samples'])
         with open(path, 'w') as f:
             f.write(json.dumps(traces))
 
+    def memory_timeline(self):
+        """
+        Returns sampled allocator usage for each node.
+
+        Returns:
+            A dict mapping node to a dict from 'device/allocator' to a list of
+            (time, live_bytes, peak_bytes, allocations) tuples, where time is in
+            nanoseconds.
+        """
+        timelines = {}
+        for proc, (_, worker_profiler_groups) in self._profilers.iteritems():
+            timelines[proc] = self._group_memory_samples(
+                [s for prof in worker_profiler_groups['memory']
+                 for s in prof['samples']])
+        return timelines
+
+    def placement(self):
+        """
+        Returns where each node laid out its pipeline threads.
+
+        Returns:
+            A dict mapping node to a list of dicts with the worker_type
+            ('load' or 'eval'), worker_num, numa_node and cpus (a cpulist
+            string such as '0-7,16-23') of each thread group. numa_node is -1
+            and cpus is empty for unpinned threads.
+        """
+        return self._placements
+
+    def stage_utilization(self):
+        """
+        Returns how busy each pipeline stage kept its threads.
+
+        Returns:
+            A dict mapping worker type ('load', 'decode', 'eval' or 'save')
+            to the fraction of the job's wall time its threads spent working
+            on tasks, averaged over the stage's threads on all nodes.
+        """
+        busy = defaultdict(float)
+        threads = defaultdict(int)
+        wall = 0.0
+        for (start, end), profiler in self._profilers.values():
+            wall = max(wall, float(end - start))
+            for kind, profs in profiler.iteritems():
+                if kind == 'memory':
+                    continue
+                for prof in profs:
+                    threads[kind] += 1
+                    busy[kind] += sum(e - s for (key, s, e) in prof['intervals']
+                                      if key == 'task')
+        if wall == 0:
+            return {}
+        return {kind: busy[kind] / (threads[kind] * wall) for kind in threads}
+
+    def task_end_times(self, worker_type):
+        """
+        Returns when the threads of a pipeline stage finished their tasks.
+
+        Args:
+            worker_type: 'load', 'decode', 'eval' or 'save'
+
+        Returns:
+            A sorted list of the end times, in nanoseconds, of the stage's
+            tasks on all nodes.
+        """
+        ends = []
+        for _, profiler in self._profilers.values():
+            for prof in profiler[worker_type]:
+                ends += [e for (key, s, e) in prof['intervals']
+                         if key == 'task']
+        return sorted(ends)
+
+    def _group_memory_samples(self, samples):
+        # Sample keys look like 'CPU:0/block:live_bytes'
+        metrics = ['live_bytes', 'peak_bytes', 'allocations']
+        by_time = defaultdict(lambda: defaultdict(dict))
+        for (key, time, value) in samples:
+            series, metric = key.rsplit(':', 1)
+            by_time[series][time][metric] = value
+        timeline = {}
+        for series, points in by_time.iteritems():
+            timeline[series] = [
+                tuple([time] + [points[time].get(m, 0) for m in metrics])
+                for time in sorted(points.keys())]
+        return timeline
+
+    def _memory_counter_events(self, proc, samples):
+        traces = []
+        for series, points in self._group_memory_samples(samples).iteritems():
+            last_time = None
+            last_allocations = None
+            for (time, live, peak, allocations) in points:
+                traces.append({
+                    'name': 'memory {}'.format(series),
+                    'ph': 'C',
+                    'ts': time / 1000,  # ns to microseconds
+                    'pid': proc,
+                    'args': {'live_bytes': live, 'peak_bytes': peak}
+                })
+                if last_time is not None and time > last_time:
+                    rate = (allocations - last_allocations) / \
+                           ((time - last_time) / 1.0e9)
+                    traces.append({
+                        'name': 'allocations/s {}'.format(series),
+                        'ph': 'C',
+                        'ts': time / 1000,
+                        'pid': proc,
+                        'args': {'allocations': rate}
+                    })
+                last_time = time
+                last_allocations = allocations
+        return traces
+
     def _convert_time(self, d):
         def convert(t):
             if isinstance(t, float):
@@ -167,6 +289,22 @@ class Profiler:
             t, offset = read_advance('q', bytes_buffer, offset)
             counter_value = t[0]
             counters[counter_name] = counter_value
+        # Sample key dictionary encoding
+        t, offset = read_advance('q', bytes_buffer, offset)
+        num_sample_keys = t[0]
+        sample_key_dictionary = {}
+        for i in range(num_sample_keys):
+            key_name, offset = unpack_string(bytes_buffer, offset)
+            t, offset = read_advance('B', bytes_buffer, offset)
+            key_index = t[0]
+            sample_key_dictionary[key_index] = key_name
+        # Samples
+        t, offset = read_advance('q', bytes_buffer, offset)
+        num_samples = t[0]
+        samples = []
+        for i in range(num_samples):
+            t, offset = read_advance('Bqq', bytes_buffer, offset)
+            samples.append((sample_key_dictionary[t[0]], t[1], t[2]))
 
         return {
             'node': node,
@@ -174,7 +312,8 @@ class Profiler:
             'worker_tag': worker_tag,
             'worker_num': worker_num,
             'intervals': intervals,
-            'counters': counters
+            'counters': counters,
+            'samples': samples
         }, offset
 
     def _parse_profiler_file(self, profiler_path):
@@ -196,10 +335,11 @@ class Profiler:
         # Eval worker profilers
         t, offset = read_advance('B', bytes_buffer, offset)
         num_eval_workers = t[0]
+        # Pre, one per kernel group and post, so it varies with the job
         t, offset = read_advance('B', bytes_buffer, offset)
-        groups_per_chain = t[0]
+        profilers_per_chain = t[0]
         for pu in range(num_eval_workers):
-            for fg in range(groups_per_chain):
+            for p in range(profilers_per_chain):
                 prof, offset = self._parse_profiler_output(bytes_buffer, offset)
                 profilers[prof['worker_type']].append(prof)
         # Save worker profilers
@@ -208,4 +348,27 @@ class Profiler:
         for i in range(num_save_workers):
             prof, offset = self._parse_profiler_output(bytes_buffer, offset)
             profilers[prof['worker_type']].append(prof)
-        return (start_time, end_time), profilers
+        # Memory usage profilers
+        t, offset = read_advance('B', bytes_buffer, offset)
+        num_memory_profilers = t[0]
+        for i in range(num_memory_profilers):
+            prof, offset = self._parse_profiler_output(bytes_buffer, offset)
+            profilers[prof['worker_type']].append(prof)
+        # Thread placement
+        t, offset = read_advance('i', bytes_buffer, offset)
+        num_placements = t[0]
+        placement = []
+        for i in range(num_placements):
+            worker_type, offset = unpack_string(bytes_buffer, offset)
+            t, offset = read_advance('i', bytes_buffer, offset)
+            worker_num = t[0]
+            t, offset = read_advance('i', bytes_buffer, offset)
+            numa_node = t[0]
+            cpus, offset = unpack_string(bytes_buffer, offset)
+            placement.append({
+                'worker_type': worker_type,
+                'worker_num': worker_num,
+                'numa_node': numa_node,
+                'cpus': cpus
+            })
+        return (start_time, end_time), profilers, placement
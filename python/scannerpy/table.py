@@ -97,6 +97,33 @@ class Table:
 
         return [i for _, i in self.load(['index'], fn=self._parse_index)]
 
+    def filtered_rows(self):
+        """
+        Row of the job's input that each row came from, for tables output by
+        jobs whose filter or aggregate ops dropped rows. An aggregate's row
+        comes from the last row of the input it aggregated.
+        """
+        db = self._db
+        rows = []
+        start_row = 0
+        for item_id, end_row in enumerate(self._descriptor.end_rows):
+            # Items a combined aggregate replaced keep their files but hold
+            # no rows
+            if end_row == start_row:
+                continue
+            path = '{}/tables/{}/row_ids_{}.bin'.format(
+                db._db_path, self._descriptor.id, item_id)
+            try:
+                contents = db._storage.read(path)
+            except UserWarning:
+                raise ScannerException(
+                    'Table {} was not output by a job with filters'
+                    .format(self.name()))
+            rows.extend(struct.unpack('={}q'.format(end_row - start_row),
+                                      contents))
+            start_row = end_row
+        return rows
+
     def profiler(self):
         if self._job_id != -1:
             return self._db.profiler(self._job_id)
@@ -296,11 +296,16 @@ Result Database::new_job(JobParameters& params) {
   grpc::ClientContext context;
   proto::JobParameters job_params;
   job_params.set_job_name(params.job_name);
+  job_params.mutable_memory_pool_config()->CopyFrom(params.memory_pool_config);
   job_params.set_pipeline_instances_per_node(
       params.pipeline_instances_per_node);
   job_params.set_work_item_size(params.work_item_size);
   job_params.set_load_sparsity_threshold(params.load_sparsity_threshold);
   job_params.set_tasks_in_queue_per_pu(params.tasks_in_queue_per_pu);
+  job_params.set_thread_placement(params.thread_placement);
+  job_params.set_resume(params.resume);
+  job_params.set_batch_coalesce_timeout_ms(params.batch_coalesce_timeout_ms);
+  job_params.set_memoize(params.memoize);
   proto::TaskSet set = consume_task_set(params.task_set);
   job_params.mutable_task_set()->Swap(&set);
   Result job_result;
@@ -74,6 +74,17 @@ struct JobParameters {
   i64 work_item_size;
   i32 load_sparsity_threshold;
   i32 tasks_in_queue_per_pu;
+  proto::ThreadPlacement thread_placement = proto::PLACEMENT_NONE;
+  //! Continue an earlier job named job_name that did not finish, skipping
+  //! the IO items it already saved
+  bool resume = false;
+  //! Batched kernels without a stencil may wait this long for rows of later
+  //! work entries to fill a batch. 0 runs the rows of each entry on their
+  //! own.
+  i32 batch_coalesce_timeout_ms = 0;
+  //! Load op outputs that earlier jobs memoized instead of computing them,
+  //! and memoize the op outputs this job saves
+  bool memoize = false;
 };
 
 //! Info about a video that fails to ingest.
@@ -16,8 +16,108 @@
 #include "scanner/api/frame.h"
 #include "scanner/util/memory.h"
 
+#include <mutex>
+#include <type_traits>
+
 namespace scanner {
 
+namespace {
+
+// Free list of Frame sized slots. Frames are usually created on a decode or
+// kernel thread and deleted on a thread further down the pipeline, so each
+// thread keeps a short local list and trades whole batches with a shared
+// list instead of taking a lock per frame. Slots are never returned to the
+// system, so the slab holds as many frames as were ever live at once.
+class FrameSlab {
+ public:
+  void* allocate() {
+    LocalList& local = local_list();
+    if (local.head == nullptr) {
+      refill(local);
+    }
+    Slot* slot = local.head;
+    local.head = slot->next;
+    local.count--;
+    return slot;
+  }
+
+  void free(void* ptr) {
+    LocalList& local = local_list();
+    Slot* slot = static_cast<Slot*>(ptr);
+    slot->next = local.head;
+    local.head = slot;
+    local.count++;
+    if (local.count >= 2 * BATCH_SIZE) {
+      give_back(local, BATCH_SIZE);
+    }
+  }
+
+ private:
+  union Slot {
+    Slot* next;
+    std::aligned_storage<sizeof(Frame), alignof(Frame)>::type frame;
+  };
+
+  struct LocalList {
+    Slot* head = nullptr;
+    i32 count = 0;
+    ~LocalList();
+  };
+
+  static const i32 BATCH_SIZE = 64;
+  static const i32 SLOTS_PER_CHUNK = 4096;
+
+  static LocalList& local_list() {
+    static thread_local LocalList list;
+    return list;
+  }
+
+  void refill(LocalList& local) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (shared_head_ == nullptr) {
+      Slot* chunk = static_cast<Slot*>(
+          ::operator new(sizeof(Slot) * SLOTS_PER_CHUNK));
+      for (i32 i = 0; i < SLOTS_PER_CHUNK; ++i) {
+        chunk[i].next = i + 1 < SLOTS_PER_CHUNK ? &chunk[i + 1] : nullptr;
+      }
+      shared_head_ = chunk;
+    }
+    while (shared_head_ != nullptr && local.count < BATCH_SIZE) {
+      Slot* slot = shared_head_;
+      shared_head_ = slot->next;
+      slot->next = local.head;
+      local.head = slot;
+      local.count++;
+    }
+  }
+
+  void give_back(LocalList& local, i32 num_slots) {
+    std::lock_guard<std::mutex> guard(lock_);
+    while (local.head != nullptr && num_slots-- > 0) {
+      Slot* slot = local.head;
+      local.head = slot->next;
+      local.count--;
+      slot->next = shared_head_;
+      shared_head_ = slot;
+    }
+  }
+
+  std::mutex lock_;
+  Slot* shared_head_ = nullptr;
+};
+
+// Never destroyed, so threads that exit after static destructors run can
+// still hand their slots back
+FrameSlab& frame_slab() {
+  static FrameSlab* slab = new FrameSlab;
+  return *slab;
+}
+
+FrameSlab::LocalList::~LocalList() {
+  frame_slab().give_back(*this, count);
+}
+}
+
 size_t size_of_frame_type(FrameType type) {
   size_t s;
   switch (type) {
@@ -103,4 +203,19 @@ std::vector<Frame*> new_frames(DeviceHandle device, FrameInfo info, i32 num) {
   }
   return frames;
 }
+
+void* Frame::operator new(size_t size) {
+  if (size != sizeof(Frame)) {
+    return ::operator new(size);
+  }
+  return frame_slab().allocate();
+}
+
+void Frame::operator delete(void* ptr, size_t size) {
+  if (size != sizeof(Frame)) {
+    ::operator delete(ptr);
+  } else if (ptr != nullptr) {
+    frame_slab().free(ptr);
+  }
+}
 }
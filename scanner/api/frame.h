@@ -61,6 +61,11 @@ class Frame {
  public:
   Frame(FrameInfo info, u8* buffer);
 
+  //! Frames are created and deleted once per row in the decode and kernel
+  //! loops, so they come from a slab instead of the system allocator.
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr, size_t size);
+
   FrameInfo as_frame_info() const;
 
   size_t size() const;
@@ -18,6 +18,8 @@
 #include "scanner/engine/kernel_registry.h"
 #include "scanner/util/memory.h"
 
+#include <glog/logging.h>
+
 namespace scanner {
 
 Element::Element(u8* _buffer, size_t _size)
@@ -94,6 +96,34 @@ void Kernel::execute_kernel(
   }
 }
 
+AggregateKernel::AggregateKernel(const KernelConfig& config)
+    : BaseKernel(config) {}
+
+void AggregateKernel::execute_kernel(
+    const StenciledBatchedColumns& input_columns,
+    BatchedColumns& output_columns) {
+  size_t batch = input_columns.empty() ? 0 : input_columns[0].size();
+  for (size_t b = 0; b < batch; ++b) {
+    Columns in_cols;
+    bool computed = true;
+    for (auto& col : input_columns) {
+      in_cols.push_back(col[b][0]);
+      computed &= !is_null_element(col[b][0]);
+    }
+    if (computed) {
+      aggregate(in_cols);
+    }
+  }
+  // Only the last row of the item gets an output, from finish_item
+  for (auto& col : output_columns) {
+    col.resize(col.size() + batch, null_element());
+  }
+}
+
+void AggregateKernel::finish_item(Columns& output_columns) {
+  finish(output_columns);
+}
+
 void VideoKernel::check_frame(const DeviceHandle& device,
                               const Element& element) {
   const Frame* frame = element.as_const_frame();
@@ -134,9 +164,13 @@ KernelRegistration::KernelRegistration(const KernelBuilder& builder) {
   i32 num_devices = builder.num_devices_;
   bool can_batch = builder.can_batch_;
   i32 preferred_batch = builder.preferred_batch_size_;
+  bool parallel = builder.parallel_;
   KernelConstructor constructor = builder.constructor_;
-  internal::KernelFactory* factory = new internal::KernelFactory(
-      name, type, num_devices, can_batch, preferred_batch, constructor);
+  LOG_IF(FATAL, parallel && type != DeviceType::CPU)
+      << "Kernel " << name << " can only run in parallel on the CPU";
+  internal::KernelFactory* factory =
+      new internal::KernelFactory(name, type, num_devices, can_batch,
+                                  preferred_batch, parallel, constructor);
   internal::KernelRegistry* registry = internal::get_kernel_registry();
   registry->add_kernel(name, factory);
 }
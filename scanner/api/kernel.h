@@ -79,7 +79,17 @@ inline void insert_frame(Element& element, Frame* frame) {
   element = ::scanner::Element{frame};
 }
 
+//! Placeholder for a row an op did not compute because nothing reads it
+inline Element null_element() { return ::scanner::Element{nullptr, 0}; }
+
+inline bool is_null_element(const Element& element) {
+  return !element.is_frame && element.buffer == nullptr;
+}
+
 inline void add_element_ref(DeviceHandle device, Element& element) {
+  if (is_null_element(element)) {
+    return;
+  }
   if (element.is_frame) {
     Frame* frame = element.as_frame();
     add_buffer_ref(device, frame->data);
@@ -89,6 +99,9 @@ inline void add_element_ref(DeviceHandle device, Element& element) {
 }
 
 inline void delete_element(DeviceHandle device, Element& element) {
+  if (is_null_element(element)) {
+    return;
+  }
   if (element.is_frame) {
     Frame* frame = element.as_frame();
     delete_buffer(device, frame->data);
@@ -349,6 +362,62 @@ class Kernel : public BaseKernel {
                        Columns& output_columns) = 0;
 };
 
+/**
+ * @brief Kernel that reduces the rows of each IO item to a single row.
+ *
+ * Must be registered for an op built with OpBuilder::aggregate(). Every row
+ * of an item is passed to aggregate, and once the item's last row has been
+ * seen, finish writes the item's one output row. If the job's output table
+ * holds exactly this op's output columns, the master then calls combine on
+ * the rows of all items of the table to leave a single row.
+ */
+class AggregateKernel : public BaseKernel {
+ public:
+  AggregateKernel(const KernelConfig& config);
+
+  virtual ~AggregateKernel(){};
+
+  /**
+   * @brief For internal use
+   **/
+  virtual void execute_kernel(const StenciledBatchedColumns& input_columns,
+                              BatchedColumns& output_columns) override;
+
+  /**
+   * @brief For internal use
+   **/
+  void finish_item(Columns& output_columns);
+
+  /**
+   * @brief Merges the rows finish wrote for the items of a table into one.
+   *
+   * @param partial_columns
+   *        output columns of finish, each holding one element per item
+   * @param output_columns
+   *        vector of elements, one per output column
+   */
+  virtual void combine(const BatchedColumns& partial_columns,
+                       Columns& output_columns) = 0;
+
+ protected:
+  /**
+   * @brief Folds one row into the aggregate of the current item.
+   *
+   * @param input_columns
+   *        vector of elements, where each element is from a different column
+   */
+  virtual void aggregate(const Columns& input_columns) = 0;
+
+  /**
+   * @brief Writes the aggregate of the current item and clears it for the
+   *        next one.
+   *
+   * @param output_columns
+   *        vector of elements, one per output column
+   */
+  virtual void finish(Columns& output_columns) = 0;
+};
+
 //! Kernel with support for frame and frame_info columns.
 class VideoKernel {
  protected:
@@ -393,7 +462,8 @@ class KernelBuilder {
       device_type_(DeviceType::CPU),
       num_devices_(1),
       can_batch_(false),
-      preferred_batch_size_(1) {}
+      preferred_batch_size_(1),
+      parallel_(false) {}
 
   KernelBuilder& device(DeviceType device_type) {
     device_type_ = device_type;
@@ -411,6 +481,20 @@ class KernelBuilder {
     return *this;
   }
 
+  /**
+   * @brief Lets the runtime run batches of a CPU kernel at once on the
+   *        node's shared thread pool.
+   *
+   * Each thread gets its own instance of the kernel, so execute need not be
+   * thread safe. However, an instance sees only some of the batches of a
+   * task, and reset is not called between them, so the kernel must not keep
+   * state across rows.
+   */
+  KernelBuilder& parallel() {
+    parallel_ = true;
+    return *this;
+  }
+
  private:
   std::string name_;
   KernelConstructor constructor_;
@@ -418,6 +502,7 @@ class KernelBuilder {
   i32 num_devices_;
   bool can_batch_;
   i32 preferred_batch_size_;
+  bool parallel_;
 };
 }
 
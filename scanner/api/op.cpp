@@ -86,9 +86,16 @@ OpRegistration::OpRegistration(const OpBuilder& builder) {
   }
   bool can_stencil = builder.can_stencil_;
   const std::vector<i32>& stencil = builder.preferred_stencil_;
+  bool is_filter = builder.is_filter_;
+  LOG_IF(FATAL, is_filter && output_columns.size() != 1)
+      << "Filter op " << name << " must have exactly one output";
+  bool is_aggregate = builder.is_aggregate_;
+  LOG_IF(FATAL, is_filter && is_aggregate)
+      << "Op " << name << " can not be both a filter and an aggregate";
   OpInfo* info =
       new OpInfo(name, variadic_inputs, input_columns, output_columns,
-                 can_stencil, stencil);
+                 can_stencil, stencil, is_filter, is_aggregate,
+                 builder.version_);
   OpRegistry* registry = get_op_registry();
   registry->add_op(name, info);
 }
@@ -92,7 +92,12 @@ class OpBuilder {
   friend class OpRegistration;
 
   OpBuilder(const std::string& name)
-    : name_(name), variadic_inputs_(false), can_stencil_(false) {}
+    : name_(name),
+      variadic_inputs_(false),
+      can_stencil_(false),
+      is_filter_(false),
+      is_aggregate_(false),
+      version_(0) {}
 
   OpBuilder& variadic_inputs() {
     if (input_columns_.size() > 0) {
@@ -133,6 +138,28 @@ class OpBuilder {
     return *this;
   }
 
+  //! Makes the op a filter. Its single output holds a byte per row, and ops
+  //! after it in a job skip the rows where that byte is zero. Those rows are
+  //! also left out of the job's output tables.
+  OpBuilder& filter() {
+    is_filter_ = true;
+    return *this;
+  }
+
+  //! Makes the op an aggregate, which reduces the rows of each IO item to
+  //! one. Its kernels must be AggregateKernels and run on the CPU.
+  OpBuilder& aggregate() {
+    is_aggregate_ = true;
+    return *this;
+  }
+
+  //! Bump when the op's outputs change for the same inputs and arguments, so
+  //! jobs stop loading outputs memoized from earlier versions
+  OpBuilder& version(i32 version) {
+    version_ = version;
+    return *this;
+  }
+
  private:
   std::string name_;
   bool variadic_inputs_;
@@ -140,6 +167,9 @@ class OpBuilder {
   std::vector<std::tuple<std::string, ColumnType>> output_columns_;
   bool can_stencil_;
   std::vector<int> preferred_stencil_ = {0};
+  bool is_filter_;
+  bool is_aggregate_;
+  i32 version_;
 };
 }
 
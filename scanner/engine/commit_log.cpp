@@ -0,0 +1,118 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/commit_log.h"
+#include "scanner/engine/metadata.h"
+#include "scanner/util/storehouse.h"
+
+#include <glog/logging.h>
+
+using storehouse::StoreResult;
+using storehouse::WriteFile;
+using storehouse::RandomReadFile;
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+// A segment is written once this many items are pending
+const size_t SEGMENT_ITEMS = 64;
+
+// or the oldest pending item has waited this long
+const f64 SEGMENT_SECONDS = 5.0;
+
+const u64 ENTRY_SIZE = sizeof(i32) + sizeof(i64);
+}
+
+CommitLog::CommitLog(storehouse::StorageBackend* storage, i32 job_id,
+                     bool resume)
+  : storage_(storage), job_id_(job_id), last_flush_(now()) {
+  while (true) {
+    const std::string path = job_commit_log_path(job_id_, next_segment_);
+    std::unique_ptr<RandomReadFile> file;
+    StoreResult result;
+    EXP_BACKOFF(make_unique_random_read_file(storage_, path, file), result);
+    if (result == StoreResult::FileDoesNotExist) {
+      break;
+    }
+    exit_on_error(result);
+    if (resume) {
+      u64 size = 0;
+      BACKOFF_FAIL(file->get_size(size));
+      // A segment cut short by a crash loses only its partial last entry
+      u64 pos = 0;
+      while (pos + ENTRY_SIZE <= size) {
+        i32 table_id = s_read<i32>(file.get(), pos);
+        i64 item_id = s_read<i64>(file.get(), pos);
+        committed_.insert(std::make_tuple(table_id, item_id));
+      }
+    } else {
+      file.reset();
+      BACKOFF_FAIL(storage_->delete_file(path));
+    }
+    next_segment_++;
+  }
+  if (!resume) {
+    next_segment_ = 0;
+  }
+  VLOG(1) << "Job " << job_id_ << " has " << committed_.size()
+          << " saved items in " << next_segment_ << " log segments";
+}
+
+const std::set<std::tuple<i32, i64>>& CommitLog::committed() const {
+  return committed_;
+}
+
+void CommitLog::append(i32 table_id, i64 item_id) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  pending_.emplace_back(table_id, item_id);
+  appended_++;
+  if (pending_.size() >= SEGMENT_ITEMS ||
+      nano_since(last_flush_) / 1e9 >= SEGMENT_SECONDS) {
+    write_pending(lk);
+  }
+}
+
+i64 CommitLog::size() {
+  std::unique_lock<std::mutex> lk(mutex_);
+  return committed_.size() + appended_;
+}
+
+void CommitLog::flush() {
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (!pending_.empty()) {
+    write_pending(lk);
+  }
+}
+
+void CommitLog::write_pending(std::unique_lock<std::mutex>& lk) {
+  std::vector<std::tuple<i32, i64>> entries;
+  entries.swap(pending_);
+  i32 segment = next_segment_++;
+  last_flush_ = now();
+  lk.unlock();
+
+  std::unique_ptr<WriteFile> file;
+  BACKOFF_FAIL(make_unique_write_file(
+      storage_, job_commit_log_path(job_id_, segment), file));
+  for (auto& entry : entries) {
+    s_write(file.get(), std::get<0>(entry));
+    s_write(file.get(), std::get<1>(entry));
+  }
+  BACKOFF_FAIL(file->save());
+}
+}
+}
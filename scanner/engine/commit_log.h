@@ -0,0 +1,74 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+#include "scanner/util/util.h"
+
+#include "storehouse/storage_backend.h"
+
+#include <mutex>
+#include <set>
+#include <tuple>
+#include <vector>
+
+namespace scanner {
+namespace internal {
+
+/**
+ * @brief Durable record of the IO items of a job whose outputs are saved.
+ *
+ * Storage backends cannot append to a file, so the log is a series of small
+ * segment files in the job directory, each holding the items saved since the
+ * previous one. Items are buffered and a segment is written once enough of
+ * them are pending or enough time has passed, so at most that much work is
+ * redone when a job is resumed after a crash.
+ */
+class CommitLog {
+ public:
+  //! Reads the segments already written for job_id when resuming, otherwise
+  //! deletes any left over from an earlier job with the same id.
+  CommitLog(storehouse::StorageBackend* storage, i32 job_id, bool resume);
+
+  //! Items that were saved before this run, keyed by output table id and
+  //! item id
+  const std::set<std::tuple<i32, i64>>& committed() const;
+
+  void append(i32 table_id, i64 item_id);
+
+  //! Items saved before and during this run
+  i64 size();
+
+  //! Writes out everything appended so far
+  void flush();
+
+ private:
+  // Takes pending_ and the next segment number under mutex_ and writes them
+  // without it
+  void write_pending(std::unique_lock<std::mutex>& lk);
+
+  storehouse::StorageBackend* storage_;
+  const i32 job_id_;
+  std::set<std::tuple<i32, i64>> committed_;
+
+  std::mutex mutex_;
+  i32 next_segment_ = 0;
+  std::vector<std::tuple<i32, i64>> pending_;
+  i64 appended_ = 0;
+  timepoint_t last_flush_;
+};
+}
+}
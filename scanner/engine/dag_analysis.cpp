@@ -0,0 +1,644 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/dag_analysis.h"
+#include "scanner/engine/kernel_registry.h"
+#include "scanner/engine/op_registry.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <set>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+// 128 bit hex digest of s, from FNV-1a hashes of it read forwards and
+// backwards
+std::string digest(const std::string& s) {
+  const u64 prime = 1099511628211ull;
+  u64 forward = 14695981039346656037ull;
+  u64 backward = 0x6c62272e07bb0142ull;
+  for (size_t i = 0; i < s.size(); ++i) {
+    forward = (forward ^ (u8)s[i]) * prime;
+    backward = (backward ^ (u8)s[s.size() - 1 - i]) * prime;
+  }
+  char hex[33];
+  snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long)forward,
+           (unsigned long long)backward);
+  return hex;
+}
+
+// Appends field to key behind its length, so no two lists of fields make
+// the same key
+void add_field(std::string& key, const std::string& field) {
+  key += std::to_string(field.size()) + ":" + field;
+}
+}
+
+AnalysisResults analyze_dag(const proto::TaskSet& task_set) {
+  AnalysisResults results;
+
+  std::vector<std::vector<std::tuple<i32, std::string>>>& live_columns =
+      results.live_columns;
+  std::vector<std::vector<i32>>& dead_columns = results.dead_columns;
+  std::vector<std::vector<i32>>& unused_outputs = results.unused_outputs;
+  std::vector<std::vector<i32>>& column_mapping = results.column_mapping;
+  std::vector<std::vector<i32>>& op_inputs = results.op_inputs;
+
+  std::vector<i32>& warmup_sizes = results.warmup_sizes;
+  std::vector<i32>& batch_sizes = results.batch_sizes;
+  std::vector<std::vector<i32>>& stencils = results.stencils;
+
+  // Start off with the columns from the gathered tables
+  OpRegistry* op_registry = get_op_registry();
+  KernelRegistry* kernel_registry = get_kernel_registry();
+  auto& ops = task_set.ops();
+  std::map<i32, std::vector<std::tuple<std::string, i32>>> intermediates;
+  {
+    auto& input_op = ops.Get(0);
+    for (const std::string& input_col : input_op.inputs(0).columns()) {
+      // Set last used to first op so that all input ops are live to start
+      // with. Input columns which aren't used are removed beforehand by
+      // prune_task_set.
+      intermediates[0].push_back(std::make_tuple(input_col, 1));
+    }
+  }
+  op_inputs.resize(ops.size());
+  for (size_t i = 1; i < ops.size(); ++i) {
+    auto& op = ops.Get(i);
+    // For each input, update the intermediate last used index to the
+    // current index
+    for (auto& eval_input : op.inputs()) {
+      i32 parent_index = eval_input.op_index();
+      op_inputs[i].push_back(parent_index);
+      for (const std::string& parent_col : eval_input.columns()) {
+        bool found = false;
+        for (auto& kv : intermediates.at(parent_index)) {
+          if (std::get<0>(kv) == parent_col) {
+            found = true;
+            std::get<1>(kv) = i;
+            break;
+          }
+        }
+        assert(found);
+      }
+    }
+    if (i == ops.size() - 1) {
+      continue;
+    }
+    // Add this op's outputs to the intermediate list
+    const auto& op_info = op_registry->get_op_info(op.name());
+    for (const auto& output_column : op_info->output_columns()) {
+      intermediates[i].push_back(std::make_tuple(output_column.name(), i));
+    }
+    const auto& kernel_factory =
+        kernel_registry->get_kernel(op.name(), op.device_type());
+    // Use default batch if not specified
+    i32 batch_size =
+        op.batch() != -1 ? op.batch() : kernel_factory->preferred_batch_size();
+    batch_sizes.push_back(batch_size);
+    // Use default stencil if not specified
+    std::vector<i32> stencil;
+    if (op.stencil_size() > 0) {
+      stencil = std::vector<i32>(op.stencil().begin(), op.stencil().end());
+    } else {
+      stencil = op_info->preferred_stencil();
+    }
+    stencils.push_back(stencil);
+  }
+
+  // The live columns at each op index
+  live_columns.resize(ops.size());
+  for (size_t i = 0; i < ops.size(); ++i) {
+    i32 op_index = i;
+    auto& columns = live_columns[i];
+    size_t max_i = std::min((size_t)(ops.size() - 2), i);
+    for (size_t j = 0; j <= max_i; ++j) {
+      for (auto& kv : intermediates.at(j)) {
+        i32 last_used_index = std::get<1>(kv);
+        if (last_used_index > op_index) {
+          // Last used index is greater than current index, so still live
+          columns.push_back(std::make_tuple((i32)j, std::get<0>(kv)));
+        }
+      }
+    }
+  }
+
+  // The columns to remove for the current kernel
+  dead_columns.resize(ops.size() - 1);
+  // Outputs from the current kernel that are not used
+  unused_outputs.resize(ops.size() - 1);
+  // Indices in the live columns list that are the inputs to the current
+  // kernel. Starts from the second evalutor (index 1)
+  column_mapping.resize(ops.size() - 1);
+  for (size_t i = 1; i < ops.size(); ++i) {
+    i32 op_index = i;
+    auto& prev_columns = live_columns[i - 1];
+    auto& op = ops.Get(op_index);
+    // Determine which columns are no longer live
+    {
+      auto& unused = unused_outputs[i - 1];
+      auto& dead = dead_columns[i - 1];
+      size_t max_i = std::min((size_t)(ops.size() - 2), (size_t)i);
+      for (size_t j = 0; j <= max_i; ++j) {
+        i32 parent_index = j;
+        for (auto& kv : intermediates.at(j)) {
+          i32 last_used_index = std::get<1>(kv);
+          if (last_used_index == op_index) {
+            // Column is no longer live, so remove it.
+            const std::string& col_name = std::get<0>(kv);
+            if (j == i) {
+              // This op has an unused output
+              i32 col_index = -1;
+              const std::vector<Column>& op_cols =
+                  op_registry->get_op_info(op.name())->output_columns();
+              for (size_t k = 0; k < op_cols.size(); k++) {
+                if (col_name == op_cols[k].name()) {
+                  col_index = k;
+                  break;
+                }
+              }
+              assert(col_index != -1);
+              unused.push_back(col_index);
+            } else {
+              // Determine where in the previous live columns list this
+              // column existed
+              i32 col_index = -1;
+              for (i32 k = 0; k < (i32)prev_columns.size(); ++k) {
+                const std::tuple<i32, std::string>& live_input =
+                    prev_columns[k];
+                if (parent_index == std::get<0>(live_input) &&
+                    col_name == std::get<1>(live_input)) {
+                  col_index = k;
+                  break;
+                }
+              }
+              assert(col_index != -1);
+              dead.push_back(col_index);
+            }
+          }
+        }
+      }
+    }
+    auto& mapping = column_mapping[op_index - 1];
+    for (const auto& eval_input : op.inputs()) {
+      i32 parent_index = eval_input.op_index();
+      for (const std::string& col : eval_input.columns()) {
+        i32 col_index = -1;
+        for (i32 k = 0; k < (i32)prev_columns.size(); ++k) {
+          const std::tuple<i32, std::string>& live_input = prev_columns[k];
+          if (parent_index == std::get<0>(live_input) &&
+              col == std::get<1>(live_input)) {
+            col_index = k;
+            break;
+          }
+        }
+        assert(col_index != -1);
+        mapping.push_back(col_index);
+      }
+    }
+  }
+  return results;
+}
+
+void prune_task_set(proto::TaskSet& task_set) {
+  auto& ops = *task_set.mutable_ops();
+  i32 num_ops = ops.size();
+
+  // An op is live if a live op reads it, and the output op always is. So are
+  // filters and aggregates, since the rows they drop are dropped from the
+  // output.
+  OpRegistry* op_registry = get_op_registry();
+  std::vector<bool> live(num_ops, false);
+  live[num_ops - 1] = true;
+  for (i32 i = num_ops - 1; i > 0; --i) {
+    const std::string& name = ops.Get(i).name();
+    if (op_registry->has_op(name) &&
+        op_registry->get_op_info(name)->drops_rows()) {
+      live[i] = true;
+    }
+    if (!live[i]) {
+      continue;
+    }
+    for (auto& input : ops.Get(i).inputs()) {
+      live[input.op_index()] = true;
+    }
+  }
+  live[0] = true;
+
+  // Drop dead ops and renumber the inputs of the rest
+  std::vector<i32> new_index(num_ops, -1);
+  google::protobuf::RepeatedPtrField<proto::Op> live_ops;
+  for (i32 i = 0; i < num_ops; ++i) {
+    if (!live[i]) {
+      continue;
+    }
+    new_index[i] = live_ops.size();
+    proto::Op* op = live_ops.Add();
+    op->Swap(ops.Mutable(i));
+    for (auto& input : *op->mutable_inputs()) {
+      assert(new_index[input.op_index()] != -1);
+      input.set_op_index(new_index[input.op_index()]);
+    }
+  }
+  ops.Swap(&live_ops);
+
+  // Input columns that some op reads
+  std::set<std::string> used_columns;
+  for (i32 i = 1; i < ops.size(); ++i) {
+    for (auto& input : ops.Get(i).inputs()) {
+      if (input.op_index() == 0) {
+        used_columns.insert(input.columns().begin(), input.columns().end());
+      }
+    }
+  }
+  auto remove_unused = [&](google::protobuf::RepeatedPtrField<std::string>&
+                               columns) {
+    google::protobuf::RepeatedPtrField<std::string> kept;
+    for (const std::string& col : columns) {
+      if (used_columns.count(col) > 0) {
+        kept.Add()->assign(col);
+      }
+    }
+    columns.Swap(&kept);
+  };
+  for (auto& task : *task_set.mutable_tasks()) {
+    for (auto& sample : *task.mutable_samples()) {
+      auto& columns = *sample.mutable_column_names();
+      bool any_used = false;
+      for (const std::string& col : columns) {
+        any_used |= used_columns.count(col) > 0;
+      }
+      if (!any_used && columns.size() > 0) {
+        used_columns.insert(columns.Get(0));
+      }
+    }
+  }
+  for (auto& task : *task_set.mutable_tasks()) {
+    for (auto& sample : *task.mutable_samples()) {
+      remove_unused(*sample.mutable_column_names());
+    }
+  }
+  for (auto& input : *ops.Mutable(0)->mutable_inputs()) {
+    remove_unused(*input.mutable_columns());
+  }
+}
+
+std::vector<std::map<std::string, std::string>> memo_keys(
+    const proto::TaskSet& task_set, const proto::Task& task,
+    const std::map<std::string, std::string>& table_versions) {
+  OpRegistry* op_registry = get_op_registry();
+  auto& ops = task_set.ops();
+  std::vector<std::map<std::string, std::string>> keys(ops.size());
+  for (i32 i = 1; i < ops.size(); ++i) {
+    for (auto& input : ops.Get(i).inputs()) {
+      for (const std::string& col : input.columns()) {
+        keys[input.op_index()][col];
+      }
+    }
+  }
+
+  for (auto& sample : task.samples()) {
+    auto version = table_versions.find(sample.table_name());
+    for (const std::string& col : sample.column_names()) {
+      auto it = keys[0].find(col);
+      if (it == keys[0].end()) {
+        continue;
+      }
+      std::string key;
+      add_field(key, sample.table_name());
+      add_field(key,
+                version != table_versions.end() ? version->second : "");
+      add_field(key, col);
+      add_field(key, sample.sampling_function());
+      add_field(key, sample.sampling_args());
+      it->second = digest(key);
+    }
+  }
+
+  for (i32 i = 1; i < ops.size() - 1; ++i) {
+    auto& op = ops.Get(i);
+    std::string key;
+    add_field(key, op.name());
+    add_field(key, std::to_string(
+                       op_registry->has_op(op.name())
+                           ? op_registry->get_op_info(op.name())->version()
+                           : 0));
+    add_field(key, op.kernel_args());
+    std::string stencil;
+    for (i32 s : op.stencil()) {
+      stencil += std::to_string(s) + ",";
+    }
+    add_field(key, stencil);
+    add_field(key, std::to_string(op.warmup()));
+    for (auto& input : op.inputs()) {
+      for (const std::string& col : input.columns()) {
+        add_field(key, keys[input.op_index()].at(col));
+      }
+    }
+    std::string op_key = digest(key);
+    for (auto& kv : keys[i]) {
+      std::string column_key;
+      add_field(column_key, op_key);
+      add_field(column_key, kv.first);
+      kv.second = digest(column_key);
+    }
+  }
+  return keys;
+}
+
+void read_memoized_columns(proto::TaskSet& task_set,
+                           const std::vector<MemoizedColumns>& memoized) {
+  if (memoized.empty()) {
+    return;
+  }
+  auto& ops = *task_set.mutable_ops();
+
+  // Op output -> name of the input column it is loaded as
+  std::map<std::tuple<i32, std::string>, std::string> loaded;
+  std::set<std::string> input_columns;
+  for (auto& input : ops.Get(0).inputs()) {
+    input_columns.insert(input.columns().begin(), input.columns().end());
+  }
+  for (auto& kv : memoized[0]) {
+    const std::string& name = std::get<1>(kv.second);
+    bool everywhere = input_columns.count(name) == 0;
+    for (size_t t = 1; everywhere && t < memoized.size(); ++t) {
+      auto it = memoized[t].find(kv.first);
+      everywhere =
+          it != memoized[t].end() && std::get<1>(it->second) == name;
+    }
+    if (everywhere) {
+      loaded[kv.first] = name;
+      input_columns.insert(name);
+    }
+  }
+  if (loaded.empty()) {
+    return;
+  }
+
+  // Point the ops at the loaded columns, splitting their inputs so the
+  // columns keep their order
+  for (i32 i = 1; i < ops.size(); ++i) {
+    proto::Op* op = ops.Mutable(i);
+    bool reads_loaded = false;
+    for (auto& input : op->inputs()) {
+      for (const std::string& col : input.columns()) {
+        reads_loaded |=
+            loaded.count(std::make_tuple(input.op_index(), col)) > 0;
+      }
+    }
+    if (!reads_loaded) {
+      continue;
+    }
+    google::protobuf::RepeatedPtrField<proto::OpInput> inputs;
+    for (auto& input : op->inputs()) {
+      for (const std::string& col : input.columns()) {
+        auto it = loaded.find(std::make_tuple(input.op_index(), col));
+        i32 op_index = it != loaded.end() ? 0 : input.op_index();
+        if (inputs.size() == 0 ||
+            inputs.Get(inputs.size() - 1).op_index() != op_index) {
+          inputs.Add()->set_op_index(op_index);
+        }
+        inputs.Mutable(inputs.size() - 1)
+            ->add_columns(it != loaded.end() ? it->second : col);
+      }
+    }
+    op->mutable_inputs()->Swap(&inputs);
+  }
+
+  // The InputTable op's columns follow the order of the samples
+  proto::OpInput* input = ops.Mutable(0)->mutable_inputs(0);
+  for (auto& kv : loaded) {
+    input->add_columns(kv.second);
+  }
+  for (i32 t = 0; t < task_set.tasks_size(); ++t) {
+    proto::Task* task = task_set.mutable_tasks(t);
+    const proto::TableSample first = task->samples(0);
+    for (auto& kv : loaded) {
+      proto::TableSample* sample = task->add_samples();
+      sample->set_table_name(std::get<0>(memoized[t].at(kv.first)));
+      sample->add_column_names(kv.second);
+      sample->set_sampling_function(first.sampling_function());
+      sample->set_sampling_args(first.sampling_args());
+    }
+  }
+}
+
+i64 producible_rows(const RowSet& valid_rows, const RowSet& compute_rows,
+                    const std::vector<i32>& stencil, i64 pos,
+                    i64 last_cached) {
+  // A row must be in the cache itself, and a computed one also the end of
+  // its stencil
+  i64 end = valid_rows.upper_index(last_cached);
+  i64 reach = std::max(stencil.back(), 0);
+  i64 first_short = compute_rows.next_row(last_cached - reach + 1);
+  if (first_short != -1 && first_short <= last_cached) {
+    end = valid_rows.upper_index(first_short - 1);
+  }
+  return std::max(end - pos, (i64)0);
+}
+
+std::vector<i64> derive_work_item_sizes(
+    const std::vector<std::vector<i32>>& stencils,
+    const std::vector<i32>& batch_sizes, i64 num_rows,
+    const std::deque<TaskStream>& task_streams, i64 last_row,
+    i64 initial_work_item_size) {
+  i64 num_kernels = stencils.size();
+  // Compute the required work item sizes to produce the minimal amount of
+  // output for each invocation of the kernels
+  std::vector<i64> work_item_sizes;
+  // Lists the last row that the stencil cache would have seen
+  // at this point
+  std::vector<i64> last_stencil_cache_row(num_kernels + 1, -1);
+  std::vector<size_t> produced_rows(num_kernels + 1);
+
+  size_t num_input_rows = task_streams.front().valid_output_rows.size();
+  size_t num_output_rows = task_streams.back().valid_output_rows.size();
+  while (produced_rows.front() < num_input_rows) {
+    i64 work_item_size = initial_work_item_size;
+    // For each kernel, determine which rows of input it needs given the
+    // current stencil cache and position in required rows
+    for (i64 k = num_kernels; k >= 1; k--) {
+      const TaskStream& prev_s = task_streams[k - 1];
+      const TaskStream& s = task_streams[k];
+      size_t pos = produced_rows[k];
+      const std::vector<i32> stencil = stencils[k - 1];
+      i64 batch_size = batch_sizes[k - 1];
+
+      // If the kernel is batched, we need to make sure we round up to
+      // request a batch of input.
+      if (work_item_size % batch_size != 0) {
+        work_item_size += (batch_size - work_item_size % batch_size);
+      }
+
+      // If we are at the end of the task, then we can not provide
+      // a full batch and must provide a partial one
+      if (pos + work_item_size > prev_s.valid_output_rows.size()) {
+        work_item_size = s.valid_output_rows.size() - pos;
+      }
+
+      // Compute which input rows are needed for the batch of outputs.
+      // Every row passes through from upstream, and the computed ones
+      // also need their stencil.
+      RowSet batch_rows =
+          s.valid_output_rows.slice(pos, pos + work_item_size);
+      RowSet required_input_rows =
+          batch_rows.intersect(s.compute_rows)
+              .expand(stencil, num_rows)
+              .unite(batch_rows);
+
+      // For all the rows not in the stencil cache, we will request them
+      // from the upstream kernel by setting the work item size
+      i64 rows_to_request =
+          required_input_rows.size() -
+          required_input_rows.upper_index(last_stencil_cache_row[k - 1]);
+      assert(rows_to_request > 0);
+      work_item_size = rows_to_request;
+    }
+    // Without kernels nothing above bounds the item by the rows left
+    work_item_size = std::min(work_item_size,
+                              (i64)(num_input_rows - produced_rows[0]));
+    produced_rows[0] += work_item_size;
+    last_stencil_cache_row[0] =
+        task_streams[0].valid_output_rows[produced_rows[0] - 1];
+    assert(produced_rows[0] > 0);
+    work_item_sizes.push_back(work_item_size);
+
+    // Propagate downward what rows will be in the stencil cache due to the
+    // computed number of rows of input
+    for (i64 k = 1; k < num_kernels + 1; k++) {
+      const TaskStream& ts = task_streams[k];
+      size_t& pos = produced_rows[k];
+      const std::vector<i32>& stencil = stencils[k - 1];
+      i64 batch_size = batch_sizes[k - 1];
+
+      // Figure out how many rows will be produced given work_item_size
+      // inputs
+      i64 rows = producible_rows(ts.valid_output_rows, ts.compute_rows,
+                                 stencil, pos,
+                                 last_stencil_cache_row[k - 1]);
+      assert(pos + rows - 1 < ts.valid_output_rows.size());
+      // Round down if we don't have enough for a batch unless this is
+      // the end of the task
+      if (rows % batch_size != 0 &&
+          ts.valid_output_rows[pos + rows - 1] != last_row) {
+        rows -= (rows % batch_size);
+      }
+      assert(rows > 0);
+
+      // Update how many rows we have produced
+      pos += rows;
+      assert(pos > 0);
+      last_stencil_cache_row[k] = ts.valid_output_rows[pos - 1];
+
+      // Send the rows to the next kernel
+      work_item_size = rows;
+    }
+  }
+  return work_item_sizes;
+}
+
+void derive_stencil_requirements(storehouse::StorageBackend* storage,
+                                 const AnalysisResults& analysis_results,
+                                 const LoadWorkEntry& load_work_entry,
+                                 const std::vector<std::vector<i32>>& stencils,
+                                 i64 initial_work_item_size,
+                                 LoadWorkEntry& output_entry,
+                                 std::deque<TaskStream>& task_streams) {
+  output_entry.set_io_item_index(load_work_entry.io_item_index());
+
+  i64 num_kernels = stencils.size();
+
+  const proto::LoadSample& sample = load_work_entry.samples(0);
+  i64 last_row = sample.rows(sample.rows_size() - 1);
+  std::string table_path = TableMetadata::descriptor_path(sample.table_id());
+  TableMetadata meta = read_table_metadata(storage, table_path);
+  i64 num_rows = meta.num_rows();
+  RowSet output_rows;
+  for (i64 r : sample.rows()) {
+    output_rows.append(r);
+  }
+  derive_row_requirements(analysis_results.op_inputs, stencils, num_rows,
+                          output_rows, task_streams);
+  const RowSet& current_rows = task_streams.front().valid_output_rows;
+
+  std::vector<i64> work_item_sizes = derive_work_item_sizes(
+      analysis_results.stencils, analysis_results.batch_sizes, num_rows,
+      task_streams, last_row, initial_work_item_size);
+
+  // Get rid of input stream since this is already captured by the load samples
+  task_streams.pop_front();
+
+  for (i64 r : work_item_sizes) {
+    output_entry.add_work_item_sizes(r);
+  }
+
+  for (const proto::LoadSample& sample : load_work_entry.samples()) {
+    auto out_sample = output_entry.add_samples();
+    out_sample->set_table_id(sample.table_id());
+    out_sample->mutable_column_ids()->CopyFrom(sample.column_ids());
+    out_sample->set_warmup_size(sample.warmup_size());
+    std::vector<i64> rows = current_rows.to_vector();
+    google::protobuf::RepeatedField<i64> data(rows.begin(), rows.end());
+    out_sample->mutable_rows()->Swap(&data);
+  }
+}
+
+
+void derive_row_requirements(const std::vector<std::vector<i32>>& op_inputs,
+                             const std::vector<std::vector<i32>>& stencils,
+                             i64 num_rows, const RowSet& output_rows,
+                             std::deque<TaskStream>& task_streams) {
+  i64 num_ops = op_inputs.size();
+  i64 num_kernels = num_ops - 2;
+  std::vector<std::set<i32>> consumers(num_ops);
+  for (i64 c = 1; c < num_ops; ++c) {
+    for (i32 p : op_inputs[c]) {
+      consumers[p].insert(c);
+    }
+  }
+
+  // Walk the ops from the output back, so every consumer of an op has
+  // already decided which of its rows it reads
+  std::vector<RowSet> compute_rows(num_ops);
+  std::vector<RowSet> input_rows(num_ops);
+  compute_rows[num_ops - 1] = output_rows;
+  input_rows[num_ops - 1] = output_rows;
+  for (i64 op = num_ops - 2; op >= 1; --op) {
+    for (i32 c : consumers[op]) {
+      compute_rows[op] = compute_rows[op].unite(input_rows[c]);
+    }
+    input_rows[op] = compute_rows[op].expand(stencils[op - 1], num_rows);
+  }
+
+  // A kernel carries every row a later op reads
+  RowSet carried = input_rows[num_ops - 1];
+  for (i64 k = num_kernels - 1; k >= 0; --k) {
+    TaskStream s;
+    s.valid_output_rows = carried;
+    s.compute_rows = compute_rows[k + 1];
+    task_streams.push_front(s);
+    carried = carried.unite(input_rows[k + 1]);
+  }
+  TaskStream input;
+  input.valid_output_rows = carried;
+  input.compute_rows = carried;
+  task_streams.push_front(input);
+}
+}
+}
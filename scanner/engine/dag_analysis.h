@@ -0,0 +1,123 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/engine/metadata.h"
+#include "scanner/engine/runtime.h"
+#include "scanner/util/common.h"
+#include "scanner/util/row_set.h"
+
+#include "storehouse/storage_backend.h"
+
+#include <deque>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace scanner {
+namespace internal {
+
+struct AnalysisResults {
+  std::vector<std::vector<std::tuple<i32, std::string>>> live_columns;
+  std::vector<std::vector<i32>> dead_columns;
+  std::vector<std::vector<i32>> unused_outputs;
+  std::vector<std::vector<i32>> column_mapping;
+  // Indices of the ops each op reads from
+  std::vector<std::vector<i32>> op_inputs;
+
+  std::vector<i32> warmup_sizes;
+  std::vector<i32> batch_sizes;
+  std::vector<std::vector<i32>> stencils;
+};
+
+AnalysisResults analyze_dag(const proto::TaskSet& task_set);
+
+//! Removes what a valid task set computes or loads without using: ops none
+//! of whose outputs are read, and input columns that no op reads. The input
+//! columns go from the InputTable op and from the samples of every task, so
+//! they are never read from storage or decoded. A sample keeps its first
+//! column if no op reads any of its columns, since it still sets the rows.
+void prune_task_set(proto::TaskSet& task_set);
+
+//! Per op -> output column -> content key of that column when task_set runs
+//! task. Two jobs compute the same rows in columns with the same key. An
+//! op's key covers its name, version, arguments, stencil and warmup and the
+//! keys of the columns it reads, and an input column's covers its table's
+//! version, as given by table_versions, and the task's sampling of it. Only
+//! the columns that some op reads get keys.
+std::vector<std::map<std::string, std::string>> memo_keys(
+    const proto::TaskSet& task_set, const proto::Task& task,
+    const std::map<std::string, std::string>& table_versions);
+
+//! Op index and output column -> table and column holding that output
+using MemoizedColumns = std::map<std::tuple<i32, std::string>,
+                                 std::tuple<std::string, std::string>>;
+
+//! Makes the ops of a task set read op outputs that earlier jobs memoized
+//! from the tables holding them, where memoized has the outputs found for
+//! each task. An output is only loaded if it was found for every task under
+//! one column name that the task set does not load already. Each loaded
+//! column gets a sample of its own, sampled like the task's first sample.
+//! Ops that nothing reads anymore are left for prune_task_set.
+void read_memoized_columns(proto::TaskSet& task_set,
+                           const std::vector<MemoizedColumns>& memoized);
+
+//! Determines the rows each kernel must carry and compute so the output op
+//! receives output_rows, where kernel k is op k + 1 and has stencils[k].
+//!
+//! An op only computes the rows its own consumers read through their
+//! stencils. Every live column moves through the kernels together, so a
+//! kernel also carries the rows later ops need, and leaves null elements in
+//! the ones it does not compute. Rows whose stencil would fall outside
+//! [0, num_rows) are not expanded.
+//!
+//! Fills task_streams with one stream for the input op, holding the rows to
+//! load, followed by one per kernel.
+void derive_row_requirements(const std::vector<std::vector<i32>>& op_inputs,
+                             const std::vector<std::vector<i32>>& stencils,
+                             i64 num_rows, const RowSet& output_rows,
+                             std::deque<TaskStream>& task_streams);
+
+//! Number of valid_rows, starting at index pos, that a kernel computing
+//! compute_rows with stencil can produce once its stencil cache holds the
+//! rows up to last_cached
+i64 producible_rows(const RowSet& valid_rows, const RowSet& compute_rows,
+                    const std::vector<i32>& stencil, i64 pos,
+                    i64 last_cached);
+
+//! Number of rows of the input stream to load for each work item, so each
+//! kernel gets about initial_work_item_size rows at a time without
+//! recomputing rows already in its stencil cache. task_streams holds the
+//! input stream and then one per kernel, which has stencils[k] and
+//! batch_sizes[k], num_rows is the size of the sampled table and last_row
+//! the task's last output row. With no kernels, the input stream is split
+//! into items of initial_work_item_size rows.
+std::vector<i64> derive_work_item_sizes(
+    const std::vector<std::vector<i32>>& stencils,
+    const std::vector<i32>& batch_sizes, i64 num_rows,
+    const std::deque<TaskStream>& task_streams, i64 last_row,
+    i64 initial_work_item_size);
+
+void derive_stencil_requirements(storehouse::StorageBackend* storage,
+                                 const AnalysisResults& analysis_results,
+                                 const LoadWorkEntry& load_work_entry,
+                                 const std::vector<std::vector<i32>>& stencils,
+                                 i64 initial_work_item_size,
+                                 LoadWorkEntry& output_entry,
+                                 std::deque<TaskStream>& task_streams);
+}
+}
@@ -0,0 +1,226 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/dag_analysis.h"
+
+#include <gtest/gtest.h>
+
+namespace scanner {
+namespace internal {
+
+TEST(DagAnalysis, LinearDAG) {
+  // Input -> Blur(-1, 0, 1) -> Histogram -> Output
+  std::vector<std::vector<i32>> op_inputs = {{}, {0}, {1}, {2}};
+  std::vector<std::vector<i32>> stencils = {{-1, 0, 1}, {0}};
+  std::deque<TaskStream> streams;
+  derive_row_requirements(op_inputs, stencils, 100, RowSet({10, 20}),
+                          streams);
+
+  ASSERT_EQ(streams.size(), 3);
+  EXPECT_EQ(streams[0].valid_output_rows.to_vector(),
+            std::vector<i64>({9, 10, 11, 19, 20, 21}));
+  EXPECT_EQ(streams[1].valid_output_rows.to_vector(),
+            std::vector<i64>({10, 20}));
+  EXPECT_EQ(streams[1].compute_rows.size(), 2);
+  EXPECT_EQ(streams[2].valid_output_rows.to_vector(),
+            std::vector<i64>({10, 20}));
+  EXPECT_EQ(streams[2].compute_rows.size(), 2);
+}
+
+TEST(DagAnalysis, NonLinearDAG) {
+  // Input -> Decode -> Flow(-1, 0, 1) -> Output
+  //   \-> Histogram ------------------/
+  // Histogram runs between Decode and Flow, so it carries the neighbouring
+  // rows Flow needs but only computes the sampled ones.
+  std::vector<std::vector<i32>> op_inputs = {{}, {0}, {0}, {1}, {2, 3}};
+  std::vector<std::vector<i32>> stencils = {{0}, {0}, {-1, 0, 1}};
+  std::vector<i64> output_rows = {10, 20, 30};
+  std::deque<TaskStream> streams;
+  derive_row_requirements(op_inputs, stencils, 100, RowSet(output_rows),
+                          streams);
+
+  ASSERT_EQ(streams.size(), 4);
+  std::vector<i64> neighbourhood = {9, 10, 11, 19, 20, 21, 29, 30, 31};
+  // Only Flow's neighbourhood is loaded
+  EXPECT_EQ(streams[0].valid_output_rows.to_vector(), neighbourhood);
+  // Decode feeds Flow, so computes the whole neighbourhood
+  EXPECT_EQ(streams[1].valid_output_rows.to_vector(), neighbourhood);
+  EXPECT_EQ(streams[1].compute_rows.size(), 9);
+  // Histogram carries the neighbourhood but only computes the output rows
+  EXPECT_EQ(streams[2].valid_output_rows.to_vector(), neighbourhood);
+  EXPECT_EQ(streams[2].compute_rows.size(), 3);
+  EXPECT_EQ(streams[2].compute_rows.to_vector(), output_rows);
+  EXPECT_EQ(streams[3].valid_output_rows.to_vector(), output_rows);
+  EXPECT_EQ(streams[3].compute_rows.size(), 3);
+}
+
+TEST(DagAnalysis, StencilsStopAtTableBounds) {
+  std::vector<std::vector<i32>> op_inputs = {{}, {0}, {1}};
+  std::vector<std::vector<i32>> stencils = {{-1, 0, 1}};
+  std::deque<TaskStream> streams;
+  derive_row_requirements(op_inputs, stencils, 10, RowSet({0, 5, 9}),
+                          streams);
+
+  ASSERT_EQ(streams.size(), 2);
+  EXPECT_EQ(streams[0].valid_output_rows.to_vector(),
+            std::vector<i64>({0, 4, 5, 6, 9}));
+}
+
+TEST(DagAnalysis, DenseItemIsOneRunPerStream) {
+  std::vector<std::vector<i32>> op_inputs = {{}, {0}, {1}, {2}};
+  std::vector<std::vector<i32>> stencils = {{-2, -1, 0, 1, 2}, {0}};
+  std::deque<TaskStream> streams;
+  derive_row_requirements(op_inputs, stencils, 10000, RowSet::range(250, 500),
+                          streams);
+
+  ASSERT_EQ(streams.size(), 3);
+  for (const TaskStream& stream : streams) {
+    EXPECT_EQ(stream.valid_output_rows.runs().size(), 1);
+    EXPECT_EQ(stream.compute_rows.runs().size(), 1);
+  }
+  EXPECT_EQ(streams[0].valid_output_rows.front(), 248);
+  EXPECT_EQ(streams[0].valid_output_rows.back(), 501);
+
+  // With rows up to 300 loaded, the stencil reaches rows up to 298
+  EXPECT_EQ(producible_rows(streams[1].valid_output_rows,
+                            streams[1].compute_rows, stencils[0], 0, 300),
+            49);
+}
+
+TEST(DagAnalysis, WorkItemSizes) {
+  // Input -> Blur(-1, 0, 1) -> Output
+  std::vector<std::vector<i32>> op_inputs = {{}, {0}, {1}};
+  std::vector<std::vector<i32>> stencils = {{-1, 0, 1}};
+  std::deque<TaskStream> streams;
+  derive_row_requirements(op_inputs, stencils, 30, RowSet::range(0, 30),
+                          streams);
+
+  // The first item also loads row 25, which Blur needs for row 24
+  EXPECT_EQ(derive_work_item_sizes(stencils, {1}, 30, streams, 29, 25),
+            std::vector<i64>({26, 4}));
+}
+
+TEST(DagAnalysis, WorkItemSizesWithoutKernels) {
+  // Input -> Output, e.g. once every op was pruned
+  std::vector<std::vector<i32>> op_inputs = {{}, {0}};
+  std::deque<TaskStream> streams;
+  derive_row_requirements(op_inputs, {}, 100, RowSet::range(0, 30), streams);
+
+  ASSERT_EQ(streams.size(), 1);
+  EXPECT_EQ(derive_work_item_sizes({}, {}, 100, streams, 29, 25),
+            std::vector<i64>({25, 5}));
+}
+
+TEST(DagAnalysis, PruneTaskSet) {
+  // Input(frame, audio, meta) -> Histogram(frame) -> Output
+  //                           \-> Spectrum(audio), never read
+  proto::TaskSet task_set;
+  proto::Task* task = task_set.add_tasks();
+  proto::TableSample* video = task->add_samples();
+  video->add_column_names("frame");
+  video->add_column_names("audio");
+  proto::TableSample* labels = task->add_samples();
+  labels->add_column_names("meta");
+  auto add_op = [&](const std::string& name, i32 input,
+                    std::vector<std::string> columns) {
+    proto::Op* op = task_set.add_ops();
+    op->set_name(name);
+    proto::OpInput* op_input = op->add_inputs();
+    op_input->set_op_index(input);
+    for (const std::string& col : columns) {
+      op_input->add_columns(col);
+    }
+  };
+  add_op("InputTable", 0, {"frame", "audio", "meta"});
+  add_op("Histogram", 0, {"frame"});
+  add_op("Spectrum", 0, {"audio"});
+  add_op("OutputTable", 1, {"histogram"});
+
+  prune_task_set(task_set);
+
+  ASSERT_EQ(task_set.ops_size(), 3);
+  EXPECT_EQ(task_set.ops(1).name(), "Histogram");
+  EXPECT_EQ(task_set.ops(2).inputs(0).op_index(), 1);
+  ASSERT_EQ(task_set.ops(0).inputs(0).columns_size(), 2);
+  EXPECT_EQ(task_set.ops(0).inputs(0).columns(0), "frame");
+  // Nothing reads the second sample, but it still sets the rows
+  EXPECT_EQ(task_set.ops(0).inputs(0).columns(1), "meta");
+  ASSERT_EQ(task_set.tasks(0).samples(0).column_names_size(), 1);
+  EXPECT_EQ(task_set.tasks(0).samples(0).column_names(0), "frame");
+  ASSERT_EQ(task_set.tasks(0).samples(1).column_names_size(), 1);
+}
+
+TEST(DagAnalysis, ReadMemoizedColumns) {
+  // Input(frame) -> Histogram(frame) -> Output, for two videos
+  proto::TaskSet task_set;
+  for (const std::string& table : {"a", "b"}) {
+    proto::TableSample* sample = task_set.add_tasks()->add_samples();
+    sample->set_table_name(table);
+    sample->add_column_names("frame");
+    sample->set_sampling_function("All");
+  }
+  auto add_op = [&](const std::string& name, i32 input,
+                    const std::string& column) {
+    proto::Op* op = task_set.add_ops();
+    op->set_name(name);
+    proto::OpInput* op_input = op->add_inputs();
+    op_input->set_op_index(input);
+    op_input->add_columns(column);
+  };
+  add_op("InputTable", 0, "frame");
+  add_op("Histogram", 0, "frame");
+  add_op("OutputTable", 1, "histogram");
+
+  std::map<std::string, std::string> versions = {{"a", "1"}, {"b", "2"}};
+  auto keys = memo_keys(task_set, task_set.tasks(0), versions);
+  EXPECT_EQ(keys[1].at("histogram"),
+            memo_keys(task_set, task_set.tasks(0), versions)[1].at(
+                "histogram"));
+  EXPECT_NE(keys[1].at("histogram"),
+            memo_keys(task_set, task_set.tasks(1), versions)[1].at(
+                "histogram"));
+  versions["a"] = "3";
+  EXPECT_NE(keys[1].at("histogram"),
+            memo_keys(task_set, task_set.tasks(0), versions)[1].at(
+                "histogram"));
+  task_set.mutable_ops(1)->set_kernel_args("bins=8");
+  EXPECT_NE(keys[1].at("histogram"),
+            memo_keys(task_set, task_set.tasks(0), versions)[1].at(
+                "histogram"));
+
+  // Only memoized for one task, so still computed
+  std::vector<MemoizedColumns> memoized(2);
+  memoized[0][std::make_tuple(1, "histogram")] =
+      std::make_tuple("a_hist", "histogram");
+  proto::TaskSet partial = task_set;
+  read_memoized_columns(partial, memoized);
+  EXPECT_EQ(partial.SerializeAsString(), task_set.SerializeAsString());
+
+  memoized[1][std::make_tuple(1, "histogram")] =
+      std::make_tuple("b_hist", "histogram");
+  read_memoized_columns(task_set, memoized);
+  prune_task_set(task_set);
+
+  ASSERT_EQ(task_set.ops_size(), 2);
+  EXPECT_EQ(task_set.ops(1).inputs(0).op_index(), 0);
+  EXPECT_EQ(task_set.ops(1).inputs(0).columns(0), "histogram");
+  ASSERT_EQ(task_set.ops(0).inputs(0).columns_size(), 2);
+  EXPECT_EQ(task_set.ops(0).inputs(0).columns(1), "histogram");
+  ASSERT_EQ(task_set.tasks(1).samples_size(), 2);
+  EXPECT_EQ(task_set.tasks(1).samples(1).table_name(), "b_hist");
+  EXPECT_EQ(task_set.tasks(1).samples(1).sampling_function(), "All");
+}
+}
+}
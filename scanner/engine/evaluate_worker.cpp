@@ -1,4 +1,5 @@
 #include "scanner/engine/evaluate_worker.h"
+#include "scanner/engine/dag_analysis.h"
 
 #include "scanner/engine/op_registry.h"
 #include "scanner/util/cuda.h"
@@ -18,12 +19,12 @@ PreEvaluateWorker::PreEvaluateWorker(const PreEvaluateWorkerArgs& args)
     profiler_(args.profiler) {
 }
 
-void PreEvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
+void PreEvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>&& entry) {
   auto feed_start = now();
 
-  entry_ = entry;
-  IOItem& io_item = std::get<0>(entry);
-  EvalWorkEntry& work_entry = std::get<1>(entry);
+  entry_ = std::move(entry);
+  IOItem& io_item = std::get<0>(entry_);
+  EvalWorkEntry& work_entry = std::get<1>(entry_);
 
 
   needs_configure_ = !(io_item.table_id() == last_table_id_);
@@ -172,7 +173,7 @@ bool PreEvaluateWorker::yield(i32 item_size,
                                    work_entry.row_ids.begin() + end);
   profiler_.add_interval("yield", yield_start, now());
 
-  output_entry = std::make_tuple(io_item, entry);
+  output_entry = std::make_tuple(io_item, std::move(entry));
   return true;
 }
 
@@ -180,6 +181,9 @@ EvaluateWorker::EvaluateWorker(const EvaluateWorkerArgs& args)
   : node_id_(args.node_id),
     worker_id_(worker_id_),
     profiler_(args.profiler),
+    kernel_pool_(args.kernel_pool),
+    coalesce_timeout_ms_(args.coalesce_timeout_ms),
+    drop_filtered_rows_(args.drop_filtered_rows),
     kernel_factories_(args.kernel_factories),
     live_columns_(args.live_columns),
     dead_columns_(args.dead_columns),
@@ -197,9 +201,10 @@ EvaluateWorker::EvaluateWorker(const EvaluateWorkerArgs& args)
       KernelFactory* factory = std::get<0>(kernel_factories_[i]);
       const KernelConfig& config = std::get<1>(kernel_factories_[i]);
       kernel_devices_.push_back(config.devices[0]);
-      kernel_num_outputs_.push_back(registry->get_op_info(factory->get_op_name())
-                                       ->output_columns()
-                                       .size());
+      OpInfo* op_info = registry->get_op_info(factory->get_op_name());
+      kernel_num_outputs_.push_back(op_info->output_columns().size());
+      kernel_is_filter_.push_back(op_info->is_filter());
+      kernel_is_aggregate_.push_back(op_info->is_aggregate());
 
 #ifdef HAVE_CUDA
       cudaSetDevice(0);
@@ -211,10 +216,15 @@ EvaluateWorker::EvaluateWorker(const EvaluateWorkerArgs& args)
         VLOG(1) << "Kernel validate failed: " << args.result.msg();
         THREAD_RETURN_SUCCESS();
       }
+      LOG_IF(FATAL, op_info->is_aggregate() &&
+                        dynamic_cast<AggregateKernel*>(kernel) == nullptr)
+          << "Kernel of aggregate op " << factory->get_op_name()
+          << " is not an AggregateKernel";
       kernels_.emplace_back(kernel);
     }
   }
   assert(kernels_.size() > 0);
+  kernel_replicas_.resize(kernels_.size());
 
   for (auto& kernel : kernels_) {
     kernel->set_profiler(&args.profiler);
@@ -230,6 +240,28 @@ EvaluateWorker::EvaluateWorker(const EvaluateWorkerArgs& args)
   }
   valid_output_rows_.resize(kernel_factories_.size());
   current_valid_idx_.assign(kernel_factories_.size(), 0);
+
+  // A chain of CPU kernels that each read only their own row is fused, so
+  // rows go through all of them a batch at a time. If every kernel is
+  // parallel, the slices of rows are split over the kernel pool instead of
+  // the batches of each kernel, so a slice still stays in one core's cache.
+  bool fusable = kernels_.size() > 1 && coalesce_timeout_ms_ <= 0;
+  bool all_parallel = kernel_pool_ != nullptr;
+  i64 fused_rows = 1;
+  for (size_t k = 0; k < kernels_.size(); ++k) {
+    const std::vector<i32>& stencil = kernel_stencils_[k];
+    fusable &= kernel_devices_[k].type == DeviceType::CPU &&
+               stencil.size() == 1 && stencil[0] == 0;
+    all_parallel &= std::get<0>(kernel_factories_[k])->parallel() &&
+                    !kernel_is_aggregate_[k];
+    fused_rows = std::max(fused_rows, (i64)kernel_batch_sizes_[k]);
+  }
+  // Every kernel must still see whole batches
+  for (i32 batch_size : kernel_batch_sizes_) {
+    fusable &= batch_size <= 1 || fused_rows % batch_size == 0;
+  }
+  fused_rows_ = fusable ? fused_rows : 0;
+  fused_on_pool_ = fusable && all_parallel;
 }
 
 void EvaluateWorker::new_task(const std::vector<TaskStream>& task_streams) {
@@ -237,24 +269,33 @@ void EvaluateWorker::new_task(const std::vector<TaskStream>& task_streams) {
     assert(valid_output_rows_[i].size() == current_valid_idx_[i]);
   }
   valid_output_rows_.clear();
-  valid_output_rows_set_.clear();
+  compute_rows_.clear();
   current_valid_idx_.clear();
   for (auto& ts : task_streams) {
     valid_output_rows_.push_back(ts.valid_output_rows);
-    valid_output_rows_set_.push_back(std::set<i64>(ts.valid_output_rows.begin(),
-                                                   ts.valid_output_rows.end()));
+    compute_rows_.push_back(ts.compute_rows);
     current_valid_idx_.push_back(0);
   }
+  // A filter judges every row it carries, since any of them may reach a
+  // later op, and an aggregate folds in all of them
+  for (size_t k = 0; k < kernel_is_filter_.size(); ++k) {
+    if (kernel_is_filter_[k] || kernel_is_aggregate_[k]) {
+      compute_rows_[k] = valid_output_rows_[k];
+    }
+  }
+  dropped_rows_.clear();
 
   // Make the op aware of the format of the data
   for (auto& kernel : kernels_) {
     kernel->reset();
   }
+  for (auto& replicas : kernel_replicas_) {
+    for (auto& kernel : replicas) {
+      kernel->reset();
+    }
+  }
 
   outputs_yielded_ = 0;
-  final_output_handles_.clear();;
-  final_output_columns_.clear();
-  final_row_ids_.clear();
 
   // Clear the stencil cache
   for (size_t k = 0; k < kernel_factories_.size(); ++k) {
@@ -281,11 +322,11 @@ void EvaluateWorker::new_task(const std::vector<TaskStream>& task_streams) {
   }
 }
 
-void EvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
-  entry_ = entry;
+void EvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>&& entry) {
+  entry_ = std::move(entry);
 
-  IOItem& io_item = std::get<0>(entry);
-  EvalWorkEntry& work_entry = std::get<1>(entry);
+  IOItem& io_item = std::get<0>(entry_);
+  EvalWorkEntry& work_entry = std::get<1>(entry_);
 
   auto feed_start = now();
 
@@ -296,22 +337,98 @@ void EvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
         std::max(total_inputs_, (i32)work_entry.columns[i].size());
   }
 
-  std::vector<DeviceHandle> side_output_handles = work_entry.column_handles;
-  BatchedColumns side_output_columns = work_entry.columns;
-  std::vector<i64> side_row_ids = work_entry.row_ids;
+  entry_dropped_rows_ = std::move(work_entry.dropped_rows);
+  dropped_rows_.insert(entry_dropped_rows_.begin(), entry_dropped_rows_.end());
+
+  // yield only reads the entry's metadata, so take over its row data
+  std::vector<DeviceHandle> side_output_handles =
+      std::move(work_entry.column_handles);
+  BatchedColumns side_output_columns = std::move(work_entry.columns);
+  std::vector<i64> side_row_ids = std::move(work_entry.row_ids);
+
+  HeldEntry held;
+  i64 output_rows = 0;
+  if (fused_on_pool_ && side_row_ids.size() > fused_rows_) {
+    output_rows = evaluate_fused_on_pool(
+        side_output_columns, side_output_handles, side_row_ids.size());
+  } else if (fused_rows_ > 0 && side_row_ids.size() > fused_rows_) {
+    // Send a few rows at a time through the whole group, so each row is still
+    // in cache when the next kernel reads it
+    BatchedColumns output_columns(side_output_columns.size());
+    for (i64 s = 0; s < side_row_ids.size(); s += fused_rows_) {
+      i64 e = std::min(s + fused_rows_, (i64)side_row_ids.size());
+      BatchedColumns slice_columns;
+      for (ElementList& column : side_output_columns) {
+        slice_columns.emplace_back(column.begin() + s, column.begin() + e);
+      }
+      std::vector<DeviceHandle> slice_handles = side_output_handles;
+      std::vector<i64> slice_row_ids(side_row_ids.begin() + s,
+                                     side_row_ids.begin() + e);
+      output_rows +=
+          evaluate_rows(slice_columns, slice_handles, slice_row_ids, held);
+
+      output_columns.resize(slice_columns.size());
+      for (size_t c = 0; c < slice_columns.size(); ++c) {
+        output_columns[c].insert(output_columns[c].end(),
+                                 slice_columns[c].begin(),
+                                 slice_columns[c].end());
+      }
+      if (e == side_row_ids.size()) {
+        side_output_handles = slice_handles;
+      }
+    }
+    side_output_columns.swap(output_columns);
+  } else {
+    output_rows = evaluate_rows(side_output_columns, side_output_handles,
+                                side_row_ids, held);
+  }
+
+  // The entry is yielded once all of its held rows have run
+  EvalWorkEntry& output_work_entry = std::get<1>(held.entry);
+  output_work_entry.io_item_index = work_entry.io_item_index;
+  output_work_entry.needs_configure = work_entry.needs_configure;
+  output_work_entry.needs_reset = work_entry.needs_reset;
+  output_work_entry.last_in_task = work_entry.last_in_task;
+  output_work_entry.warmup_rows = work_entry.warmup_rows;
+  output_work_entry.columns = std::move(side_output_columns);
+  output_work_entry.column_handles = std::move(side_output_handles);
+  output_work_entry.row_ids = valid_output_rows_.back().to_vector(
+      outputs_yielded_, outputs_yielded_ + output_rows);
+  outputs_yielded_ += output_rows;
+  output_work_entry.dropped_rows = std::move(entry_dropped_rows_);
+  entry_dropped_rows_.clear();
+  if (drop_filtered_rows_ && !dropped_rows_.empty()) {
+    for (i64 i = 0; i < output_rows; ++i) {
+      if (dropped_rows_.count(output_work_entry.row_ids[i]) > 0) {
+        held.dropped.push_back(i);
+      }
+    }
+  }
+  std::get<0>(held.entry) = io_item;
+  held_entries_.push_back(std::move(held));
+
+  run_held_rows(false);
+
+  profiler_.add_interval("feed", feed_start, now());
+}
 
+void EvaluateWorker::flush() { run_held_rows(true); }
+
+i64 EvaluateWorker::evaluate_rows(BatchedColumns& side_output_columns,
+                                  std::vector<DeviceHandle>& side_output_handles,
+                                  std::vector<i64>& side_row_ids,
+                                  HeldEntry& held) {
+  i64 output_rows = 0;
   // For each kernel, produce as much output as can be produced given current
   // input rows and stencil cache.
   for (size_t k = 0; k < kernels_.size(); ++k) {
-    const std::string& op_name =
-        std::get<0>(kernel_factories_[k])->get_op_name();
     DeviceHandle current_handle = kernel_devices_[k];
     std::unique_ptr<BaseKernel>& kernel = kernels_[k];
     i32 num_output_columns = kernel_num_outputs_[k];
     std::vector<i32>& kernel_stencil = kernel_stencils_[k];
     i32 kernel_batch_size = kernel_batch_sizes_[k];
-    std::vector<i64>& kernel_valid_rows = valid_output_rows_[k];
-    std::set<i64>& kernel_valid_rows_set = valid_output_rows_set_[k];
+    RowSet& kernel_valid_rows = valid_output_rows_[k];
+    RowSet& kernel_compute_rows = compute_rows_[k];
     std::vector<std::deque<Element>>& kernel_cache = stencil_cache_[k];
     std::vector<DeviceHandle>& kernel_cache_devices = stencil_cache_devices_[k];
     std::deque<i64>& kernel_cache_row_ids = stencil_cache_row_ids_[k];
@@ -361,15 +478,11 @@ void EvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
 
     // Determine how many elements can be produced given stencil requirements
     // and the currrent stencil cache extent
-    i64 producible_rows = 0;
-    for (i64 i = current_valid_idx_[k]; i < kernel_valid_rows.size(); ++i) {
-      i64 row = kernel_valid_rows[i];
-      if (row + kernel_stencil.back() > max_row_id_seen) {
-        break;
-      }
-      producible_rows++;
-    }
-    assert(producible_rows > 0);
+    i64 producible_rows = internal::producible_rows(
+        kernel_valid_rows, kernel_compute_rows, kernel_stencil,
+        current_valid_idx_[k], max_row_id_seen);
+    // A slice of a fused entry may hold no rows this kernel needs
+    assert(producible_rows > 0 || fused_rows_ > 0);
 
     // Setup side output columns to reflect the number of valid rows that will
     // be produced from this kernel
@@ -393,13 +506,12 @@ void EvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
       }
       assert(producible_elements[0].size() == producible_rows);
 
-      // Update side output data by copying data since we don't have
-      // reference counting for all pointers :(
+      // Elements stay in the stencil cache after being passed on, so the side
+      // output takes its own references to the cached buffers
       if (!(kernel_stencil.size() == 1 && kernel_stencil[0] == 0)) {
         for (i64 c = 0; c < side_output_columns.size(); ++c) {
-          side_output_columns[c] = duplicate_elements(
-              profiler_, side_output_handles[c], side_output_handles[c],
-              producible_elements[c]);
+          side_output_columns[c] = share_elements(side_output_handles[c],
+                                                  producible_elements[c]);
         }
       } else {
         // However, if we aren't stenciling, then we don't need to copy since we
@@ -414,26 +526,46 @@ void EvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
     i64 row_start = current_valid_idx_[k];
     i64 row_end = current_valid_idx_[k] + producible_rows;
     current_valid_idx_[k] += producible_rows;
+    output_rows = producible_rows;
 
     for (i32 c = 0; c < num_output_columns; ++c) {
       side_output_handles.push_back(current_handle);
       side_output_columns.emplace_back();
     }
-    for (i32 start = row_start; start < row_end; start += kernel_batch_size) {
-      i32 batch = std::min((i64)kernel_batch_size, row_end - start);
-      i32 end = start + batch;
+    if (coalesce_timeout_ms_ > 0 && k == kernels_.size() - 1) {
+      hold_rows(row_start, row_end, side_output_columns, side_output_handles,
+                held);
+      continue;
+    }
+    // Stage the inputs of every batch before running any of them, so the
+    // batches of a parallel kernel can run at once
+    std::vector<KernelBatch> batches;
+    std::vector<KernelBatch*> runnable_batches;
+    for (i64 start = row_start; start < row_end; start += kernel_batch_size) {
+      batches.emplace_back();
+      KernelBatch& kb = batches.back();
+      kb.start = start;
+      kb.size = std::min((i64)kernel_batch_size, row_end - start);
+      std::vector<i64>& computed_rows = kb.computed_rows;
+      for (i64 r = start; r < start + kb.size; ++r) {
+        if (computes(k, kernel_valid_rows[r])) {
+          computed_rows.push_back(r);
+        }
+      }
       // Stage inputs to the kernel using the stencil cache
-      StenciledBatchedColumns input_columns(input_column_idx.size());
+      StenciledBatchedColumns& input_columns = kb.input_columns;
+      input_columns.resize(input_column_idx.size());
       // For each column
       auto& cache_row_deque = kernel_cache_row_ids;
       for (size_t i = 0; i < input_column_idx.size(); ++i) {
         i32 col_id = input_column_idx[i];
         auto& cache_deque = kernel_cache[col_id];
         auto& col = input_columns[i];
-        col.resize(batch);
+        col.resize(computed_rows.size());
         // For each batch element
-        for (i64 r = start; r < end; ++r) {
-          auto& input_stencil = col[r - start];
+        for (size_t b = 0; b < computed_rows.size(); ++b) {
+          i64 r = computed_rows[b];
+          auto& input_stencil = col[b];
           i64 last_cache_element = 0;
           // Place elements in "stencil" dimension of input columns
           i64 curr_row = kernel_valid_rows[r];
@@ -452,34 +584,43 @@ void EvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
           assert(input_stencil.size() == kernel_stencil.size());
         }
       }
-
       // Setup output buffers to receive op output
-      DeviceHandle output_handle = current_handle;
-      BatchedColumns output_columns;
-      output_columns.resize(num_output_columns);
-
-      // Map from previous output columns to the set of input columns needed
-      // by the kernel
-      auto eval_start = now();
-      kernel->execute_kernel(input_columns, output_columns);
-      profiler_.add_interval("evaluate:" + op_name, eval_start, now());
-      // Delete unused outputs
-      for (size_t y = 0; y < unused_outputs_[k].size(); ++y) {
-        i32 unused_col_idx =
-            unused_outputs_[k][unused_outputs_[k].size() - 1 - y];
-        ElementList& column = output_columns[unused_col_idx];
-        for (Element& element : column) {
-          delete_element(current_handle, element);
-        }
-        output_columns.erase(output_columns.begin() + unused_col_idx);
+      kb.output_columns.resize(num_output_columns);
+      if (!computed_rows.empty()) {
+        runnable_batches.push_back(&kb);
       }
+    }
 
-      // Verify the kernel produced the correct amount of output
-      for (size_t i = 0; i < output_columns.size(); ++i) {
-        LOG_IF(FATAL, output_columns[i].size() != batch)
-            << "Op " << k << " produced " << output_columns[i].size()
-            << " output elements for column " << i << ". Expected "
-            << batch << " outputs.";
+    execute_batches(k, runnable_batches);
+    if (kernel_is_filter_[k]) {
+      std::set<i64> dropped;
+      for (KernelBatch* kb : runnable_batches) {
+        record_filter(k, *kb, kernel_valid_rows, dropped);
+      }
+      drop_rows(dropped);
+    }
+    if (kernel_is_aggregate_[k]) {
+      for (KernelBatch& kb : batches) {
+        record_aggregate(k, kb, kernel_valid_rows);
+      }
+    }
+
+    for (KernelBatch& kb : batches) {
+      i64 start = kb.start;
+      i32 batch = kb.size;
+      std::vector<i64>& computed_rows = kb.computed_rows;
+      BatchedColumns& output_columns = kb.output_columns;
+      collect_outputs(k, computed_rows.size(), output_columns);
+
+      // Spread the outputs back over the whole batch
+      if (computed_rows.size() < batch) {
+        for (ElementList& column : output_columns) {
+          ElementList spread(batch, null_element());
+          for (size_t b = 0; b < computed_rows.size(); ++b) {
+            spread[computed_rows[b] - start] = column[b];
+          }
+          column.swap(spread);
+        }
       }
 
       // Add new output columns
@@ -496,7 +637,9 @@ void EvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
           (kernel_stencil.size() == 1 && kernel_stencil[0] == 0);
       i64 last_cache_element = 0;
       i64 min_used_row =
-          kernel_valid_rows[start + batch - kernel_stencil[0]];
+          start + batch < kernel_valid_rows.size()
+              ? kernel_valid_rows[start + batch] + kernel_stencil.front()
+              : kernel_valid_rows.back() + 1;
       {
         auto& row_id_deque = kernel_cache_row_ids;
         while (row_id_deque.size() > 0) {
@@ -532,67 +675,409 @@ void EvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
     }
     // Delete elements from stencil cache that will no longer be used
   }
+  return output_rows;
+}
 
-  final_output_handles_ = side_output_handles;
-  if (final_output_columns_.size() == 0) {
-    final_output_columns_.resize(side_output_columns.size());
+i64 EvaluateWorker::evaluate_fused_on_pool(BatchedColumns& columns,
+                                           std::vector<DeviceHandle>& handles,
+                                           i64 num_rows) {
+  // Every kernel of a fused group runs on the CPU
+  for (size_t c = 0; c < columns.size(); ++c) {
+    move_if_different_address_space(profiler_, handles[c], CPU_DEVICE,
+                                    columns[c]);
+    handles[c] = CPU_DEVICE;
   }
-  for (size_t i = 0; i < side_output_columns.size(); ++i) {
-    final_output_columns_[i].insert(final_output_columns_[i].end(),
-                                    side_output_columns[i].begin(),
-                                    side_output_columns[i].end());
+
+  i64 num_slices = (num_rows + fused_rows_ - 1) / fused_rows_;
+  i32 num_tasks = std::min(num_slices, (i64)kernel_pool_->num_threads() + 1);
+  // Instances are created here rather than on the pool threads
+  for (size_t k = 0; k < kernels_.size(); ++k) {
+    kernel_instance(k, num_tasks - 1);
   }
 
-  profiler_.add_interval("feed", feed_start, now());
+  std::vector<BatchedColumns> slice_columns(num_slices);
+  std::vector<std::vector<DeviceHandle>> slice_handles(num_slices, handles);
+  std::vector<std::set<i64>> slice_dropped(num_slices);
+  for (i64 s = 0; s < num_slices; ++s) {
+    i64 start = s * fused_rows_;
+    i64 end = std::min(start + fused_rows_, num_rows);
+    for (ElementList& column : columns) {
+      slice_columns[s].emplace_back(column.begin() + start,
+                                    column.begin() + end);
+    }
+  }
+  auto eval_start = now();
+  kernel_pool_->parallel_for(num_tasks, [&](i32 t) {
+    for (i64 s = num_slices * t / num_tasks;
+         s < num_slices * (t + 1) / num_tasks; ++s) {
+      evaluate_fused_slice(t, s * fused_rows_, slice_columns[s],
+                           slice_handles[s], slice_dropped[s]);
+    }
+  });
+  profiler_.add_interval("evaluate:fused", eval_start, now());
+
+  columns.clear();
+  columns.resize(slice_columns[0].size());
+  for (BatchedColumns& slice : slice_columns) {
+    for (size_t c = 0; c < slice.size(); ++c) {
+      columns[c].insert(columns[c].end(), slice[c].begin(), slice[c].end());
+    }
+  }
+  handles = slice_handles[0];
+  for (const std::set<i64>& dropped : slice_dropped) {
+    drop_rows(dropped);
+  }
+  // The stencils are degenerate, so the stencil caches are never read and
+  // every kernel's valid rows are the rows of the entry
+  for (size_t k = 0; k < kernels_.size(); ++k) {
+    current_valid_idx_[k] += num_rows;
+  }
+  return num_rows;
 }
 
-bool EvaluateWorker::yield(i32 item_size,
-                           std::tuple<IOItem, EvalWorkEntry>& output_entry) {
-  IOItem& io_item = std::get<0>(entry_);
-  EvalWorkEntry& work_entry = std::get<1>(entry_);
+void EvaluateWorker::evaluate_fused_slice(i32 i, i64 first,
+                                          BatchedColumns& columns,
+                                          std::vector<DeviceHandle>& handles,
+                                          std::set<i64>& dropped) {
+  i64 num_rows = columns[0].size();
+  for (size_t k = 0; k < kernels_.size(); ++k) {
+    BaseKernel* instance = kernel_instance(k, i);
+    const RowSet& kernel_valid_rows = valid_output_rows_[k];
+    std::vector<i32>& input_column_idx = column_mapping_[k];
+    i32 num_output_columns = kernel_num_outputs_[k];
+    i64 row_start = current_valid_idx_[k] + first;
+
+    BatchedColumns outputs(num_output_columns);
+    for (i64 start = 0; start < num_rows; start += kernel_batch_sizes_[k]) {
+      KernelBatch kb;
+      kb.start = row_start + start;
+      kb.size = std::min((i64)kernel_batch_sizes_[k], num_rows - start);
+      for (i64 r = kb.start; r < kb.start + kb.size; ++r) {
+        i64 row = kernel_valid_rows[r];
+        if (computes(k, row) && dropped.count(row) == 0) {
+          kb.computed_rows.push_back(r);
+        }
+      }
+      kb.input_columns.resize(input_column_idx.size());
+      for (size_t c = 0; c < input_column_idx.size(); ++c) {
+        const ElementList& column = columns[input_column_idx[c]];
+        for (i64 r : kb.computed_rows) {
+          kb.input_columns[c].push_back({column[r - row_start]});
+        }
+      }
+      kb.output_columns.resize(num_output_columns);
+      if (!kb.computed_rows.empty()) {
+        instance->execute_kernel(kb.input_columns, kb.output_columns);
+      }
+      if (kernel_is_filter_[k] && !kb.computed_rows.empty()) {
+        record_filter(k, kb, kernel_valid_rows, dropped);
+      }
+      collect_outputs(k, kb.computed_rows.size(), kb.output_columns);
 
-  auto yield_start = now();
+      // Spread the outputs back over the whole batch
+      for (size_t c = 0; c < kb.output_columns.size(); ++c) {
+        ElementList spread(kb.size, null_element());
+        for (size_t b = 0; b < kb.computed_rows.size(); ++b) {
+          spread[kb.computed_rows[b] - kb.start] = kb.output_columns[c][b];
+        }
+        outputs[c].insert(outputs[c].end(), spread.begin(), spread.end());
+      }
+    }
+    for (ElementList& column : outputs) {
+      columns.push_back(std::move(column));
+      handles.push_back(kernel_devices_[k]);
+    }
 
-  EvalWorkEntry output_work_entry;
-  output_work_entry.io_item_index = work_entry.io_item_index;
-  output_work_entry.needs_configure = work_entry.needs_configure;
-  output_work_entry.needs_reset = work_entry.needs_reset;
-  output_work_entry.last_in_task = work_entry.last_in_task;
-  output_work_entry.warmup_rows = work_entry.warmup_rows;
+    // Delete dead columns
+    for (size_t y = 0; y < dead_columns_[k].size(); ++y) {
+      i32 dead_col_idx = dead_columns_[k][dead_columns_[k].size() - 1 - y];
+      for (Element& element : columns[dead_col_idx]) {
+        delete_element(handles[dead_col_idx], element);
+      }
+      columns.erase(columns.begin() + dead_col_idx);
+      handles.erase(handles.begin() + dead_col_idx);
+    }
+  }
+}
+
+void EvaluateWorker::execute_batches(size_t k,
+                                     const std::vector<KernelBatch*>& batches) {
+  if (batches.empty()) {
+    return;
+  }
+  const std::string& op_name =
+      std::get<0>(kernel_factories_[k])->get_op_name();
+  i32 num_batches = batches.size();
+  i32 num_chunks = 1;
+  if (std::get<0>(kernel_factories_[k])->parallel() &&
+      kernel_pool_ != nullptr) {
+    num_chunks = std::min(num_batches, kernel_pool_->num_threads() + 1);
+  }
+  // A parallel kernel splits the batches into contiguous runs, each on its
+  // own instance of the kernel
+  auto eval_start = now();
+  auto run_chunk = [&](i32 c) {
+    BaseKernel* instance = kernel_instance(k, c);
+    for (i32 i = (i64)num_batches * c / num_chunks;
+         i < (i64)num_batches * (c + 1) / num_chunks; ++i) {
+      KernelBatch* kb = batches[i];
+      instance->execute_kernel(kb->input_columns, kb->output_columns);
+    }
+  };
+  if (num_chunks > 1) {
+    // Instances are created here rather than on the pool threads
+    kernel_instance(k, num_chunks - 1);
+    kernel_pool_->parallel_for(num_chunks, run_chunk);
+  } else {
+    run_chunk(0);
+  }
+  profiler_.add_interval("evaluate:" + op_name, eval_start, now());
+}
+
+void EvaluateWorker::collect_outputs(size_t k, size_t num_computed,
+                                     BatchedColumns& output_columns) {
+  // Delete unused outputs
+  for (size_t y = 0; y < unused_outputs_[k].size(); ++y) {
+    i32 unused_col_idx = unused_outputs_[k][unused_outputs_[k].size() - 1 - y];
+    ElementList& column = output_columns[unused_col_idx];
+    for (Element& element : column) {
+      delete_element(kernel_devices_[k], element);
+    }
+    output_columns.erase(output_columns.begin() + unused_col_idx);
+  }
+
+  // Verify the kernel produced the correct amount of output
+  for (size_t i = 0; i < output_columns.size(); ++i) {
+    LOG_IF(FATAL, output_columns[i].size() != num_computed)
+        << "Op " << k << " produced " << output_columns[i].size()
+        << " output elements for column " << i << ". Expected "
+        << num_computed << " outputs.";
+  }
+}
+
+void EvaluateWorker::hold_rows(i64 row_start, i64 row_end,
+                               BatchedColumns& columns,
+                               std::vector<DeviceHandle>& handles,
+                               HeldEntry& held) {
+  size_t k = kernels_.size() - 1;
+  RowSet& kernel_valid_rows = valid_output_rows_[k];
+  std::vector<i32>& input_column_idx = column_mapping_[k];
+  std::vector<i32>& dead = dead_columns_[k];
+  i32 num_output_columns = kernel_num_outputs_[k];
+  i32 num_kept_outputs = num_output_columns - unused_outputs_[k].size();
+  i64 first_output = columns.size() - num_output_columns;
+  i64 num_rows = row_end - row_start;
+
+  // The stencil is degenerate, so row r of each input column is the only
+  // input of row r
+  i64 entry = held_entries_start_ + held_entries_.size();
+  timepoint_t fed = now();
+  for (i64 r = 0; r < num_rows; ++r) {
+    if (!computes(k, kernel_valid_rows[row_start + r])) {
+      continue;
+    }
+    HeldRow held_row;
+    held_row.entry = entry;
+    held_row.row = r;
+    held_row.fed = fed;
+    for (i32 col_idx : input_column_idx) {
+      held_row.inputs.push_back(columns[col_idx][r]);
+    }
+    held_rows_.push_back(std::move(held_row));
+    held.rows_waiting++;
+  }
+  for (i32 c = 0; c < num_kept_outputs; ++c) {
+    columns[first_output + c].assign(num_rows, null_element());
+  }
+
+  // A degenerate stencil cache holds no references of its own, so the rows
+  // can leave it now
+  std::deque<i64>& cache_row_ids = stencil_cache_row_ids_[k];
+  i64 min_used_row = row_end < kernel_valid_rows.size()
+                         ? kernel_valid_rows[row_end]
+                         : kernel_valid_rows.back() + 1;
+  while (!cache_row_ids.empty() && cache_row_ids.front() < min_used_row) {
+    cache_row_ids.pop_front();
+    for (auto& cache_deque : stencil_cache_[k]) {
+      cache_deque.pop_front();
+    }
+  }
 
-  BatchedColumns& work_item_output_columns = output_work_entry.columns;
-  std::vector<DeviceHandle>& work_item_output_handles =
-      output_work_entry.column_handles;
-  i32 num_final_output_columns = 0;
+  held_output_columns_.clear();
+  for (i32 c = 0; c < num_kept_outputs; ++c) {
+    i64 col_idx = first_output + c;
+    if (std::find(dead.begin(), dead.end(), col_idx) != dead.end()) {
+      held_output_columns_.push_back(-1);
+    } else {
+      held_output_columns_.push_back(
+          col_idx - std::count_if(dead.begin(), dead.end(),
+                                  [&](i32 d) { return d < col_idx; }));
+    }
+  }
+  // Held rows may still read the dead columns, so they are deleted when the
+  // entry is yielded
+  for (size_t y = 0; y < dead.size(); ++y) {
+    i32 dead_col_idx = dead[dead.size() - 1 - y];
+    held.dead_columns.push_back(std::move(columns[dead_col_idx]));
+    held.dead_handles.push_back(handles[dead_col_idx]);
+    columns.erase(columns.begin() + dead_col_idx);
+    handles.erase(handles.begin() + dead_col_idx);
+  }
+}
 
-  num_final_output_columns = final_output_columns_.size();
-  work_item_output_columns.resize(final_output_columns_.size());
-  work_item_output_handles = final_output_handles_;
+void EvaluateWorker::record_filter(size_t k, const KernelBatch& kb,
+                                   const RowSet& valid_rows,
+                                   std::set<i64>& dropped) {
+  const ElementList& verdicts = kb.output_columns[0];
+  LOG_IF(FATAL, verdicts.size() != kb.computed_rows.size())
+      << "Filter op " << k << " produced " << verdicts.size()
+      << " output elements. Expected " << kb.computed_rows.size()
+      << " outputs.";
+  for (size_t b = 0; b < verdicts.size(); ++b) {
+    u8 keep = 0;
+    if (verdicts[b].size > 0) {
+      memcpy_buffer(&keep, CPU_DEVICE, verdicts[b].buffer, kernel_devices_[k],
+                    1);
+    }
+    if (keep == 0) {
+      dropped.insert(valid_rows[kb.computed_rows[b]]);
+    }
+  }
+}
 
-  i32 yieldable_rows = std::numeric_limits<i32>::max();
-  for (i32 i = 0; i < num_final_output_columns; ++i) {
-    yieldable_rows =
-        std::min((i32)final_output_columns_[i].size(), yieldable_rows);
+void EvaluateWorker::drop_rows(const std::set<i64>& rows) {
+  dropped_rows_.insert(rows.begin(), rows.end());
+  entry_dropped_rows_.insert(entry_dropped_rows_.end(), rows.begin(),
+                             rows.end());
+}
+
+void EvaluateWorker::record_aggregate(size_t k, KernelBatch& kb,
+                                      const RowSet& valid_rows) {
+  i64 last = valid_rows.size() - 1;
+  for (i64 r = kb.start; r < kb.start + kb.size; ++r) {
+    if (r != last) {
+      i64 row = valid_rows[r];
+      dropped_rows_.insert(row);
+      entry_dropped_rows_.push_back(row);
+    }
+  }
+  if (kb.computed_rows.empty() || kb.computed_rows.back() != last) {
+    return;
   }
+  // The kernel left a null element in the last row for the aggregate
+  AggregateKernel* kernel = static_cast<AggregateKernel*>(kernels_[k].get());
+  Columns outputs(kb.output_columns.size());
+  kernel->finish_item(outputs);
+  for (size_t c = 0; c < outputs.size(); ++c) {
+    kb.output_columns[c].back() = outputs[c];
+  }
+}
 
-  for (i32 i = 0; i < num_final_output_columns; ++i) {
-    work_item_output_columns[i].insert(
-        work_item_output_columns[i].end(), final_output_columns_[i].begin(),
-        final_output_columns_[i].begin() + yieldable_rows);
-    final_output_columns_[i].erase(
-        final_output_columns_[i].begin(),
-        final_output_columns_[i].begin() + yieldable_rows);
+void EvaluateWorker::run_held_rows(bool partial) {
+  size_t k = kernels_.size() - 1;
+  i64 batch_size = kernel_batch_sizes_[k];
+  while (held_rows_.size() >= batch_size ||
+         (partial && !held_rows_.empty())) {
+    KernelBatch kb;
+    kb.start = 0;
+    kb.size = std::min(batch_size, (i64)held_rows_.size());
+    kb.input_columns.resize(column_mapping_[k].size());
+    for (i32 b = 0; b < kb.size; ++b) {
+      kb.computed_rows.push_back(b);
+      for (size_t i = 0; i < kb.input_columns.size(); ++i) {
+        kb.input_columns[i].push_back({held_rows_[b].inputs[i]});
+      }
+    }
+    kb.output_columns.resize(kernel_num_outputs_[k]);
+    execute_batches(k, {&kb});
+    collect_outputs(k, kb.size, kb.output_columns);
+
+    // Put each output in the row of the entry it belongs to
+    for (i32 b = 0; b < kb.size; ++b) {
+      HeldRow& held_row = held_rows_.front();
+      HeldEntry& held = held_entries_[held_row.entry - held_entries_start_];
+      BatchedColumns& columns = std::get<1>(held.entry).columns;
+      for (size_t c = 0; c < kb.output_columns.size(); ++c) {
+        i32 col_idx = held_output_columns_[c];
+        if (col_idx < 0) {
+          delete_element(kernel_devices_[k], kb.output_columns[c][b]);
+        } else {
+          columns[col_idx][held_row.row] = kb.output_columns[c][b];
+        }
+      }
+      held.rows_waiting--;
+      held_rows_.pop_front();
+    }
   }
-  output_work_entry.row_ids = std::vector<i64>(
-      valid_output_rows_.back().begin() + outputs_yielded_,
-      valid_output_rows_.back().begin() + outputs_yielded_ + yieldable_rows);
+}
 
-  assert(output_work_entry.row_ids.size() ==
-         work_item_output_columns[0].size());
+BaseKernel* EvaluateWorker::kernel_instance(size_t k, i32 i) {
+  if (i == 0) {
+    return kernels_[k].get();
+  }
+  auto& replicas = kernel_replicas_[k];
+  while (replicas.size() < i) {
+    KernelFactory* factory = std::get<0>(kernel_factories_[k]);
+    const KernelConfig& config = std::get<1>(kernel_factories_[k]);
+    // Replicas get no profiler, since Profiler is not thread safe and they
+    // run alongside the first instance
+    BaseKernel* kernel = factory->new_instance(config);
+    proto::Result result;
+    kernel->validate(&result);
+    LOG_IF(FATAL, !result.success())
+        << "Instance " << i << " of kernel " << factory->get_op_name()
+        << " failed validation: " << result.msg();
+    replicas.emplace_back(kernel);
+  }
+  return replicas[i - 1].get();
+}
 
-  outputs_yielded_ += yieldable_rows;
+bool EvaluateWorker::yield(std::tuple<IOItem, EvalWorkEntry>& output_entry) {
+  if (held_entries_.empty() || held_entries_.front().rows_waiting > 0) {
+    return false;
+  }
+  auto yield_start = now();
 
-  output_entry = std::make_tuple(io_item, output_work_entry);
+  HeldEntry& held = held_entries_.front();
+  for (size_t i = 0; i < held.dead_columns.size(); ++i) {
+    for (Element& element : held.dead_columns[i]) {
+      delete_element(held.dead_handles[i], element);
+    }
+  }
+  // Leave out the rows that filters dropped
+  if (!held.dropped.empty()) {
+    EvalWorkEntry& work_entry = std::get<1>(held.entry);
+    std::vector<bool> keep(work_entry.row_ids.size(), true);
+    i64 warmup_rows = work_entry.warmup_rows;
+    for (i64 i : held.dropped) {
+      keep[i] = false;
+      if (i < warmup_rows) {
+        work_entry.warmup_rows--;
+      }
+    }
+    for (size_t c = 0; c < work_entry.columns.size(); ++c) {
+      ElementList kept;
+      for (size_t i = 0; i < keep.size(); ++i) {
+        if (keep[i]) {
+          kept.push_back(work_entry.columns[c][i]);
+        } else {
+          delete_element(work_entry.column_handles[c],
+                         work_entry.columns[c][i]);
+        }
+      }
+      work_entry.columns[c].swap(kept);
+    }
+    std::vector<i64> kept_row_ids;
+    for (size_t i = 0; i < keep.size(); ++i) {
+      if (keep[i]) {
+        kept_row_ids.push_back(work_entry.row_ids[i]);
+      }
+    }
+    work_entry.row_ids.swap(kept_row_ids);
+  }
+  output_entry = std::move(held.entry);
+  held_entries_.pop_front();
+  held_entries_start_++;
 
   profiler_.add_interval("yield", yield_start, now());
 
@@ -641,7 +1126,7 @@ PostEvaluateWorker::PostEvaluateWorker(const PostEvaluateWorkerArgs& args)
   current_offset_ = 0;
 }
 
-void PostEvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
+void PostEvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>&& entry) {
   IOItem& io_item = std::get<0>(entry);
   EvalWorkEntry& work_entry = std::get<1>(entry);
 
@@ -670,6 +1155,9 @@ void PostEvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
   i64 num_rows = work_entry.columns[0].size();
   i32 warmup_frames = work_entry.warmup_rows;
   current_offset_ += num_rows;
+  buffered_entry_.row_ids.insert(buffered_entry_.row_ids.end(),
+                                 work_entry.row_ids.begin() + warmup_frames,
+                                 work_entry.row_ids.end());
 
   i32 encoder_idx = 0;
   // Swizzle columns correctly
@@ -775,8 +1263,9 @@ void PostEvaluateWorker::feed(std::tuple<IOItem, EvalWorkEntry>& entry) {
       }
     }
 
-    buffered_entries_.push_back(std::make_tuple(io_item, buffered_entry_));
-    buffered_entry_.columns.clear();
+    buffered_entries_.push_back(
+        std::make_tuple(io_item, std::move(buffered_entry_)));
+    buffered_entry_ = EvalWorkEntry();
   }
 }
 
@@ -785,7 +1274,7 @@ bool PostEvaluateWorker::yield(std::tuple<IOItem, EvalWorkEntry>& output) {
 
   bool got_result = false;
   if (buffered_entries_.size() > 0) {
-    output = buffered_entries_.front();
+    output = std::move(buffered_entries_.front());
     buffered_entries_.pop_front();
     got_result = true;
   }
@@ -19,6 +19,7 @@
 #include "scanner/engine/runtime.h"
 #include "scanner/util/common.h"
 #include "scanner/util/queue.h"
+#include "scanner/util/thread_pool.h"
 #include "scanner/video/decoder_automata.h"
 #include "scanner/video/video_encoder.h"
 
@@ -47,7 +48,7 @@ class PreEvaluateWorker {
  public:
   PreEvaluateWorker(const PreEvaluateWorkerArgs& args);
 
-  void feed(std::tuple<IOItem, EvalWorkEntry>& entry);
+  void feed(std::tuple<IOItem, EvalWorkEntry>&& entry);
 
   bool yield(i32 item_size, std::tuple<IOItem, EvalWorkEntry>& output);
 
@@ -96,6 +97,14 @@ struct EvaluateWorkerArgs {
   std::vector<std::vector<i32>> kernel_stencils;
   // Batch size needed by kernels
   std::vector<i32> kernel_batch_sizes;
+  // Runs the batches of parallel kernels, shared by the whole node
+  ThreadPool* kernel_pool;
+  // If positive, the last kernel runs full batches of rows gathered across
+  // entries, waiting at most this long for a batch to fill
+  i32 coalesce_timeout_ms;
+  // Leave the rows that filters dropped out of the yielded entries. Set for
+  // the last kernel group.
+  bool drop_filtered_rows;
 
   Profiler& profiler;
   proto::Result& result;
@@ -108,20 +117,133 @@ class EvaluateWorker {
 
   void new_task(const std::vector<TaskStream>& task_streams);
 
-  void feed(std::tuple<IOItem, EvalWorkEntry>& entry);
+  void feed(std::tuple<IOItem, EvalWorkEntry>&& entry);
 
-  bool yield(i32 item_size, std::tuple<IOItem, EvalWorkEntry>& output);
+  //! Returns the oldest fed entry whose rows have all been computed, or
+  //! false if there is none
+  bool yield(std::tuple<IOItem, EvalWorkEntry>& output);
+
+  //! True if rows of the last kernel are waiting for a full batch
+  bool has_held_rows() const { return !held_rows_.empty(); }
+
+  //! When the oldest held row was fed
+  timepoint_t held_since() const { return held_rows_.front().fed; }
+
+  //! Runs the held rows as a partial batch
+  void flush();
 
  private:
+  // Inputs and outputs of one call to a kernel
+  struct KernelBatch {
+    i64 start;
+    i32 size;
+    // Only rows that a later op reads are computed, the rest just get a
+    // null element
+    std::vector<i64> computed_rows;
+    StenciledBatchedColumns input_columns;
+    BatchedColumns output_columns;
+  };
+
+  // A fed entry, held until the rows of the last kernel have run
+  struct HeldEntry {
+    std::tuple<IOItem, EvalWorkEntry> entry;
+    // Columns that are dead after the last kernel, deleted once the held
+    // rows no longer read them
+    BatchedColumns dead_columns;
+    std::vector<DeviceHandle> dead_handles;
+    i64 rows_waiting = 0;
+    // Indices of the rows that filters dropped
+    std::vector<i64> dropped;
+  };
+
+  // A row of the last kernel waiting for a full batch
+  struct HeldRow {
+    // Sequence number of its entry
+    i64 entry;
+    // Index of the row in the entry's columns
+    i64 row;
+    // Per input column -> element
+    std::vector<Element> inputs;
+    timepoint_t fed;
+  };
+
+  // Runs every kernel on the rows of an entry and returns the number of rows
+  // the last kernel produced. Leaves the outputs in side_output_columns.
+  i64 evaluate_rows(BatchedColumns& side_output_columns,
+                    std::vector<DeviceHandle>& side_output_handles,
+                    std::vector<i64>& side_row_ids, HeldEntry& held);
+
+  // Runs every kernel of a fused group on the rows of an entry, each
+  // fused_rows_ slice as one task on the kernel pool, and returns the number
+  // of rows produced. Leaves the outputs in columns.
+  i64 evaluate_fused_on_pool(BatchedColumns& columns,
+                             std::vector<DeviceHandle>& handles,
+                             i64 num_rows);
+
+  // Runs every kernel of a fused group on one slice of an entry, starting at
+  // row first of the entry, with instance i of each kernel. Rows that filters
+  // drop are added to dropped.
+  void evaluate_fused_slice(i32 i, i64 first, BatchedColumns& columns,
+                            std::vector<DeviceHandle>& handles,
+                            std::set<i64>& dropped);
+
+  // Runs the batches of kernel k, splitting them over instances of the
+  // kernel if it is parallel
+  void execute_batches(size_t k, const std::vector<KernelBatch*>& batches);
+
+  // Deletes the outputs of kernel k that nothing reads and checks that it
+  // produced num_computed rows of the rest
+  void collect_outputs(size_t k, size_t num_computed,
+                       BatchedColumns& output_columns);
+
+  // Holds the rows [row_start, row_end) of the last kernel instead of running
+  // them, leaving null elements in their output columns until they do run
+  void hold_rows(i64 row_start, i64 row_end, BatchedColumns& columns,
+                 std::vector<DeviceHandle>& handles, HeldEntry& held);
+
+  // Runs the held rows a full batch at a time, and then the remainder if
+  // partial is set
+  void run_held_rows(bool partial);
+
+  // Adds to dropped the rows of a batch of filter kernel k whose output byte
+  // is zero, where valid_rows are the kernel's valid output rows
+  void record_filter(size_t k, const KernelBatch& kb,
+                     const RowSet& valid_rows, std::set<i64>& dropped);
+
+  // Drops rows from the rest of the task
+  void drop_rows(const std::set<i64>& rows);
+
+  // Drops the rows of a batch of aggregate kernel k other than the task's
+  // last one, which gets the aggregate of the task's rows
+  void record_aggregate(size_t k, KernelBatch& kb, const RowSet& valid_rows);
+
+  // True if kernel k computes row, which is one of its valid output rows
+  bool computes(size_t k, i64 row) const {
+    return compute_rows_[k].contains(row) && dropped_rows_.count(row) == 0;
+  }
+
+  // Instance i of kernel k, where instance 0 is the one in kernels_. The
+  // others run batches of a parallel kernel and are created on first use.
+  BaseKernel* kernel_instance(size_t k, i32 i);
+
   const i32 node_id_;
   const i32 worker_id_;
 
   Profiler& profiler_;
+  ThreadPool* kernel_pool_;
+  const i32 coalesce_timeout_ms_;
+  const bool drop_filtered_rows_;
+  // If positive, entries run through the kernels this many rows at a time
+  i64 fused_rows_;
+  // If set, those slices of rows run at once on the kernel pool
+  bool fused_on_pool_;
 
   std::vector<std::tuple<KernelFactory*, KernelConfig>> kernel_factories_;
   std::vector<DeviceHandle> kernel_devices_;
   std::vector<i32> kernel_num_outputs_;
   std::vector<std::unique_ptr<BaseKernel>> kernels_;
+  // Per kernel -> instances after the first
+  std::vector<std::vector<std::unique_ptr<BaseKernel>>> kernel_replicas_;
 
   std::vector<std::vector<std::tuple<i32, std::string>>> live_columns_;
   std::vector<std::vector<i32>> dead_columns_;
@@ -129,13 +251,16 @@ class EvaluateWorker {
   std::vector<std::vector<i32>> column_mapping_;
   std::vector<std::vector<i32>> kernel_stencils_;
   std::vector<i32> kernel_batch_sizes_;
+  std::vector<bool> kernel_is_filter_;
+  std::vector<bool> kernel_is_aggregate_;
 
   // Used for computing complement of column mapping
   std::vector<std::set<i32>> column_mapping_set_;
 
   // Task state
-  std::vector<std::set<i64>> valid_output_rows_set_;
-  std::vector<std::vector<i64>> valid_output_rows_;
+  std::vector<RowSet> valid_output_rows_;
+  // Per kernel -> which valid output rows it computes
+  std::vector<RowSet> compute_rows_;
   std::vector<i64> current_valid_idx_;
   // Per kernel -> per input column -> deque of element)
   std::vector<std::vector<std::deque<Element>>> stencil_cache_;
@@ -143,6 +268,11 @@ class EvaluateWorker {
   std::vector<std::vector<DeviceHandle>> stencil_cache_devices_;
   // Per kernel -> deque of row ids
   std::vector<std::deque<i64>> stencil_cache_row_ids_;
+  // Rows of the task that filters dropped
+  std::set<i64> dropped_rows_;
+  // Rows dropped while evaluating the current entry, including those it
+  // came with
+  std::vector<i64> entry_dropped_rows_;
 
   // Continutation state
   std::tuple<IOItem, EvalWorkEntry> entry_;
@@ -150,9 +280,15 @@ class EvaluateWorker {
   i32 total_inputs_;
 
   i64 outputs_yielded_;
-  std::vector<DeviceHandle> final_output_handles_;
-  std::vector<std::deque<Element>> final_output_columns_;
-  std::vector<i64> final_row_ids_;
+
+  // Fed entries not yet yielded, oldest first
+  std::deque<HeldEntry> held_entries_;
+  // Sequence number of held_entries_.front()
+  i64 held_entries_start_ = 0;
+  std::deque<HeldRow> held_rows_;
+  // Per output of the last kernel -> its column in the held entries, or -1
+  // if it is dead
+  std::vector<i32> held_output_columns_;
 };
 
 struct ColumnCompressionOptions {
@@ -177,7 +313,7 @@ class PostEvaluateWorker {
  public:
   PostEvaluateWorker(const PostEvaluateWorkerArgs& args);
 
-  void feed(std::tuple<IOItem, EvalWorkEntry>& entry);
+  void feed(std::tuple<IOItem, EvalWorkEntry>&& entry);
 
   bool yield(std::tuple<IOItem, EvalWorkEntry>& output);
 
@@ -38,12 +38,14 @@ namespace internal {
 class KernelFactory {
  public:
   KernelFactory(const std::string& op_name, DeviceType type, i32 max_devices,
-                bool can_batch, i32 batch_size, KernelConstructor constructor)
+                bool can_batch, i32 batch_size, bool parallel,
+                KernelConstructor constructor)
     : op_name_(op_name),
       type_(type),
       max_devices_(max_devices),
       can_batch_(can_batch),
       preferred_batch_size_(batch_size),
+      parallel_(parallel),
       constructor_(constructor) {}
 
   const std::string& get_op_name() const { return op_name_; }
@@ -57,6 +59,9 @@ class KernelFactory {
 
   i32 preferred_batch_size() const { return preferred_batch_size_; }
 
+  //! True if batches may run at once on separate kernel instances
+  bool parallel() const { return parallel_; }
+
   /* @brief Constructs a kernel to be used for processing elements of data.
    */
   BaseKernel* new_instance(const KernelConfig& config) {
@@ -69,6 +74,7 @@ class KernelFactory {
   i32 max_devices_;
   bool can_batch_;
   i32 preferred_batch_size_;
+  bool parallel_;
   KernelConstructor constructor_;
 };
 }
@@ -187,7 +187,7 @@ LoadWorker::LoadWorker(const LoadWorkerArgs& args)
 }
 
 std::tuple<IOItem, EvalWorkEntry> LoadWorker::execute(
-    std::tuple<IOItem, LoadWorkEntry>& entry) {
+    std::tuple<IOItem, LoadWorkEntry>&& entry) {
 
   IOItem& io_item = std::get<0>(entry);
   LoadWorkEntry& load_work_entry = std::get<1>(entry);
@@ -196,6 +196,9 @@ std::tuple<IOItem, EvalWorkEntry> LoadWorker::execute(
 
   if (io_item.table_id() != last_table_id_) {
     // Not from the same task so clear cached data
+    if (last_table_id_ != -1) {
+      profiler_.increment("table_switches", 1);
+    }
     last_table_id_ = io_item.table_id();
     index_.clear();
   }
@@ -38,7 +38,7 @@ class LoadWorker {
   LoadWorker(const LoadWorkerArgs& args);
 
   std::tuple<IOItem, EvalWorkEntry> execute(
-      std::tuple<IOItem, LoadWorkEntry>& entry);
+      std::tuple<IOItem, LoadWorkEntry>&& entry);
 
  private:
   void read_other_column(i32 table_id, i32 column_id, i32 item_id,
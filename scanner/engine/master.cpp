@@ -16,6 +16,7 @@
 #include "scanner/engine/master.h"
 #include <grpc/support/log.h>
 #include <mutex>
+#include "scanner/engine/dag_analysis.h"
 #include "scanner/engine/ingest.h"
 #include "scanner/engine/sampler.h"
 #include "scanner/util/cuda.h"
@@ -24,8 +25,12 @@
 namespace scanner {
 namespace internal {
 namespace {
+// How often StreamWork looks for stragglers to re-issue to an idle node
+const i32 STREAM_WORK_POLL_MS = 100;
+
+// Output tables may already exist if they belong to resumed_job
 void validate_task_set(DatabaseMetadata& meta, const proto::TaskSet& task_set,
-                       Result* result) {
+                       const JobMetadata* resumed_job, Result* result) {
   auto& tasks = task_set.tasks();
   // Validate tasks
   std::set<std::string> task_output_table_names;
@@ -35,7 +40,9 @@ void validate_task_set(DatabaseMetadata& meta, const proto::TaskSet& task_set,
                       "tables can not have empty names";
       result->set_success(false);
     }
-    if (meta.has_table(task.output_table_name())) {
+    if (meta.has_table(task.output_table_name()) &&
+        !(resumed_job != nullptr &&
+          resumed_job->has_table(task.output_table_name()))) {
       LOG(WARNING) << "Task specified with duplicate output table name. "
                    << "A table with name " << task.output_table_name() << " "
                    << "already exists.";
@@ -81,6 +88,7 @@ void validate_task_set(DatabaseMetadata& meta, const proto::TaskSet& task_set,
     i32 op_idx = 0;
     std::vector<std::string> op_names;
     std::vector<std::vector<std::string>> op_outputs;
+    bool after_filter = false;
     for (auto& op : task_set.ops()) {
       op_names.push_back(op.name());
 
@@ -176,6 +184,44 @@ void validate_task_set(DatabaseMetadata& meta, const proto::TaskSet& task_set,
               "declaration to support stenciling.",
               op.name().c_str(), op_idx);
         }
+        // The outputs of ops after a filter or aggregate hold null elements
+        // in the rows it dropped, so such an op and the ops after it may only
+        // read their own row
+        std::vector<i32> stencil(op.stencil().begin(), op.stencil().end());
+        if (stencil.empty()) {
+          stencil = info->preferred_stencil();
+        }
+        if ((info->drops_rows() || after_filter) &&
+            !(stencil.size() == 1 && stencil[0] == 0)) {
+          RESULT_ERROR(result,
+                       "Op %s at index %d has a stencil, but filters, "
+                       "aggregates and the Ops after them can only read "
+                       "their own row.",
+                       op.name().c_str(), op_idx);
+        }
+        // An aggregate emits at the last row of each item, which must not
+        // have been dropped, and keeps state across batches. Its combine
+        // step runs on the master's CPU.
+        if (info->is_aggregate()) {
+          if (after_filter) {
+            RESULT_ERROR(result,
+                         "Aggregate Op %s at index %d can not come after a "
+                         "filter or another aggregate.",
+                         op.name().c_str(), op_idx);
+          }
+          if (op.device_type() != DeviceType::CPU) {
+            RESULT_ERROR(result,
+                         "Aggregate Op %s at index %d must run on the CPU.",
+                         op.name().c_str(), op_idx);
+          }
+          if (factory->parallel()) {
+            RESULT_ERROR(result,
+                         "Aggregate Op %s at index %d can not have a parallel "
+                         "kernel.",
+                         op.name().c_str(), op_idx);
+          }
+        }
+        after_filter |= info->drops_rows();
         // Check that a stencil is not set on a non-stenciling kernel
         if (!factory->can_batch() && op.batch() > 1) {
           RESULT_ERROR(
@@ -272,6 +318,41 @@ Result get_task_end_rows(
   }
   return result;
 }
+
+// Whether every task samples all rows of its tables the same way, so the
+// rows of an output table line up with those of its input tables
+bool samples_all_rows(const proto::TaskSet& task_set) {
+  for (auto& task : task_set.tasks()) {
+    for (auto& sample : task.samples()) {
+      if (sample.sampling_function() != "All" ||
+          sample.sampling_args() != task.samples(0).sampling_args()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Whether an IO item of the task starts with warmup rows from the item
+// before it
+bool task_has_warmup(const std::map<std::string, TableMetadata>& table_metas,
+                     const proto::Task& task) {
+  TaskSampler sampler(table_metas, task);
+  if (!sampler.validate().success()) {
+    return false;
+  }
+  i64 num_samples = sampler.total_samples();
+  for (i64 i = 0; i < num_samples; ++i) {
+    proto::NewWork new_work;
+    if (!sampler.next_work(new_work).success()) {
+      return false;
+    }
+    if (new_work.load_work().samples(0).warmup_size() > 0) {
+      return true;
+    }
+  }
+  return false;
+}
 }
 
 MasterImpl::MasterImpl(DatabaseParameters& params)
@@ -366,39 +447,102 @@ grpc::Status MasterImpl::NextWork(grpc::ServerContext* context,
                                   const proto::NodeInfo* node_info,
                                   proto::NewWork* new_work) {
   std::unique_lock<std::mutex> lk(work_mutex_);
-  if (samples_left_ <= 0) {
-    if (next_task_ < num_tasks_ && task_result_.success()) {
-      // More tasks left
-      task_sampler_.reset(new TaskSampler(
-          table_metas_, job_params_.task_set().tasks(next_task_)));
-      task_result_ = task_sampler_->validate();
-      if (task_result_.success()) {
-        samples_left_ = task_sampler_->total_samples();
-        next_task_++;
-        VLOG(1) << "Tasks left: " << num_tasks_ - next_task_;
-      }
-    } else {
-      // No more tasks left
-      new_work->mutable_io_item()->set_item_id(-1);
-      return grpc::Status::OK;
-    }
-  }
-  if (!task_result_.success()) {
+  proto::NewWorkBatch batch;
+  if (dispatcher_->next_work(node_info->node_id(), 1, batch) == 0) {
     new_work->mutable_io_item()->set_item_id(-1);
     return grpc::Status::OK;
   }
+  new_work->Swap(batch.mutable_work(0));
+  return grpc::Status::OK;
+}
 
-  assert(samples_left_ > 0);
-  task_result_ = task_sampler_->next_work(*new_work);
-  if (!task_result_.success()) {
-    new_work->mutable_io_item()->set_item_id(-1);
+grpc::Status MasterImpl::NextWorkBatch(grpc::ServerContext* context,
+                                       const proto::WorkRequest* request,
+                                       proto::NewWorkBatch* batch) {
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  dispatcher_->next_work(request->node_id(), request->max_items(), *batch);
+  return grpc::Status::OK;
+}
+
+grpc::Status MasterImpl::StreamWork(
+    grpc::ServerContext* context, const proto::WorkRequest* request,
+    grpc::ServerWriter<proto::NewWorkBatch>* writer) {
+  i32 node_id = request->node_id();
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  // The stream only serves the job that is running when it opens
+  std::shared_ptr<WorkDispatcher> dispatcher = dispatcher_;
+  NodeWork& start = node_work_[node_id];
+  start.max_items = request->max_items();
+  start.in_flight = 0;
+  while (!context->IsCancelled() && dispatcher_ == dispatcher) {
+    // node_work_ is cleared by the next job, so look the node up every time
+    NodeWork& node = node_work_[node_id];
+    proto::NewWorkBatch batch;
+    if (node.in_flight < node.max_items) {
+      node.in_flight += dispatcher->next_work(
+          node_id, node.max_items - node.in_flight, batch);
+    } else {
+      // Saves the node never reported would otherwise keep it from ever
+      // hearing that the job is over
+      batch.set_finished(dispatcher->finished());
+    }
+    if (batch.work_size() == 0 && !batch.finished()) {
+      // Woken when the node retires an item. Stragglers become worth
+      // re-issuing without any call, so also look again every so often.
+      work_cv_.wait_for(lk, std::chrono::milliseconds(STREAM_WORK_POLL_MS));
+      continue;
+    }
+    lk.unlock();
+    bool written = writer->Write(batch);
+    lk.lock();
+    if (!written || batch.finished()) {
+      break;
+    }
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status MasterImpl::FinishedWork(grpc::ServerContext* context,
+                                      const proto::FinishedItem* item,
+                                      proto::CommitGrant* grant) {
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  if (item->job_id() != job_id_) {
+    grant->set_commit(false);
     return grpc::Status::OK;
   }
+  grant->set_commit(dispatcher_->commit(item->node_id(), item->table_id(),
+                                        item->item_id()));
+  if (!grant->commit()) {
+    retire_item(*item);
+    work_cv_.notify_all();
+  }
+  return grpc::Status::OK;
+}
 
-  samples_left_--;
-  total_samples_used_++;
-  if (bar_) {
-    bar_->Progressed(total_samples_used_);
+grpc::Status MasterImpl::SavedWork(grpc::ServerContext* context,
+                                   const proto::FinishedItem* item,
+                                   proto::Empty* empty) {
+  std::shared_ptr<CommitLog> commit_log;
+  {
+    std::unique_lock<std::mutex> lk(work_mutex_);
+    if (item->job_id() != job_id_) {
+      // A late report from an earlier job
+      return grpc::Status::OK;
+    }
+    // Items stay outstanding until saved, so a copy that dies after being
+    // granted the item is re-issued
+    if (dispatcher_->saved(item->node_id(), item->table_id(),
+                           item->item_id())) {
+      commit_log = commit_log_;
+    }
+    retire_item(*item);
+    // The job may have just finished
+    work_cv_.notify_all();
+  }
+  if (commit_log) {
+    // Appending may write out a log segment, so keep it out of work_mutex_
+    commit_log->append(item->table_id(), item->item_id());
+    record_finished(1);
   }
   return grpc::Status::OK;
 }
@@ -422,7 +566,35 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
   DatabaseMetadata meta_copy =
       read_database_metadata(storage_, DatabaseMetadata::descriptor_path());
 
-  validate_task_set(meta, job_params->task_set(), job_result);
+  // A resumed job keeps its id and output tables, and only runs the items
+  // its commit log does not list
+  std::unique_ptr<JobMetadata> resumed_job;
+  if (job_params->resume() && meta.has_job(job_params->job_name())) {
+    resumed_job.reset(new JobMetadata(read_job_metadata(
+        storage_, JobMetadata::descriptor_path(
+                      meta.get_job_id(job_params->job_name())))));
+    const proto::JobDescriptor& old_job = resumed_job->get_descriptor();
+    auto& tasks = job_params->task_set().tasks();
+    bool same_items = old_job.io_item_size() == io_item_size &&
+                      old_job.tasks_size() == tasks.size();
+    for (i32 i = 0; same_items && i < tasks.size(); ++i) {
+      same_items = old_job.tasks(i).SerializeAsString() ==
+                   tasks.Get(i).SerializeAsString();
+    }
+    if (!same_items) {
+      RESULT_ERROR(job_result,
+                   "Job %s can only be resumed with the same tasks and IO "
+                   "item size",
+                   job_params->job_name().c_str());
+      return grpc::Status::OK;
+    }
+  } else if (job_params->resume()) {
+    LOG(INFO) << "No job named " << job_params->job_name()
+              << " to resume, starting it from scratch";
+  }
+
+  validate_task_set(meta, job_params->task_set(), resumed_job.get(),
+                    job_result);
   if (!job_result->success()) {
     // No database changes made at this point, so just return
     return grpc::Status::OK;
@@ -435,6 +607,18 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
     table_metas_[table_name] = read_table_metadata(storage_, table_path);
   }
 
+  // Work is made from a copy of the task set that loads the op outputs
+  // earlier jobs memoized, without the ops and input columns it then does
+  // not need, so those columns are never loaded or decoded. The job
+  // descriptor keeps the tasks as given, since resuming a job compares
+  // against them. If every op output was memoized, no op is left and the
+  // workers only move the loaded columns into the output tables.
+  if (job_params->memoize() && samples_all_rows(job_params->task_set())) {
+    read_memoized_columns(*job_params_.mutable_task_set(),
+                          find_memoized_columns(meta, job_params_.task_set()));
+  }
+  prune_task_set(*job_params_.mutable_task_set());
+
   // Get output columns from last output op
   std::vector<Column> input_table_columns;
   {
@@ -484,6 +668,43 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
       assert(found);
     }
   }
+  // An item can lose every row to a filter, and videos can not be empty
+  bool drops_rows = false;
+  i32 aggregate_idx = -1;
+  for (i32 i = 0; i < ops.size(); ++i) {
+    auto& op = ops.Get(i);
+    if (!op_registry->has_op(op.name())) {
+      continue;
+    }
+    OpInfo* info = op_registry->get_op_info(op.name());
+    drops_rows |= info->drops_rows();
+    if (info->is_aggregate()) {
+      aggregate_idx = i;
+    }
+  }
+  // The per-item rows of a table are combined if it holds exactly the
+  // aggregate's outputs
+  bool combines = false;
+  if (aggregate_idx != -1 && last_op.inputs_size() == 1 &&
+      last_op.inputs(0).op_index() == aggregate_idx) {
+    const std::vector<Column>& aggregate_columns =
+        op_registry->get_op_info(ops.Get(aggregate_idx).name())
+            ->output_columns();
+    auto& columns = last_op.inputs(0).columns();
+    combines = columns.size() == aggregate_columns.size();
+    for (i32 i = 0; combines && i < columns.size(); ++i) {
+      combines = columns.Get(i) == aggregate_columns[i].name();
+    }
+  }
+  for (auto& col : output_columns) {
+    if (drops_rows && col.type() == ColumnType::Video) {
+      RESULT_ERROR(job_result,
+                   "Output column %s is a video, but jobs with filter or "
+                   "aggregate Ops can not output videos.",
+                   col.name().c_str());
+      return grpc::Status::OK;
+    }
+  }
   proto::JobDescriptor job_descriptor;
   job_descriptor.set_io_item_size(io_item_size);
   job_descriptor.set_work_item_size(work_item_size);
@@ -499,17 +720,20 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
 
   // Add job name into database metadata so we can look up what jobs have
   // been run
-  i32 job_id = meta.add_job(job_params->job_name());
+  i32 job_id = resumed_job ? resumed_job->id()
+                           : meta.add_job(job_params->job_name());
   job_descriptor.set_id(job_id);
+  job_params_.set_job_id(job_id);
   job_descriptor.set_name(job_params->job_name());
 
   i64 min_stencil, max_stencil;
   std::tie(min_stencil, max_stencil) =
-      determine_stencil_bounds(job_params->task_set());
+      determine_stencil_bounds(job_params_.task_set());
   total_samples_used_ = 0;
   total_samples_ = 0;
   for (auto& task : job_params->task_set().tasks()) {
-    i32 table_id = meta.add_table(task.output_table_name());
+    i32 table_id = resumed_job ? meta.get_table_id(task.output_table_name())
+                               : meta.add_table(task.output_table_name());
     proto::TableDescriptor table_desc;
     table_desc.set_id(table_id);
     table_desc.set_name(task.output_table_name());
@@ -529,6 +753,14 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
       *job_result = result;
       break;
     }
+    // Warmup rows would be folded into the aggregates of two items
+    if (aggregate_idx != -1 && task_has_warmup(table_metas_, task)) {
+      RESULT_ERROR(job_result,
+                   "Task for table %s has warmup rows, which jobs with "
+                   "aggregate Ops do not support.",
+                   task.output_table_name().c_str());
+      break;
+    }
     total_samples_ += end_rows.size();
     for (i64 r : end_rows) {
       table_desc.add_end_rows(r);
@@ -546,15 +778,31 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
   // Write out database metadata so that workers can read it
   write_job_metadata(storage_, JobMetadata(job_descriptor));
 
+  std::shared_ptr<CommitLog> commit_log(
+      new CommitLog(storage_, job_id, resumed_job != nullptr));
+  total_samples_used_ = commit_log->committed().size();
+  if (resumed_job) {
+    LOG(INFO) << "Resuming job " << job_params->job_name() << " with "
+              << total_samples_used_ << " of " << total_samples_
+              << " IO items already saved";
+  }
+
   // Setup initial task sampler
-  task_result_.set_success(true);
-  samples_left_ = 0;
-  next_task_ = 0;
-  num_tasks_ = job_params->task_set().tasks_size();
+  {
+    // Workers from an earlier job may still be asking for work
+    std::unique_lock<std::mutex> lk(work_mutex_);
+    job_id_ = job_id;
+    commit_log_ = commit_log;
+    dispatcher_.reset(new WorkDispatcher(table_metas_, job_params_.task_set(),
+                                         commit_log->committed()));
+    node_work_.clear();
+    // Ends streams still open for an earlier job
+    work_cv_.notify_all();
+  }
 
   write_database_metadata(storage_, meta);
 
-  VLOG(1) << "Total tasks: " << num_tasks_;
+  VLOG(1) << "Total tasks: " << job_params->task_set().tasks_size();
 
   grpc::CompletionQueue cq;
   std::vector<grpc::ClientContext> client_contexts(workers_.size());
@@ -565,6 +813,7 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
 
   if (job_params->show_progress()) {
     bar_.reset(new ProgressBar(total_samples_, ""));
+    bar_->Progressed(total_samples_used_);
   } else {
     bar_.reset(nullptr);
   }
@@ -582,7 +831,7 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
   }
 
   proto::JobParameters w_job_params;
-  w_job_params.CopyFrom(*job_params);
+  w_job_params.CopyFrom(job_params_);
   w_job_params.set_global_total(workers_.size());
   for (size_t i = 0; i < workers_.size(); ++i) {
     auto& worker = workers_[i];
@@ -611,26 +860,274 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
                    << " returned error: " << replies[worker_id].msg();
       job_result->set_success(false);
       job_result->set_msg(replies[worker_id].msg());
-      next_task_ = num_tasks_;
+      dispatcher_->cancel();
+      work_cv_.notify_all();
     }
   }
 
+  // Whatever was saved is kept for a resumed run, even if the job failed
+  commit_log->flush();
+
   if (!job_result->success()) {
-    // Overwrite database metadata with copy from prior to modification
-    write_database_metadata(storage_, meta_copy);
+    if (commit_log->size() == 0) {
+      // Overwrite database metadata with copy from prior to modification
+      write_database_metadata(storage_, meta_copy);
+    } else {
+      LOG(WARNING) << "Job " << job_params->job_name() << " failed after "
+                   << "saving " << commit_log->size() << " of "
+                   << total_samples_ << " IO items. Run it again with resume "
+                   << "to finish the rest.";
+    }
   }
-  if (!task_result_.success()) {
-    job_result->CopyFrom(task_result_);
+  Result task_result = dispatcher_->result();
+  if (!task_result.success()) {
+    job_result->CopyFrom(task_result);
   } else {
-    assert(next_task_ == num_tasks_);
+    assert(dispatcher_->finished());
+    VLOG(1) << "Re-issued " << dispatcher_->items_reissued()
+            << " straggling items";
     if (bar_) {
       bar_->Progressed(total_samples_);
     }
   }
+  if (job_result->success() && drops_rows) {
+    // Output tables were laid out for every sampled row, so shrink each item
+    // to the rows its filters kept, as recorded by the save workers
+    for (auto& task : job_params->task_set().tasks()) {
+      i32 table_id = meta.get_table_id(task.output_table_name());
+      TableMetadata table = read_table_metadata(
+          storage_, TableMetadata::descriptor_path(table_id));
+      proto::TableDescriptor& table_desc = table.get_descriptor();
+      i64 end_row = 0;
+      for (i32 item_id = 0; item_id < table_desc.end_rows_size(); ++item_id) {
+        storehouse::FileInfo info;
+        storehouse::StoreResult result = storage_->get_file_info(
+            table_item_row_ids_path(table_id, item_id), info);
+        LOG_IF(FATAL, result != storehouse::StoreResult::Success)
+            << "Missing row ids for item " << item_id << " of table "
+            << task.output_table_name();
+        end_row += info.size / sizeof(i64);
+        table_desc.set_end_rows(item_id, end_row);
+      }
+      write_table_metadata(storage_, table);
+    }
+  }
+  // Outputs only line up with the rows they were computed from if no rows
+  // were dropped or lost to stencils
+  if (job_result->success() && job_params->memoize() && !drops_rows &&
+      min_stencil == 0 && max_stencil == 0 &&
+      samples_all_rows(job_params->task_set())) {
+    memoize_columns(meta, job_params->task_set());
+  }
+  if (job_result->success() && combines) {
+    for (auto& task : job_params->task_set().tasks()) {
+      combine_aggregate(ops.Get(aggregate_idx),
+                        meta.get_table_id(task.output_table_name()));
+    }
+  }
 
   return grpc::Status::OK;
 }
 
+std::map<std::string, std::string> MasterImpl::table_versions() const {
+  std::map<std::string, std::string> versions;
+  for (auto& kv : table_metas_) {
+    const proto::TableDescriptor& desc = kv.second.get_descriptor();
+    versions[kv.first] =
+        std::to_string(desc.id()) + ":" + std::to_string(desc.timestamp());
+  }
+  return versions;
+}
+
+std::vector<MemoizedColumns> MasterImpl::find_memoized_columns(
+    const DatabaseMetadata& meta, const proto::TaskSet& task_set) {
+  std::map<std::string, std::string> versions = table_versions();
+  std::vector<MemoizedColumns> memoized;
+  for (auto& task : task_set.tasks()) {
+    memoized.emplace_back();
+    auto keys = memo_keys(task_set, task, versions);
+    for (i32 i = 1; i < task_set.ops_size() - 1; ++i) {
+      for (auto& kv : keys[i]) {
+        const std::string path = memoized_column_path(kv.second);
+        storehouse::FileInfo info;
+        if (storage_->get_file_info(path, info) !=
+            storehouse::StoreResult::Success) {
+          continue;
+        }
+        std::unique_ptr<storehouse::RandomReadFile> file;
+        BACKOFF_FAIL(make_unique_random_read_file(storage_, path, file));
+        u64 pos = 0;
+        proto::MemoizedColumn entry =
+            deserialize_db_proto<proto::MemoizedColumn>(file.get(), pos);
+        // The table may have been deleted or replaced since
+        const std::string& table_name = entry.table_name();
+        if (entry.key() != kv.second || !meta.has_table(table_name) ||
+            meta.get_table_id(table_name) != entry.table_id()) {
+          continue;
+        }
+        bool has_column = false;
+        for (auto& col : table_metas_.at(table_name).columns()) {
+          has_column |= col.name() == entry.column_name();
+        }
+        if (!has_column) {
+          continue;
+        }
+        memoized.back()[std::make_tuple(i, kv.first)] =
+            std::make_tuple(table_name, entry.column_name());
+      }
+    }
+  }
+  return memoized;
+}
+
+void MasterImpl::memoize_columns(const DatabaseMetadata& meta,
+                                 const proto::TaskSet& task_set) {
+  std::map<std::string, std::string> versions = table_versions();
+  auto& output_op = task_set.ops(task_set.ops_size() - 1);
+  for (auto& task : task_set.tasks()) {
+    auto keys = memo_keys(task_set, task, versions);
+    for (auto& input : output_op.inputs()) {
+      // Input columns are already in tables
+      if (input.op_index() == 0) {
+        continue;
+      }
+      for (const std::string& col : input.columns()) {
+        proto::MemoizedColumn entry;
+        entry.set_key(keys[input.op_index()].at(col));
+        entry.set_table_id(meta.get_table_id(task.output_table_name()));
+        entry.set_table_name(task.output_table_name());
+        entry.set_column_name(col);
+        std::unique_ptr<storehouse::WriteFile> file;
+        BACKOFF_FAIL(make_unique_write_file(
+            storage_, memoized_column_path(entry.key()), file));
+        serialize_db_proto<proto::MemoizedColumn>(file.get(), entry);
+        BACKOFF_FAIL(file->save());
+      }
+    }
+  }
+}
+
+void MasterImpl::combine_aggregate(const proto::Op& op, i32 table_id) {
+  TableMetadata table =
+      read_table_metadata(storage_, TableMetadata::descriptor_path(table_id));
+  proto::TableDescriptor& table_desc = table.get_descriptor();
+  i32 num_items = table_desc.end_rows_size();
+  i32 num_columns = table_desc.columns_size();
+
+  // Read back the rows the workers saved for each item
+  BatchedColumns partial_columns(num_columns);
+  i64 last_row_id = 0;
+  for (i32 item_id = 0; item_id < num_items; ++item_id) {
+    for (i32 c = 0; c < num_columns; ++c) {
+      std::unique_ptr<storehouse::RandomReadFile> file;
+      BACKOFF_FAIL(make_unique_random_read_file(
+          storage_,
+          table_item_output_path(table_id, table_desc.columns(c).id(),
+                                 item_id),
+          file));
+      u64 pos = 0;
+      u64 num_elements = s_read<u64>(file.get(), pos);
+      std::vector<i64> sizes;
+      for (u64 i = 0; i < num_elements; ++i) {
+        sizes.push_back(s_read<i64>(file.get(), pos));
+      }
+      for (i64 size : sizes) {
+        u8* buffer = new_buffer(CPU_DEVICE, size);
+        s_read(file.get(), buffer, size, pos);
+        insert_element(partial_columns[c], buffer, size);
+      }
+    }
+    std::unique_ptr<storehouse::RandomReadFile> file;
+    BACKOFF_FAIL(make_unique_random_read_file(
+        storage_, table_item_row_ids_path(table_id, item_id), file));
+    u64 pos = 0;
+    std::vector<u8> row_ids = storehouse::read_entire_file(file.get(), pos);
+    if (row_ids.size() >= sizeof(i64)) {
+      memcpy(&last_row_id, row_ids.data() + row_ids.size() - sizeof(i64),
+             sizeof(i64));
+    }
+  }
+
+  KernelFactory* factory =
+      get_kernel_registry()->get_kernel(op.name(), DeviceType::CPU);
+  KernelConfig config;
+  config.devices = {CPU_DEVICE};
+  config.args = std::vector<u8>(op.kernel_args().begin(),
+                                op.kernel_args().end());
+  for (auto& col : table_desc.columns()) {
+    config.output_columns.push_back(col.name());
+  }
+  for (auto& input : op.inputs()) {
+    config.input_columns.insert(config.input_columns.end(),
+                                input.columns().begin(),
+                                input.columns().end());
+  }
+  config.work_item_size = job_params_.work_item_size();
+  config.node_id = 0;
+  config.node_count = 1;
+  std::unique_ptr<BaseKernel> kernel(factory->new_instance(config));
+  AggregateKernel* aggregate = dynamic_cast<AggregateKernel*>(kernel.get());
+  LOG_IF(FATAL, aggregate == nullptr)
+      << "Kernel of aggregate op " << op.name()
+      << " is not an AggregateKernel";
+  Columns combined(num_columns);
+  aggregate->combine(partial_columns, combined);
+  for (ElementList& column : partial_columns) {
+    for (Element& element : column) {
+      delete_element(CPU_DEVICE, element);
+    }
+  }
+
+  // The combined row goes in an item after the partial ones, which are left
+  // in place so that combining again, as a resumed job does, reads the same
+  // rows
+  for (i32 c = 0; c < num_columns; ++c) {
+    std::unique_ptr<storehouse::WriteFile> file;
+    BACKOFF_FAIL(make_unique_write_file(
+        storage_,
+        table_item_output_path(table_id, table_desc.columns(c).id(),
+                               num_items),
+        file));
+    s_write(file.get(), (u64)1);
+    s_write(file.get(), (i64)combined[c].size);
+    s_write(file.get(), combined[c].buffer, combined[c].size);
+    BACKOFF_FAIL(file->save());
+    delete_element(CPU_DEVICE, combined[c]);
+  }
+  std::unique_ptr<storehouse::WriteFile> file;
+  BACKOFF_FAIL(make_unique_write_file(
+      storage_, table_item_row_ids_path(table_id, num_items), file));
+  s_write(file.get(), last_row_id);
+  BACKOFF_FAIL(file->save());
+
+  for (i32 item_id = 0; item_id < num_items; ++item_id) {
+    table_desc.set_end_rows(item_id, 0);
+  }
+  table_desc.add_end_rows(1);
+  write_table_metadata(storage_, table);
+}
+
+void MasterImpl::record_finished(i64 items) {
+  std::unique_lock<std::mutex> lk(progress_mutex_);
+  total_samples_used_ += items;
+  if (bar_) {
+    bar_->Progressed(total_samples_used_);
+  }
+}
+
+void MasterImpl::retire_item(const proto::FinishedItem& item) {
+  auto it = node_work_.find(item.node_id());
+  if (it == node_work_.end()) {
+    // The node does not stream its work
+    return;
+  }
+  NodeWork& node = it->second;
+  node.in_flight = std::max(0, node.in_flight - 1);
+  if (item.max_items() > 0) {
+    node.max_items = item.max_items();
+  }
+}
+
 grpc::Status MasterImpl::Ping(grpc::ServerContext* context,
                               const proto::Empty* empty1,
                               proto::Empty* empty2) {
@@ -659,6 +1156,13 @@ grpc::Status MasterImpl::GetOpInfo(grpc::ServerContext* context,
     Column* info = op_info->add_output_columns();
     info->CopyFrom(output_column);
   }
+  KernelRegistry* kernel_registry = get_kernel_registry();
+  for (DeviceType type : {DeviceType::CPU, DeviceType::GPU}) {
+    if (kernel_registry->has_kernel(op_name, type) &&
+        kernel_registry->get_kernel(op_name, type)->can_batch()) {
+      op_info->add_batch_devices(type);
+    }
+  }
   op_info->mutable_result()->set_success(true);
 
   return grpc::Status::OK;
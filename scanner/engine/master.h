@@ -16,12 +16,16 @@
 #pragma once
 
 #include <grpc/support/log.h>
+#include "scanner/engine/commit_log.h"
+#include "scanner/engine/dag_analysis.h"
 #include "scanner/engine/rpc.grpc.pb.h"
 #include "scanner/engine/runtime.h"
 #include "scanner/engine/sampler.h"
+#include "scanner/engine/work_dispatcher.h"
 #include "scanner/util/progress_bar.h"
 #include "scanner/util/util.h"
 
+#include <condition_variable>
 #include <mutex>
 #include <thread>
 
@@ -56,6 +60,22 @@ class MasterImpl final : public proto::Master::Service {
                         const proto::NodeInfo* node_info,
                         proto::NewWork* new_work);
 
+  grpc::Status NextWorkBatch(grpc::ServerContext* context,
+                             const proto::WorkRequest* request,
+                             proto::NewWorkBatch* batch);
+
+  grpc::Status StreamWork(grpc::ServerContext* context,
+                          const proto::WorkRequest* request,
+                          grpc::ServerWriter<proto::NewWorkBatch>* writer);
+
+  grpc::Status FinishedWork(grpc::ServerContext* context,
+                            const proto::FinishedItem* item,
+                            proto::CommitGrant* grant);
+
+  grpc::Status SavedWork(grpc::ServerContext* context,
+                         const proto::FinishedItem* item,
+                         proto::Empty* empty);
+
   grpc::Status NewJob(grpc::ServerContext* context,
                       const proto::JobParameters* job_params,
                       proto::Result* job_result);
@@ -79,6 +99,27 @@ class MasterImpl final : public proto::Master::Service {
   void start_watchdog(grpc::Server* server, i32 timeout_ms = 50000);
 
  private:
+  void record_finished(i64 items);
+
+  // Requires work_mutex_. Takes an item of node off its StreamWork count.
+  void retire_item(const proto::FinishedItem& item);
+
+  // Version of the contents of each table, for memo keys
+  std::map<std::string, std::string> table_versions() const;
+
+  // Op outputs that earlier jobs memoized for each task of task_set, in
+  // tables that still hold them
+  std::vector<MemoizedColumns> find_memoized_columns(
+      const DatabaseMetadata& meta, const proto::TaskSet& task_set);
+
+  // Records the op outputs in the output tables of a finished job
+  void memoize_columns(const DatabaseMetadata& meta,
+                       const proto::TaskSet& task_set);
+
+  // Replaces the per-item rows of an output table holding exactly the
+  // outputs of aggregate op with the one row its combine step makes of them
+  void combine_aggregate(const proto::Op& op, i32 table_id);
+
   std::thread watchdog_thread_;
   std::atomic<bool> watchdog_awake_;
   std::vector<std::unique_ptr<proto::Worker::Stub>> workers_;
@@ -93,12 +134,22 @@ class MasterImpl final : public proto::Master::Service {
   i64 total_samples_used_;
   i64 total_samples_;
 
+  // Items a node streaming its work wants in flight, and has in flight
+  struct NodeWork {
+    i32 max_items = 0;
+    i32 in_flight = 0;
+  };
+
   std::mutex work_mutex_;
-  i64 next_task_;
-  i64 num_tasks_;
-  std::unique_ptr<TaskSampler> task_sampler_;
-  i64 samples_left_;
-  Result task_result_;
+  // Signalled under work_mutex_ when a node may have room for more items
+  std::condition_variable work_cv_;
+  std::map<i32, NodeWork> node_work_;
+  // Job the work RPCs serve, and where its saved items are recorded
+  i32 job_id_ = -1;
+  std::shared_ptr<CommitLog> commit_log_;
+  std::mutex progress_mutex_;
+  // Shared with the StreamWork calls of its job
+  std::shared_ptr<WorkDispatcher> dispatcher_;
 };
 }
 }
@@ -0,0 +1,142 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures how many IO items per second the master can hand out to many
+// workers. Each simulated worker is a thread that requests work from the
+// WorkDispatcher the master serves NextWork and NextWorkBatch from,
+// serializes the reply as the RPC layer would, and sleeps for one network
+// round trip per request. Items are committed and saved as soon as they
+// arrive, as FinishedWork and SavedWork would from the save threads.
+// Switches counts how often a worker got an item from a different table than
+// the one before, each of which costs a load worker its cached metadata.
+//
+// Usage: MasterBenchmark [items] [round trip us] [tables]
+
+#include "scanner/engine/work_dispatcher.h"
+#include "scanner/util/common.h"
+#include "scanner/util/util.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace scanner;
+using namespace scanner::internal;
+
+namespace {
+
+// Rows per IO item, small enough that the master sees many requests
+const i64 ITEM_SIZE = 8;
+
+TableMetadata make_table(i32 id, const std::string& name, i64 rows) {
+  proto::TableDescriptor desc;
+  desc.set_id(id);
+  desc.set_name(name);
+  proto::Column* col = desc.add_columns();
+  col->set_id(0);
+  col->set_name("frame");
+  col->set_type(proto::Video);
+  desc.add_end_rows(rows);
+  return TableMetadata(desc);
+}
+
+f64 run(const std::map<std::string, TableMetadata>& table_metas,
+        const proto::TaskSet& task_set, i32 num_workers, i32 batch_size,
+        i32 round_trip_us, i64& switches) {
+  WorkDispatcher dispatcher(table_metas, task_set);
+  auto start = now();
+  std::vector<std::thread> workers;
+  std::vector<i64> worker_switches(num_workers);
+  for (i32 w = 0; w < num_workers; ++w) {
+    workers.emplace_back([&, w]() {
+      std::string wire;
+      i32 last_table_id = -1;
+      while (true) {
+        proto::NewWorkBatch batch;
+        dispatcher.next_work(w, batch_size, batch);
+        batch.SerializeToString(&wire);
+        for (auto& work : batch.work()) {
+          if (work.io_item().table_id() != last_table_id) {
+            worker_switches[w] += last_table_id != -1;
+            last_table_id = work.io_item().table_id();
+          }
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(round_trip_us));
+        for (auto& work : batch.work()) {
+          dispatcher.commit(w, work.io_item().table_id(),
+                            work.io_item().item_id());
+          dispatcher.saved(w, work.io_item().table_id(),
+                           work.io_item().item_id());
+        }
+        if (batch.finished()) {
+          break;
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  f64 seconds = nano_since(start) / 1e9;
+  switches = 0;
+  for (i64 s : worker_switches) {
+    switches += s;
+  }
+  return dispatcher.items_dispatched() / seconds;
+}
+}
+
+int main(int argc, char** argv) {
+  i64 num_items = argc > 1 ? std::atol(argv[1]) : 200000;
+  i32 round_trip_us = argc > 2 ? std::atoi(argv[2]) : 200;
+  i32 num_tables = argc > 3 ? std::atoi(argv[3]) : 16;
+
+  std::map<std::string, TableMetadata> table_metas;
+  proto::TaskSet task_set;
+  proto::AllSamplerArgs args;
+  args.set_sample_size(ITEM_SIZE);
+  std::string sampler_args;
+  args.SerializeToString(&sampler_args);
+  i64 rows_per_table = num_items / num_tables * ITEM_SIZE;
+  for (i32 t = 0; t < num_tables; ++t) {
+    std::string input = "input" + std::to_string(t);
+    std::string output = "output" + std::to_string(t);
+    table_metas[input] = make_table(t, input, rows_per_table);
+    table_metas[output] = make_table(num_tables + t, output, rows_per_table);
+
+    proto::Task* task = task_set.add_tasks();
+    task->set_output_table_name(output);
+    proto::TableSample* sample = task->add_samples();
+    sample->set_table_name(input);
+    sample->add_column_names("frame");
+    sample->set_sampling_function("All");
+    sample->set_sampling_args(sampler_args);
+  }
+
+  // Batches of one are what NextWork serves
+  std::vector<i32> worker_counts = {1, 16, 128};
+  std::vector<i32> batch_sizes = {1, 8, 32};
+  printf("%8s %8s %14s %10s\n", "workers", "batch", "items/s", "switches");
+  for (i32 num_workers : worker_counts) {
+    for (i32 batch_size : batch_sizes) {
+      i64 switches;
+      f64 rate = run(table_metas, task_set, num_workers, batch_size,
+                     round_trip_us, switches);
+      printf("%8d %8d %14.0f %10ld\n", num_workers, batch_size, rate,
+             switches);
+    }
+  }
+  return 0;
+}
@@ -58,6 +58,18 @@ inline std::string table_item_video_metadata_path(i32 table_id, i32 column_id,
          std::to_string(item_id) + "_video_metadata.bin";
 }
 
+// Row of the job's input that each row of the item came from, written for
+// jobs whose filters drop rows
+inline std::string table_item_row_ids_path(i32 table_id, i32 item_id) {
+  return table_directory(table_id) + "/row_ids_" + std::to_string(item_id) +
+         ".bin";
+}
+
+// Where the column holding the op output with content key is recorded
+inline std::string memoized_column_path(const std::string& key) {
+  return get_database_path() + "memo/" + key + ".bin";
+}
+
 inline std::string job_directory(i32 job_id) {
   return get_database_path() + "jobs/" + std::to_string(job_id);
 }
@@ -66,6 +78,12 @@ inline std::string job_descriptor_path(i32 job_id) {
   return job_directory(job_id) + "/descriptor.bin";
 }
 
+// Segment seq of the log of IO items whose outputs have all been saved
+inline std::string job_commit_log_path(i32 job_id, i32 seq) {
+  return job_directory(job_id) + "/commit_log_" + std::to_string(seq) +
+         ".bin";
+}
+
 inline std::string job_profiler_path(i32 job_id, i32 node) {
   return job_directory(job_id) + "/profile_" + std::to_string(node) + ".bin";
 }
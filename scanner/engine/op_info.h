@@ -28,13 +28,17 @@ class OpInfo {
   OpInfo(const std::string& name, bool variadic_inputs,
          const std::vector<Column>& input_columns,
          const std::vector<Column>& output_columns, bool can_stencil,
-         const std::vector<i32> preferred_stencil)
+         const std::vector<i32> preferred_stencil, bool is_filter,
+         bool is_aggregate, i32 version)
     : name_(name),
       variadic_inputs_(variadic_inputs),
       input_columns_(input_columns),
       output_columns_(output_columns),
       can_stencil_(can_stencil),
-      preferred_stencil_(preferred_stencil) {}
+      preferred_stencil_(preferred_stencil),
+      is_filter_(is_filter),
+      is_aggregate_(is_aggregate),
+      version_(version) {}
 
   const std::string& name() const { return name_; }
 
@@ -50,6 +54,15 @@ class OpInfo {
     return preferred_stencil_;
   }
 
+  const bool is_filter() const { return is_filter_; }
+
+  const bool is_aggregate() const { return is_aggregate_; }
+
+  //! Whether ops after this one see fewer rows than it did
+  const bool drops_rows() const { return is_filter_ || is_aggregate_; }
+
+  const i32 version() const { return version_; }
+
  private:
   std::string name_;
   bool variadic_inputs_;
@@ -57,6 +70,9 @@ class OpInfo {
   std::vector<Column> output_columns_;
   bool can_stencil_;
   std::vector<i32> preferred_stencil_;
+  bool is_filter_;
+  bool is_aggregate_;
+  i32 version_;
 };
 }
 }
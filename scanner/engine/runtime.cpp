@@ -36,32 +36,41 @@ void move_if_different_address_space(Profiler& profiler,
                                      ElementList& column) {
   if (!current_handle.is_same_address_space(target_handle) &&
       column.size() > 0) {
-    bool is_frame = column[0].is_frame;
+    // Null elements of rows an op did not compute have nothing to move
+    std::vector<Element*> elements;
+    for (Element& element : column) {
+      if (!is_null_element(element)) {
+        elements.push_back(&element);
+      }
+    }
+    if (elements.empty()) {
+      return;
+    }
+    bool is_frame = elements[0]->is_frame;
 
     std::vector<u8*> src_buffers;
     std::vector<u8*> dest_buffers;
     std::vector<size_t> sizes;
     if (is_frame) {
-      for (i32 b = 0; b < (i32)column.size(); ++b) {
-        Frame* frame = column[b].as_frame();
+      for (Element* element : elements) {
+        Frame* frame = element->as_frame();
         src_buffers.push_back(frame->data);
         sizes.push_back(frame->size());
       }
     } else {
-      for (i32 b = 0; b < (i32)column.size(); ++b) {
-        src_buffers.push_back(column[b].buffer);
-        sizes.push_back(column[b].size);
+      for (Element* element : elements) {
+        src_buffers.push_back(element->buffer);
+        sizes.push_back(element->size);
       }
     }
 
     size_t total_size = 0;
-    for (i32 b = 0; b < (i32)column.size(); ++b) {
-      total_size += sizes[b];
+    for (size_t size : sizes) {
+      total_size += size;
     }
 
-    u8* block = new_block_buffer(target_handle, total_size, column.size());
-    for (i32 b = 0; b < (i32)column.size(); ++b) {
-      size_t size = sizes[b];
+    u8* block = new_block_buffer(target_handle, total_size, elements.size());
+    for (size_t size : sizes) {
       dest_buffers.push_back(block);
       block += size;
     }
@@ -72,15 +81,15 @@ void move_if_different_address_space(Profiler& profiler,
 
     auto delete_start = now();
     if (is_frame) {
-      for (i32 b = 0; b < (i32)column.size(); ++b) {
-        Frame* frame = column[b].as_frame();
+      for (size_t b = 0; b < elements.size(); ++b) {
+        Frame* frame = elements[b]->as_frame();
         delete_buffer(current_handle, frame->data);
         frame->data = dest_buffers[b];
       }
     } else {
-      for (i32 b = 0; b < (i32)column.size(); ++b) {
-        delete_buffer(current_handle, column[b].buffer);
-        column[b].buffer = dest_buffers[b];
+      for (size_t b = 0; b < elements.size(); ++b) {
+        delete_buffer(current_handle, elements[b]->buffer);
+        elements[b]->buffer = dest_buffers[b];
       }
     }
   }
@@ -148,6 +157,39 @@ ElementList duplicate_elements(Profiler& profiler, DeviceHandle current_handle,
   return output_list;
 }
 
+namespace {
+// Buffers from new_buffer, e.g. non-frame columns from the load worker, have
+// no reference count, so they are copied instead
+u8* share_buffer(DeviceHandle device, u8* buffer, size_t size) {
+  if (try_add_buffer_ref(device, buffer)) {
+    return buffer;
+  }
+  u8* copy = new_buffer(device, size);
+  memcpy_buffer(copy, device, buffer, device, size);
+  return copy;
+}
+}
+
+ElementList share_elements(DeviceHandle device, const ElementList& column) {
+  ElementList output_list;
+  for (const Element& element : column) {
+    if (is_null_element(element)) {
+      output_list.push_back(element);
+    } else if (element.is_frame) {
+      const Frame* frame = element.as_const_frame();
+      u8* data = share_buffer(device, frame->data, frame->size());
+      // Frame structs are owned by their element, so wrap the shared data in
+      // a new one
+      insert_frame(output_list, new Frame(frame->as_frame_info(), data));
+    } else {
+      insert_element(output_list,
+                     share_buffer(device, element.buffer, element.size),
+                     element.size);
+    }
+  }
+  return output_list;
+}
+
 std::tuple<i64, i64> determine_stencil_bounds(const proto::TaskSet& task_set) {
   i64 min = std::numeric_limits<i64>::max();
   i64 max = std::numeric_limits<i64>::min();
@@ -168,6 +210,11 @@ std::tuple<i64, i64> determine_stencil_bounds(const proto::TaskSet& task_set) {
     min = std::min((i64)stencil[0], min);
     max = std::max((i64)stencil[stencil.size() - 1], max);
   }
+  // Without kernels, each row only reads itself
+  if (task_set.ops_size() <= 2) {
+    min = 0;
+    max = 0;
+  }
 
   return std::make_tuple(min, max);
 }
@@ -22,7 +22,9 @@
 #include "scanner/engine/metadata.h"
 #include "scanner/engine/op_registry.h"
 #include "scanner/engine/rpc.grpc.pb.h"
-#include "scanner/util/queue.h"
+#include "scanner/util/bounded_queue.h"
+#include "scanner/util/row_set.h"
+#include "scanner/util/work_stealing_queue.h"
 
 #include "storehouse/storage_backend.h"
 
@@ -32,6 +34,7 @@
 #include <grpc++/server_builder.h>
 
 #include <dlfcn.h>
+#include <deque>
 #include <string>
 #include <thread>
 
@@ -52,6 +55,9 @@ struct EvalWorkEntry {
   bool needs_reset;
   bool last_in_task;
   i64 warmup_rows;
+  // Rows that filters dropped while this entry was evaluated, which later
+  // kernel groups must skip too
+  std::vector<i64> dropped_rows;
   // Only for pre worker
   std::vector<proto::VideoDescriptor::VideoCodecType> video_encoding_type;
   std::vector<i64> work_item_sizes;
@@ -61,13 +67,18 @@ struct EvalWorkEntry {
 };
 
 struct TaskStream {
-  std::vector<i64> valid_output_rows;
+  RowSet valid_output_rows;
+  // The subset of valid_output_rows the kernel computes. It only carries the
+  // others along for later ops, with null elements in its own outputs.
+  RowSet compute_rows;
 };
 
-using LoadInputQueue =
-    Queue<std::tuple<i32, std::deque<TaskStream>, IOItem, LoadWorkEntry>>;
+using LoadInputQueue = BoundedQueue<
+    std::tuple<i32, std::deque<TaskStream>, IOItem, LoadWorkEntry>>;
 using EvalQueue =
-    Queue<std::tuple<std::deque<TaskStream>, IOItem, EvalWorkEntry>>;
+    BoundedQueue<std::tuple<std::deque<TaskStream>, IOItem, EvalWorkEntry>>;
+using InitialEvalQueue = WorkStealingQueue<
+    std::tuple<std::deque<TaskStream>, IOItem, EvalWorkEntry>>;
 
 struct DatabaseParameters {
   storehouse::StorageConfig* storage_config;
@@ -101,6 +112,11 @@ void move_if_different_address_space(Profiler& profiler,
 ElementList duplicate_elements(Profiler& profiler, DeviceHandle current_handle,
                                DeviceHandle target_handle, ElementList& column);
 
+//! Returns new elements that share the buffers of column by reference, or
+//! copies of buffers that are not in a block. Each returned element must be
+//! deleted independently of the originals.
+ElementList share_elements(DeviceHandle device, const ElementList& column);
+
 std::tuple<i64, i64> determine_stencil_bounds(const proto::TaskSet& task_set);
 }
 }
@@ -61,6 +61,41 @@ void* save_thread(void* arg) {
 
     auto work_start = now();
 
+    // The master re-issues straggling items to idle workers, so another copy
+    // of this item may already be saving it
+    proto::FinishedItem finished_item;
+    finished_item.set_node_id(args.node_id);
+    finished_item.set_table_id(io_item.table_id());
+    finished_item.set_item_id(io_item.item_id());
+    finished_item.set_max_items(args.in_flight_target);
+    finished_item.set_job_id(args.job_id);
+    proto::CommitGrant grant;
+    grpc::ClientContext context;
+    grpc::Status status =
+        args.master->FinishedWork(&context, finished_item, &grant);
+    // Outputs are written in place, so only the granted copy may write them.
+    // The master re-issues the item if that copy never reports it saved.
+    if (!status.ok() || !grant.commit()) {
+      if (!status.ok()) {
+        LOG(WARNING) << "Save (N/KI: " << args.node_id << "/" << args.id
+                     << "): could not reach master to commit item "
+                     << work_entry.io_item_index << ", discarding it";
+      } else {
+        VLOG(1) << "Save (N/KI: " << args.node_id << "/" << args.id
+                << "): discarding item " << work_entry.io_item_index
+                << ", another copy is being saved";
+      }
+      for (size_t out_idx = 0; out_idx < work_entry.columns.size();
+           ++out_idx) {
+        for (Element& element : work_entry.columns[out_idx]) {
+          delete_element(work_entry.column_handles[out_idx], element);
+        }
+      }
+      args.profiler.increment("duplicates_discarded", 1);
+      args.retired_items.increment();
+      continue;
+    }
+
     // Write out each output column to an individual data file
     i32 video_col_idx = 0;
     for (size_t out_idx = 0; out_idx < work_entry.columns.size(); ++out_idx) {
@@ -208,12 +243,32 @@ void* save_thread(void* arg) {
       args.profiler.increment("io_write", size_written);
     }
 
+    if (args.save_row_ids) {
+      const std::string row_ids_path =
+          table_item_row_ids_path(io_item.table_id(), io_item.item_id());
+      WriteFile* row_ids_file = nullptr;
+      BACKOFF_FAIL(storage->make_write_file(row_ids_path, row_ids_file));
+      s_write(row_ids_file, (const u8*)work_entry.row_ids.data(),
+              work_entry.row_ids.size() * sizeof(i64));
+      BACKOFF_FAIL(row_ids_file->save());
+      delete row_ids_file;
+    }
+
+    // Only now is the item durable, so a resumed run of the job may skip it
+    proto::Empty empty;
+    grpc::ClientContext saved_context;
+    status = args.master->SavedWork(&saved_context, finished_item, &empty);
+    LOG_IF(WARNING, !status.ok())
+        << "Save (N/KI: " << args.node_id << "/" << args.id
+        << "): could not record item " << work_entry.io_item_index
+        << " as saved, the master will re-issue it";
+
     VLOG(2) << "Save (N/KI: " << args.node_id << "/" << args.id
             << "): finished item " << work_entry.io_item_index;
 
     args.profiler.add_interval("task", work_start, now());
 
-    args.retired_items++;
+    args.retired_items.increment();
   }
 
   VLOG(1) << "Save (N/KI: " << args.node_id << "/" << args.id
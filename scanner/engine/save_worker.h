@@ -18,6 +18,7 @@
 #include "scanner/engine/runtime.h"
 #include "scanner/util/common.h"
 #include "scanner/util/queue.h"
+#include "scanner/util/util.h"
 
 namespace scanner {
 namespace internal {
@@ -26,6 +27,9 @@ struct SaveThreadArgs {
   // Uniform arguments
   i32 node_id;
   std::string job_name;
+  i32 job_id;
+  // Write the input row of every saved row, since filters left some out
+  bool save_row_ids;
 
   // Per worker arguments
   int id;
@@ -34,7 +38,11 @@ struct SaveThreadArgs {
 
   // Queues for communicating work
   EvalQueue& input_work;
-  std::atomic<i64>& retired_items;
+  EventCounter& retired_items;
+  // Items the node wants in flight, reported to the master with each item
+  std::atomic<i32>& in_flight_target;
+  // Grants the right to save items that may have run on another worker too
+  proto::Master::Stub* master;
 };
 
 void* save_thread(void* arg);
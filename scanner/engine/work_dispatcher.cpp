@@ -0,0 +1,297 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/work_dispatcher.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+// An item is re-issued once it has been running this many times longer than
+// the median item
+const f64 STRAGGLER_SLOWDOWN = 3.0;
+
+// Nor before it has been running this long, so scheduling noise on very
+// short items does not cause needless copies
+const f64 MIN_STRAGGLER_SECONDS = 1.0;
+
+// Number of committed items needed before the median is trusted
+const size_t MIN_TIMED_ITEMS = 5;
+
+// Copies of an item that may run at once, including the original
+const size_t MAX_ITEM_COPIES = 2;
+}
+
+WorkDispatcher::WorkDispatcher(
+    const std::map<std::string, TableMetadata>& table_metas,
+    const proto::TaskSet& task_set,
+    const std::set<std::tuple<i32, i64>>& saved)
+  : table_metas_(table_metas),
+    task_set_(task_set),
+    saved_(saved),
+    num_tasks_(task_set.tasks_size()),
+    task_items_(task_set.tasks_size()) {
+  task_result_.set_success(true);
+}
+
+i32 WorkDispatcher::next_work(i32 node_id, i32 max_items,
+                              proto::NewWorkBatch& batch) {
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  i32 added = 0;
+  while (added < max_items && task_result_.success()) {
+    ItemRange& range = node_ranges_[node_id];
+    if (range.begin == range.end && !assign_range(node_id)) {
+      break;
+    }
+    proto::NewWork& work = task_items_[range.task][range.begin++];
+    Outstanding& item = outstanding_[std::make_tuple(
+        work.io_item().table_id(), work.io_item().item_id())];
+    item.dispatched = now();
+    item.work.CopyFrom(work);
+    item.nodes.push_back(node_id);
+    batch.add_work()->Swap(&work);
+    items_dispatched_++;
+    added++;
+  }
+  while (added < max_items && task_result_.success()) {
+    Outstanding* straggler = find_straggler(node_id);
+    if (straggler == nullptr) {
+      break;
+    }
+    VLOG(1) << "Re-issuing item " << straggler->work.io_item().item_id()
+            << " of table " << straggler->work.io_item().table_id()
+            << " to node " << node_id;
+    straggler->nodes.push_back(node_id);
+    batch.add_work()->CopyFrom(straggler->work);
+    items_reissued_++;
+    added++;
+  }
+  if (added == 0) {
+    batch.set_finished(finished_locked());
+  }
+  return added;
+}
+
+bool WorkDispatcher::commit(i32 node_id, i32 table_id, i64 item_id) {
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  auto it = outstanding_.find(std::make_tuple(table_id, item_id));
+  if (it == outstanding_.end()) {
+    // Another copy already saved it
+    return false;
+  }
+  Outstanding& item = it->second;
+  if (item.committer != -1 && item.committer != node_id &&
+      !grant_expired(item)) {
+    // Another copy is saving it. This one is done, so the item may be
+    // re-issued to this node again should the other copy die.
+    item.nodes.erase(
+        std::remove(item.nodes.begin(), item.nodes.end(), node_id),
+        item.nodes.end());
+    return false;
+  }
+  if (item.committer == -1) {
+    item_seconds_.push_back(nano_since(item.dispatched) / 1e9);
+  } else if (item.committer != node_id) {
+    VLOG(1) << "Grant to save item " << item_id << " of table " << table_id
+            << " passes from node " << item.committer << " to node "
+            << node_id;
+  }
+  item.committer = node_id;
+  item.committed = now();
+  return true;
+}
+
+bool WorkDispatcher::saved(i32 node_id, i32 table_id, i64 item_id) {
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  auto it = outstanding_.find(std::make_tuple(table_id, item_id));
+  if (it == outstanding_.end()) {
+    return false;
+  }
+  outstanding_.erase(it);
+  return true;
+}
+
+void WorkDispatcher::cancel() {
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  next_task_ = num_tasks_;
+  node_ranges_.clear();
+  outstanding_.clear();
+}
+
+bool WorkDispatcher::finished() {
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  return finished_locked();
+}
+
+Result WorkDispatcher::result() {
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  return task_result_;
+}
+
+i64 WorkDispatcher::items_dispatched() {
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  return items_dispatched_;
+}
+
+i64 WorkDispatcher::items_reissued() {
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  return items_reissued_;
+}
+
+bool WorkDispatcher::assign_range(i32 node_id) {
+  ItemRange& range = node_ranges_[node_id];
+  if (range.task >= 0) {
+    // Free the handed out items of a task once nobody is working on it
+    bool in_use = false;
+    for (auto& kv : node_ranges_) {
+      in_use |= kv.first != node_id && kv.second.task == range.task;
+    }
+    if (!in_use) {
+      std::vector<proto::NewWork>().swap(task_items_[range.task]);
+    }
+    range = ItemRange();
+  }
+  if (start_next_task(range)) {
+    return true;
+  }
+  if (!task_result_.success()) {
+    return false;
+  }
+
+  // Every task has started, so split the largest range left with its owner
+  ItemRange* victim = nullptr;
+  for (auto& kv : node_ranges_) {
+    ItemRange& other = kv.second;
+    if (victim == nullptr ||
+        other.end - other.begin > victim->end - victim->begin) {
+      victim = &other;
+    }
+  }
+  if (victim == nullptr || victim->begin == victim->end) {
+    return false;
+  }
+  i64 mid = victim->begin + (victim->end - victim->begin) / 2;
+  range.task = victim->task;
+  range.begin = mid;
+  range.end = victim->end;
+  victim->end = mid;
+  return true;
+}
+
+bool WorkDispatcher::start_next_task(ItemRange& range) {
+  while (next_task_ < num_tasks_) {
+    i64 task = next_task_++;
+    TaskSampler sampler(table_metas_, task_set_.tasks(task));
+    task_result_ = sampler.validate();
+    if (!task_result_.success()) {
+      return false;
+    }
+    std::vector<proto::NewWork>& items = task_items_[task];
+    items.resize(sampler.total_samples());
+    for (proto::NewWork& item : items) {
+      task_result_ = sampler.next_work(item);
+      if (!task_result_.success()) {
+        return false;
+      }
+    }
+    if (!saved_.empty()) {
+      items.erase(std::remove_if(items.begin(), items.end(),
+                                 [&](const proto::NewWork& item) {
+                                   return saved_.count(std::make_tuple(
+                                              item.io_item().table_id(),
+                                              item.io_item().item_id())) > 0;
+                                 }),
+                  items.end());
+    }
+    VLOG(1) << "Tasks left: " << num_tasks_ - next_task_;
+    if (!items.empty()) {
+      range.task = task;
+      range.begin = 0;
+      range.end = items.size();
+      return true;
+    }
+  }
+  return false;
+}
+
+f64 WorkDispatcher::straggler_seconds() {
+  if (item_seconds_.size() < MIN_TIMED_ITEMS) {
+    return -1;
+  }
+  if (median_items_ != item_seconds_.size()) {
+    std::vector<f64> seconds = item_seconds_;
+    std::nth_element(seconds.begin(), seconds.begin() + seconds.size() / 2,
+                     seconds.end());
+    median_seconds_ = seconds[seconds.size() / 2];
+    median_items_ = item_seconds_.size();
+  }
+  return std::max(MIN_STRAGGLER_SECONDS, STRAGGLER_SLOWDOWN * median_seconds_);
+}
+
+bool WorkDispatcher::grant_expired(const Outstanding& item) {
+  f64 threshold = straggler_seconds();
+  return threshold >= 0 && nano_since(item.committed) / 1e9 > threshold;
+}
+
+WorkDispatcher::Outstanding* WorkDispatcher::find_straggler(i32 node_id) {
+  f64 threshold = straggler_seconds();
+  if (threshold < 0) {
+    return nullptr;
+  }
+
+  // Re-issue the item that has been running the longest
+  Outstanding* straggler = nullptr;
+  f64 longest_seconds = threshold;
+  for (auto& kv : outstanding_) {
+    Outstanding& item = kv.second;
+    if (item.nodes.size() >= MAX_ITEM_COPIES ||
+        std::find(item.nodes.begin(), item.nodes.end(), node_id) !=
+            item.nodes.end()) {
+      continue;
+    }
+    // A copy that is still saving the item needs no help
+    if (item.committer != -1 && !grant_expired(item)) {
+      continue;
+    }
+    f64 running_seconds = nano_since(item.dispatched) / 1e9;
+    if (running_seconds > longest_seconds) {
+      straggler = &item;
+      longest_seconds = running_seconds;
+    }
+  }
+  return straggler;
+}
+
+bool WorkDispatcher::finished_locked() {
+  if (!task_result_.success()) {
+    return true;
+  }
+  if (next_task_ < num_tasks_ || !outstanding_.empty()) {
+    return false;
+  }
+  for (auto& kv : node_ranges_) {
+    if (kv.second.begin < kv.second.end) {
+      return false;
+    }
+  }
+  return true;
+}
+}
+}
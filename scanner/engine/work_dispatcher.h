@@ -0,0 +1,149 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/engine/metadata.h"
+#include "scanner/engine/sampler.h"
+#include "scanner/util/common.h"
+#include "scanner/util/util.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+
+namespace scanner {
+namespace internal {
+
+/**
+ * @brief Hands out the IO items of a job's tasks to workers.
+ *
+ * Each node works through a contiguous range of one task's items, so
+ * consecutive items it receives read the same table and usually the same
+ * video, which keeps the table and index caches of its load workers warm.
+ * A node that runs out of its range starts the next task nobody has started.
+ * When every task has started, it takes the back half of the largest range
+ * left, falling back to single items as ranges run out.
+ *
+ * Once nothing is left to hand out, idle nodes are given a second copy of
+ * items that have been running much longer than the median item. The copy
+ * that finishes first is granted the right to save the item, which stays
+ * outstanding until it is saved. If that takes as long as a straggler would,
+ * the grant holder is presumed dead, so the item may be re-issued again and
+ * the grant passes to the next copy that finishes.
+ *
+ * Items listed as already saved by an earlier run of the job are never
+ * handed out. A task's items are generated when it starts. All methods are
+ * thread safe, and handing out a batch takes the lock once, so the cost of a
+ * request is shared by every item in it.
+ */
+class WorkDispatcher {
+ public:
+  //! saved holds (output table id, item id) of items to skip
+  WorkDispatcher(const std::map<std::string, TableMetadata>& table_metas,
+                 const proto::TaskSet& task_set,
+                 const std::set<std::tuple<i32, i64>>& saved = {});
+
+  //! Appends up to max_items IO items for node_id to batch and returns how
+  //! many were added. Returns 0 when there is nothing to hand out right now,
+  //! and sets batch.finished once there never will be again.
+  i32 next_work(i32 node_id, i32 max_items, proto::NewWorkBatch& batch);
+
+  //! Called when node_id has finished an item. Returns true if it should
+  //! save the outputs, i.e. no other copy of the item holds the grant to.
+  bool commit(i32 node_id, i32 table_id, i64 item_id);
+
+  //! Called when node_id has saved an item it was granted. Returns false if
+  //! another copy was saved first.
+  bool saved(i32 node_id, i32 table_id, i64 item_id);
+
+  //! Stops handing out work, e.g. after a worker failed
+  void cancel();
+
+  //! True once every item has been handed out and committed, or a task
+  //! failed
+  bool finished();
+
+  //! Failure of the first task that did not validate, if any
+  Result result();
+
+  i64 items_dispatched();
+
+  i64 items_reissued();
+
+ private:
+  // Items [begin, end) of task_items_[task]
+  struct ItemRange {
+    i64 task = -1;
+    i64 begin = 0;
+    i64 end = 0;
+  };
+
+  // Requires work_mutex_. Gives node a new range when its own is used up,
+  // returning false if there is no work left.
+  bool assign_range(i32 node_id);
+
+  // Requires work_mutex_. Generates the items of the next task.
+  bool start_next_task(ItemRange& range);
+
+  // A handed out item that has not been saved yet
+  struct Outstanding {
+    timepoint_t dispatched;
+    proto::NewWork work;
+    // Nodes running a copy of the item
+    std::vector<i32> nodes;
+    // Node allowed to save the item, if any, and when it was allowed to
+    i32 committer = -1;
+    timepoint_t committed;
+  };
+
+  // Requires work_mutex_. Seconds after which an item is a straggler, or
+  // a negative number if too few items have finished to tell.
+  f64 straggler_seconds();
+
+  // Requires work_mutex_. True if the grant to save item was given so long
+  // ago that its holder most likely died.
+  bool grant_expired(const Outstanding& item);
+
+  // Requires work_mutex_. Finds an item that is taking much longer than
+  // usual and that node_id is not already running.
+  Outstanding* find_straggler(i32 node_id);
+
+  // Requires work_mutex_
+  bool finished_locked();
+
+  const std::map<std::string, TableMetadata>& table_metas_;
+  const proto::TaskSet task_set_;
+  const std::set<std::tuple<i32, i64>> saved_;
+
+  std::mutex work_mutex_;
+  i64 next_task_ = 0;
+  i64 num_tasks_;
+  std::vector<std::vector<proto::NewWork>> task_items_;
+  std::map<i32, ItemRange> node_ranges_;
+  // Keyed by output table id and item id
+  std::map<std::tuple<i32, i64>, Outstanding> outstanding_;
+  // Time from handing out to the first commit of every item so far
+  std::vector<f64> item_seconds_;
+  // Median of item_seconds_ when it held median_items_ entries
+  f64 median_seconds_ = 0;
+  size_t median_items_ = 0;
+  i64 items_dispatched_ = 0;
+  i64 items_reissued_ = 0;
+  Result task_result_;
+};
+}
+}
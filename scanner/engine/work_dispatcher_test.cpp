@@ -0,0 +1,209 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/work_dispatcher.h"
+
+#include <gtest/gtest.h>
+
+#include <set>
+#include <thread>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+TableMetadata make_table(i32 id, const std::string& name, i64 rows) {
+  proto::TableDescriptor desc;
+  desc.set_id(id);
+  desc.set_name(name);
+  proto::Column* col = desc.add_columns();
+  col->set_id(0);
+  col->set_name("frame");
+  col->set_type(proto::Video);
+  desc.add_end_rows(rows);
+  return TableMetadata(desc);
+}
+
+// One task per table, each reading items_per_task items of 10 rows
+class WorkDispatcherTest : public ::testing::Test {
+ protected:
+  void make_tasks(i32 num_tasks, i64 items_per_task) {
+    proto::AllSamplerArgs args;
+    args.set_sample_size(10);
+    std::string sampler_args;
+    args.SerializeToString(&sampler_args);
+    for (i32 t = 0; t < num_tasks; ++t) {
+      std::string input = "input" + std::to_string(t);
+      std::string output = "output" + std::to_string(t);
+      table_metas_[input] = make_table(t, input, items_per_task * 10);
+      table_metas_[output] = make_table(100 + t, output, items_per_task * 10);
+
+      proto::Task* task = task_set_.add_tasks();
+      task->set_output_table_name(output);
+      proto::TableSample* sample = task->add_samples();
+      sample->set_table_name(input);
+      sample->add_column_names("frame");
+      sample->set_sampling_function("All");
+      sample->set_sampling_args(sampler_args);
+    }
+  }
+
+  std::map<std::string, TableMetadata> table_metas_;
+  proto::TaskSet task_set_;
+};
+}
+
+TEST_F(WorkDispatcherTest, NodesKeepToTheirOwnTask) {
+  make_tasks(2, 10);
+  WorkDispatcher dispatcher(table_metas_, task_set_);
+
+  proto::NewWorkBatch a;
+  proto::NewWorkBatch b;
+  EXPECT_EQ(dispatcher.next_work(0, 4, a), 4);
+  EXPECT_EQ(dispatcher.next_work(1, 4, b), 4);
+  EXPECT_EQ(dispatcher.next_work(0, 4, a), 4);
+  for (i32 i = 0; i < a.work_size(); ++i) {
+    EXPECT_EQ(a.work(i).io_item().table_id(), 100);
+    EXPECT_EQ(a.work(i).io_item().item_id(), i);
+  }
+  for (i32 i = 0; i < b.work_size(); ++i) {
+    EXPECT_EQ(b.work(i).io_item().table_id(), 101);
+    EXPECT_EQ(b.work(i).io_item().item_id(), i);
+  }
+}
+
+TEST_F(WorkDispatcherTest, IdleNodesSplitRemainingRanges) {
+  make_tasks(1, 16);
+  WorkDispatcher dispatcher(table_metas_, task_set_);
+
+  proto::NewWorkBatch a;
+  EXPECT_EQ(dispatcher.next_work(0, 1, a), 1);
+  // Node 1 takes the back half of what node 0 has left
+  proto::NewWorkBatch b;
+  EXPECT_EQ(dispatcher.next_work(1, 1, b), 1);
+  EXPECT_EQ(b.work(0).io_item().item_id(), 8);
+
+  std::set<i64> items;
+  for (i32 node = 0; node < 4; ++node) {
+    proto::NewWorkBatch batch;
+    dispatcher.next_work(node, 100, batch);
+    for (auto& work : batch.work()) {
+      EXPECT_TRUE(items.insert(work.io_item().item_id()).second);
+    }
+  }
+  items.insert(0);
+  items.insert(8);
+  EXPECT_EQ(items.size(), 16);
+  EXPECT_EQ(dispatcher.items_dispatched(), 16);
+
+  // Handed out but not saved yet
+  proto::NewWorkBatch wait;
+  EXPECT_EQ(dispatcher.next_work(2, 1, wait), 0);
+  EXPECT_FALSE(wait.finished());
+  for (i64 item : items) {
+    EXPECT_TRUE(dispatcher.commit(0, 100, item));
+  }
+  EXPECT_FALSE(dispatcher.finished());
+  for (i64 item : items) {
+    EXPECT_TRUE(dispatcher.saved(0, 100, item));
+  }
+  EXPECT_TRUE(dispatcher.finished());
+
+  proto::NewWorkBatch done;
+  EXPECT_EQ(dispatcher.next_work(2, 1, done), 0);
+  EXPECT_TRUE(done.finished());
+}
+
+TEST_F(WorkDispatcherTest, ReissuesStragglersAndCommitsFirstCopy) {
+  make_tasks(1, 8);
+  WorkDispatcher dispatcher(table_metas_, task_set_);
+
+  proto::NewWorkBatch a;
+  EXPECT_EQ(dispatcher.next_work(0, 8, a), 8);
+  for (i64 item = 0; item < 7; ++item) {
+    EXPECT_TRUE(dispatcher.commit(0, 100, item));
+    EXPECT_TRUE(dispatcher.saved(0, 100, item));
+  }
+  // Nothing has been running long enough to be worth a second copy
+  proto::NewWorkBatch b;
+  EXPECT_EQ(dispatcher.next_work(1, 1, b), 0);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  EXPECT_EQ(dispatcher.next_work(1, 1, b), 1);
+  EXPECT_EQ(b.work(0).io_item().item_id(), 7);
+  EXPECT_EQ(dispatcher.items_reissued(), 1);
+  // Only one extra copy is made
+  proto::NewWorkBatch c;
+  EXPECT_EQ(dispatcher.next_work(2, 1, c), 0);
+
+  EXPECT_TRUE(dispatcher.commit(1, 100, 7));
+  EXPECT_FALSE(dispatcher.commit(0, 100, 7));
+  EXPECT_TRUE(dispatcher.saved(1, 100, 7));
+  EXPECT_TRUE(dispatcher.finished());
+}
+
+TEST_F(WorkDispatcherTest, ReissuesItemsWhoseSaverDied) {
+  make_tasks(1, 7);
+  WorkDispatcher dispatcher(table_metas_, task_set_);
+
+  proto::NewWorkBatch a;
+  EXPECT_EQ(dispatcher.next_work(0, 7, a), 7);
+  for (i64 item = 0; item < 6; ++item) {
+    EXPECT_TRUE(dispatcher.commit(0, 100, item));
+    EXPECT_TRUE(dispatcher.saved(0, 100, item));
+  }
+  // Node 0 is granted the last item but never reports it saved
+  EXPECT_TRUE(dispatcher.commit(0, 100, 6));
+  proto::NewWorkBatch b;
+  EXPECT_EQ(dispatcher.next_work(1, 1, b), 0);
+  EXPECT_FALSE(b.finished());
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  EXPECT_EQ(dispatcher.next_work(1, 1, b), 1);
+  EXPECT_EQ(b.work(0).io_item().item_id(), 6);
+  // The grant passes to the new copy
+  EXPECT_TRUE(dispatcher.commit(1, 100, 6));
+  EXPECT_FALSE(dispatcher.finished());
+  EXPECT_TRUE(dispatcher.saved(1, 100, 6));
+  EXPECT_FALSE(dispatcher.saved(0, 100, 6));
+  EXPECT_TRUE(dispatcher.finished());
+}
+
+TEST_F(WorkDispatcherTest, SkipsItemsSavedByEarlierRun) {
+  make_tasks(2, 4);
+  // All of the first task and half of the second were saved
+  std::set<std::tuple<i32, i64>> saved = {
+      std::make_tuple(100, 0), std::make_tuple(100, 1),
+      std::make_tuple(100, 2), std::make_tuple(100, 3),
+      std::make_tuple(101, 0), std::make_tuple(101, 2)};
+  WorkDispatcher dispatcher(table_metas_, task_set_, saved);
+
+  proto::NewWorkBatch batch;
+  EXPECT_EQ(dispatcher.next_work(0, 8, batch), 2);
+  ASSERT_EQ(batch.work_size(), 2);
+  EXPECT_EQ(batch.work(0).io_item().table_id(), 101);
+  EXPECT_EQ(batch.work(0).io_item().item_id(), 1);
+  EXPECT_EQ(batch.work(1).io_item().item_id(), 3);
+  for (auto& work : batch.work()) {
+    EXPECT_TRUE(dispatcher.commit(0, work.io_item().table_id(),
+                                  work.io_item().item_id()));
+    EXPECT_TRUE(dispatcher.saved(0, work.io_item().table_id(),
+                                 work.io_item().item_id()));
+  }
+  EXPECT_TRUE(dispatcher.finished());
+}
+}
+}
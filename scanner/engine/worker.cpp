@@ -14,12 +14,15 @@
  */
 
 #include "scanner/engine/worker.h"
+#include "scanner/engine/dag_analysis.h"
 #include "scanner/engine/evaluate_worker.h"
 #include "scanner/engine/kernel_registry.h"
 #include "scanner/engine/load_worker.h"
 #include "scanner/engine/runtime.h"
 #include "scanner/engine/save_worker.h"
 #include "scanner/util/cuda.h"
+#include "scanner/util/numa.h"
+#include "scanner/util/thread_pool.h"
 
 #include <arpa/inet.h>
 #include <grpc/grpc_posix.h>
@@ -30,6 +33,7 @@
 #include <boost/python.hpp>
 #include <boost/python/numpy.hpp>
 #include <omp.h>
+#include <cmath>
 
 // For avcodec_register_all()... should go in software video with global mutex
 extern "C" {
@@ -46,362 +50,66 @@ namespace internal {
 namespace {
 inline bool operator==(const MemoryPoolConfig& lhs,
                        const MemoryPoolConfig& rhs) {
-  return (lhs.cpu().use_pool() == rhs.cpu().use_pool()) &&
+  return (lhs.pinned_cpu() == rhs.pinned_cpu()) &&
+         (lhs.cpu_huge_pages() == rhs.cpu_huge_pages()) &&
+         (lhs.prefault_cpu_pool() == rhs.prefault_cpu_pool()) &&
+         (lhs.cpu().use_pool() == rhs.cpu().use_pool()) &&
          (lhs.cpu().free_space() == rhs.cpu().free_space()) &&
+         (lhs.cpu().block_cache_size() == rhs.cpu().block_cache_size()) &&
          (lhs.gpu().use_pool() == rhs.gpu().use_pool()) &&
-         (lhs.gpu().free_space() == rhs.gpu().free_space());
+         (lhs.gpu().free_space() == rhs.gpu().free_space()) &&
+         (lhs.gpu().block_cache_size() == rhs.gpu().block_cache_size());
 }
 inline bool operator!=(const MemoryPoolConfig& lhs,
                        const MemoryPoolConfig& rhs) {
   return !(lhs == rhs);
 }
 
-struct AnalysisResults {
-  std::vector<std::vector<std::tuple<i32, std::string>>> live_columns;
-  std::vector<std::vector<i32>> dead_columns;
-  std::vector<std::vector<i32>> unused_outputs;
-  std::vector<std::vector<i32>> column_mapping;
-
-  std::vector<i32> warmup_sizes;
-  std::vector<i32> batch_sizes;
-  std::vector<std::vector<i32>> stencils;
-};
-
-AnalysisResults analyze_dag(const proto::TaskSet& task_set) {
-  AnalysisResults results;
-
-  std::vector<std::vector<std::tuple<i32, std::string>>>& live_columns =
-      results.live_columns;
-  std::vector<std::vector<i32>>& dead_columns = results.dead_columns;
-  std::vector<std::vector<i32>>& unused_outputs = results.unused_outputs;
-  std::vector<std::vector<i32>>& column_mapping = results.column_mapping;
-
-  std::vector<i32>& warmup_sizes = results.warmup_sizes;
-  std::vector<i32>& batch_sizes = results.batch_sizes;
-  std::vector<std::vector<i32>>& stencils = results.stencils;
-
-  // Start off with the columns from the gathered tables
-  OpRegistry* op_registry = get_op_registry();
-  KernelRegistry* kernel_registry = get_kernel_registry();
-  auto& ops = task_set.ops();
-  std::map<i32, std::vector<std::tuple<std::string, i32>>> intermediates;
-  {
-    auto& input_op = ops.Get(0);
-    for (const std::string& input_col : input_op.inputs(0).columns()) {
-      // Set last used to first op so that all input ops are live to start
-      // with. We could eliminate input columns which aren't used, but this
-      // also requires modifying the samples.
-      intermediates[0].push_back(std::make_tuple(input_col, 1));
-    }
-  }
-  for (size_t i = 1; i < ops.size(); ++i) {
-    auto& op = ops.Get(i);
-    // For each input, update the intermediate last used index to the
-    // current index
-    for (auto& eval_input : op.inputs()) {
-      i32 parent_index = eval_input.op_index();
-      for (const std::string& parent_col : eval_input.columns()) {
-        bool found = false;
-        for (auto& kv : intermediates.at(parent_index)) {
-          if (std::get<0>(kv) == parent_col) {
-            found = true;
-            std::get<1>(kv) = i;
-            break;
-          }
-        }
-        assert(found);
-      }
-    }
-    if (i == ops.size() - 1) {
-      continue;
-    }
-    // Add this op's outputs to the intermediate list
-    const auto& op_info = op_registry->get_op_info(op.name());
-    for (const auto& output_column : op_info->output_columns()) {
-      intermediates[i].push_back(std::make_tuple(output_column.name(), i));
-    }
-    const auto& kernel_factory =
-        kernel_registry->get_kernel(op.name(), op.device_type());
-    // Use default batch if not specified
-    i32 batch_size =
-        op.batch() != -1 ? op.batch() : kernel_factory->preferred_batch_size();
-    batch_sizes.push_back(batch_size);
-    // Use default stencil if not specified
-    std::vector<i32> stencil;
-    if (op.stencil_size() > 0) {
-      stencil = std::vector<i32>(op.stencil().begin(), op.stencil().end());
-    } else {
-      stencil = op_info->preferred_stencil();
-    }
-    stencils.push_back(stencil);
-  }
-
-  // The live columns at each op index
-  live_columns.resize(ops.size());
-  for (size_t i = 0; i < ops.size(); ++i) {
-    i32 op_index = i;
-    auto& columns = live_columns[i];
-    size_t max_i = std::min((size_t)(ops.size() - 2), i);
-    for (size_t j = 0; j <= max_i; ++j) {
-      for (auto& kv : intermediates.at(j)) {
-        i32 last_used_index = std::get<1>(kv);
-        if (last_used_index > op_index) {
-          // Last used index is greater than current index, so still live
-          columns.push_back(std::make_tuple((i32)j, std::get<0>(kv)));
-        }
-      }
-    }
-  }
-
-  // The columns to remove for the current kernel
-  dead_columns.resize(ops.size() - 1);
-  // Outputs from the current kernel that are not used
-  unused_outputs.resize(ops.size() - 1);
-  // Indices in the live columns list that are the inputs to the current
-  // kernel. Starts from the second evalutor (index 1)
-  column_mapping.resize(ops.size() - 1);
-  for (size_t i = 1; i < ops.size(); ++i) {
-    i32 op_index = i;
-    auto& prev_columns = live_columns[i - 1];
-    auto& op = ops.Get(op_index);
-    // Determine which columns are no longer live
-    {
-      auto& unused = unused_outputs[i - 1];
-      auto& dead = dead_columns[i - 1];
-      size_t max_i = std::min((size_t)(ops.size() - 2), (size_t)i);
-      for (size_t j = 0; j <= max_i; ++j) {
-        i32 parent_index = j;
-        for (auto& kv : intermediates.at(j)) {
-          i32 last_used_index = std::get<1>(kv);
-          if (last_used_index == op_index) {
-            // Column is no longer live, so remove it.
-            const std::string& col_name = std::get<0>(kv);
-            if (j == i) {
-              // This op has an unused output
-              i32 col_index = -1;
-              const std::vector<Column>& op_cols =
-                  op_registry->get_op_info(op.name())->output_columns();
-              for (size_t k = 0; k < op_cols.size(); k++) {
-                if (col_name == op_cols[k].name()) {
-                  col_index = k;
-                  break;
-                }
-              }
-              assert(col_index != -1);
-              unused.push_back(col_index);
-            } else {
-              // Determine where in the previous live columns list this
-              // column existed
-              i32 col_index = -1;
-              for (i32 k = 0; k < (i32)prev_columns.size(); ++k) {
-                const std::tuple<i32, std::string>& live_input =
-                    prev_columns[k];
-                if (parent_index == std::get<0>(live_input) &&
-                    col_name == std::get<1>(live_input)) {
-                  col_index = k;
-                  break;
-                }
-              }
-              assert(col_index != -1);
-              dead.push_back(col_index);
-            }
-          }
-        }
-      }
-    }
-    auto& mapping = column_mapping[op_index - 1];
-    for (const auto& eval_input : op.inputs()) {
-      i32 parent_index = eval_input.op_index();
-      for (const std::string& col : eval_input.columns()) {
-        i32 col_index = -1;
-        for (i32 k = 0; k < (i32)prev_columns.size(); ++k) {
-          const std::tuple<i32, std::string>& live_input = prev_columns[k];
-          if (parent_index == std::get<0>(live_input) &&
-              col == std::get<1>(live_input)) {
-            col_index = k;
-            break;
-          }
-        }
-        assert(col_index != -1);
-        mapping.push_back(col_index);
-      }
-    }
-  }
-  return results;
-}
-
-void derive_stencil_requirements(storehouse::StorageBackend* storage,
-                                 const AnalysisResults& analysis_results,
-                                 const LoadWorkEntry& load_work_entry,
-                                 const std::vector<std::vector<i32>>& stencils,
-                                 i64 initial_work_item_size,
-                                 LoadWorkEntry& output_entry,
-                                 std::deque<TaskStream>& task_streams) {
-  output_entry.set_io_item_index(load_work_entry.io_item_index());
-
-  i64 num_kernels = stencils.size();
-
-  // Compute the required rows for each kernel based on the stencil
-  // HACK(apoms): this will only really work for linear DAGs. For DAGs with
-  //   non-linear topologies, this might break. Supporting proper DAGs would
-  //   require tracking stencils up each branch individually.
-  std::vector<i64> current_rows;
-  const proto::LoadSample& sample = load_work_entry.samples(0);
-  i64 last_row = sample.rows(sample.rows_size() - 1);
-  std::string table_path = TableMetadata::descriptor_path(sample.table_id());
-  TableMetadata meta = read_table_metadata(storage, table_path);
-  {
-    current_rows = std::vector<i64>(sample.rows().begin(), sample.rows().end());
-    TaskStream s;
-    s.valid_output_rows = current_rows;
-    task_streams.push_front(s);
-    // For each kernel, derive the required elements via its stencil
-    for (i64 i = 0; i < num_kernels; ++i) {
-      const std::vector<i32>& stencil = stencils[num_kernels - 1 - i];
-      std::unordered_set<i64> new_rows;
-      new_rows.reserve(current_rows.size());
-      for (i64 r : current_rows) {
-        // Ignore rows which can not achieve their stencil
-        if (r - stencil[0] < 0 ||
-            r + stencil[stencil.size() - 1] >= meta.num_rows()) continue;
-        for (i64 s : stencil) {
-          new_rows.insert(r + s);
-        }
-      }
-      current_rows = std::vector<i64>(new_rows.begin(), new_rows.end());
-      std::sort(current_rows.begin(), current_rows.end());
-      TaskStream s;
-      s.valid_output_rows = current_rows;
-      task_streams.push_front(s);
-    }
+// Number of IO items a node keeps accepted but not yet saved. Every pipeline
+// instance needs one item to work on, plus enough queued behind it to hide the
+// time it takes to load the next one, and one more for the master to stream in
+// after each save. Both are estimated from moving averages of what the job has
+// seen so far.
+class InFlightTarget {
+ public:
+  InFlightTarget(i32 min_items, i32 max_items)
+    : min_items_(min_items), max_items_(std::max(min_items, max_items)) {}
+
+  void record_load(f64 seconds) { update(load_seconds_, seconds); }
+
+  //! items were saved over the last seconds
+  void record_retired(i64 items, f64 seconds) {
+    update(item_interval_seconds_, seconds / items);
   }
-  // Compute the required work item sizes to produce the minimal amount of
-  // output for each invocation of the kernels
-  std::vector<i64> work_item_sizes;
-  {
-    // Lists the last row that the stencil cache would have seen
-    // at this point
-    std::vector<i64> last_stencil_cache_row(num_kernels + 1, -1);
-    std::vector<size_t> produced_rows(num_kernels + 1);
-
-    size_t num_input_rows = task_streams.front().valid_output_rows.size();
-    size_t num_output_rows = task_streams.back().valid_output_rows.size();
-    while (produced_rows.front() < num_input_rows) {
-      i64 work_item_size = initial_work_item_size;
-      // For each kernel, determine which rows of input it needs given the
-      // current stencil cache and position in required rows
-      for (i64 k = num_kernels; k >= 1; k--) {
-        const TaskStream& prev_s = task_streams[k - 1];
-        const TaskStream& s = task_streams[k];
-        size_t pos = produced_rows[k];
-        const std::vector<i32> stencil = analysis_results.stencils[k - 1];
-        i64 batch_size = analysis_results.batch_sizes[k - 1];
-
-        // If the kernel is batched, we need to make sure we round up to
-        // request a batch of input.
-        if (work_item_size % batch_size != 0) {
-          work_item_size += (batch_size - work_item_size % batch_size);
-        }
 
-        // If we are at the end of the task, then we can not provide
-        // a full batch and must provide a partial one
-        if (pos + work_item_size > prev_s.valid_output_rows.size()) {
-          work_item_size = s.valid_output_rows.size() - pos;
-        }
-
-        // Compute which input rows are needed for the batch of outputs
-        std::set<i64> required_input_rows;
-        for (i64 i = 0; i < work_item_size; ++i) {
-          i64 row = s.valid_output_rows[pos + i];
-          for (i32 s : stencil) {
-            required_input_rows.insert(row + s);
-          }
-        }
-        std::vector<i64> sorted_input_rows(required_input_rows.begin(),
-                                           required_input_rows.end());
-        std::sort(sorted_input_rows.begin(), sorted_input_rows.end());
-
-        // For all the rows not in the stencil cache, we will request them
-        // from the upstream kernel by setting the work item size
-        i64 rows_to_request = 0;
-        {
-          i64 i = 0;
-          for (; i < sorted_input_rows.size(); ++i) {
-            // If the requested row is not in the stencil cache, we are done
-            // with this work item
-            if (sorted_input_rows[i] > last_stencil_cache_row[k - 1]) {
-              break;
-            }
-          }
-          rows_to_request = (sorted_input_rows.size() - i);
-        }
-        assert(rows_to_request > 0);
-        work_item_size = rows_to_request;
-      }
-      produced_rows[0] += work_item_size;
-      last_stencil_cache_row[0] =
-          task_streams[0].valid_output_rows[produced_rows[0] - 1];
-      assert(produced_rows[0] > 0);
-      work_item_sizes.push_back(work_item_size);
-
-      // Propagate downward what rows will be in the stencil cache due to the
-      // computed number of rows of input
-      for (i64 k = 1; k < num_kernels + 1; k++) {
-        const TaskStream& ts = task_streams[k];
-        size_t& pos = produced_rows[k];
-        const std::vector<i32>& stencil = analysis_results.stencils[k - 1];
-        i64 batch_size = analysis_results.batch_sizes[k - 1];
-
-        // Figure out how many rows will be produced given work_item_size
-        // inputs
-        i64 rows = 0;
-        for (; pos + rows < ts.valid_output_rows.size(); ++rows) {
-          if (ts.valid_output_rows[pos + rows] + stencil.back() >
-              last_stencil_cache_row[k - 1]) {
-            break;
-          }
-        }
-        assert(pos + rows - 1 < ts.valid_output_rows.size());
-        // Round down if we don't have enough for a batch unless this is
-        // the end of the task
-        if (rows % batch_size != 0 &&
-            ts.valid_output_rows[pos + rows - 1] != last_row) {
-          rows -= (rows % batch_size);
-        }
-        assert(rows > 0);
-
-        // Update how many rows we have produced
-        pos += rows;
-        assert(pos > 0);
-        last_stencil_cache_row[k] = ts.valid_output_rows[pos - 1];
-
-        // Send the rows to the next kernel
-        work_item_size = rows;
-      }
+  i32 target() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Fill up to the limit until there is a service rate to plan with
+    if (item_interval_seconds_ <= 0) {
+      return max_items_;
     }
+    i32 queued = (i32)std::ceil(load_seconds_ / item_interval_seconds_) + 1;
+    return std::min(max_items_, min_items_ + queued);
   }
 
-  // Get rid of input stream since this is already captured by the load samples
-  task_streams.pop_front();
-
-  for (i64 r : work_item_sizes) {
-    output_entry.add_work_item_sizes(r);
+ private:
+  // Exponentially weighted, so the target follows changes in item cost
+  void update(f64& average, f64 sample) {
+    const f64 weight = 0.2;
+    std::unique_lock<std::mutex> lock(mutex_);
+    average = average <= 0 ? sample : (1 - weight) * average + weight * sample;
   }
 
-  for (const proto::LoadSample& sample : load_work_entry.samples()) {
-    auto out_sample = output_entry.add_samples();
-    out_sample->set_table_id(sample.table_id());
-    out_sample->mutable_column_ids()->CopyFrom(sample.column_ids());
-    out_sample->set_warmup_size(sample.warmup_size());
-    google::protobuf::RepeatedField<i64> data(
-        current_rows.begin(), current_rows.end());
-    out_sample->mutable_rows()->Swap(&data);
-  }
-}
+  const i32 min_items_;
+  const i32 max_items_;
+  std::mutex mutex_;
+  f64 load_seconds_ = 0;
+  f64 item_interval_seconds_ = 0;
+};
 
 void load_driver(LoadInputQueue& load_work,
-                 std::vector<EvalQueue>& initial_eval_work,
-                 LoadWorkerArgs args) {
+                 InitialEvalQueue& initial_eval_work,
+                 InFlightTarget& in_flight, LoadWorkerArgs args) {
   Profiler& profiler = args.profiler;
   LoadWorker worker(args);
   while (true) {
@@ -425,14 +133,17 @@ void load_driver(LoadInputQueue& load_work,
 
     auto work_start = now();
 
-    auto input_entry = std::make_tuple(io_item, load_work_entry);
-    std::tuple<IOItem, EvalWorkEntry> output_entry =
-        worker.execute(input_entry);
+    std::tuple<IOItem, EvalWorkEntry> output_entry = worker.execute(
+        std::make_tuple(std::move(io_item), std::move(load_work_entry)));
 
     profiler.add_interval("task", work_start, now());
+    in_flight.record_load(nano_since(work_start) / 1e9);
 
-    initial_eval_work[output_queue_idx].push(std::make_tuple(
-        task_streams, std::get<0>(output_entry), std::get<1>(output_entry)));
+    initial_eval_work.push(
+        output_queue_idx,
+        std::make_tuple(std::move(task_streams),
+                        std::move(std::get<0>(output_entry)),
+                        std::move(std::get<1>(output_entry))));
   }
   VLOG(1) << "Load (N/PU: " << args.node_id << "/" << args.worker_id
           << "): thread finished";
@@ -441,24 +152,31 @@ void load_driver(LoadInputQueue& load_work,
 std::mutex no_pipelining_lock;
 std::condition_variable no_pipelining_cvar;
 
-void pre_evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
+void pre_evaluate_driver(InitialEvalQueue& input_work, EvalQueue& output_work,
                          PreEvaluateWorkerArgs args) {
   Profiler& profiler = args.profiler;
   PreEvaluateWorker worker(args);
   while (true) {
     auto idle_start = now();
 
+    // Take the oldest item assigned to this instance, or steal one from
+    // another instance if this one has run dry
     std::tuple<std::deque<TaskStream>, IOItem, EvalWorkEntry> entry;
-    input_work.pop(entry);
+    bool stolen = false;
+    bool got_entry = input_work.pop(args.worker_id, entry, stolen);
 
     args.profiler.add_interval("idle", idle_start, now());
 
+    if (!got_entry) {
+      break;
+    }
+    if (stolen) {
+      profiler.increment("steals", 1);
+    }
+
     auto& task_streams = std::get<0>(entry);
     IOItem& io_item = std::get<1>(entry);
     EvalWorkEntry& work_entry = std::get<2>(entry);
-    if (work_entry.io_item_index == -1) {
-      break;
-    }
 
     VLOG(2) << "Pre-evaluate (N/KI: " << args.node_id << "/" << args.worker_id
             << "): "
@@ -471,12 +189,12 @@ void pre_evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
       total_rows = std::max(total_rows, (i32)work_entry.columns[i].size());
     }
 
-    auto input_entry = std::make_tuple(io_item, work_entry);
-    worker.feed(input_entry);
+    std::vector<i64> work_item_sizes = work_entry.work_item_sizes;
+    worker.feed(std::make_tuple(std::move(io_item), std::move(work_entry)));
     bool first = true;
     i32 work_item_index = 0;
-    while (work_item_index < work_entry.work_item_sizes.size()) {
-      i32 work_item_size = work_entry.work_item_sizes.at(work_item_index++);
+    while (work_item_index < work_item_sizes.size()) {
+      i32 work_item_size = work_item_sizes.at(work_item_index++);
       total_rows -= work_item_size;
 
       std::tuple<IOItem, EvalWorkEntry> output_entry;
@@ -485,14 +203,14 @@ void pre_evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
       }
 
       if (first) {
-        output_work.push(std::make_tuple(task_streams,
-                                         std::get<0>(output_entry),
-                                         std::get<1>(output_entry)));
+        output_work.push(std::make_tuple(std::move(task_streams),
+                                         std::move(std::get<0>(output_entry)),
+                                         std::move(std::get<1>(output_entry))));
         first = false;
       } else {
         output_work.push(std::make_tuple(std::deque<TaskStream>(),
-                                         std::get<0>(output_entry),
-                                         std::get<1>(output_entry)));
+                                         std::move(std::get<0>(output_entry)),
+                                         std::move(std::get<1>(output_entry))));
       }
 
       if (std::getenv("NO_PIPELINING")) {
@@ -513,11 +231,39 @@ void evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
                      EvaluateWorkerArgs args) {
   Profiler& profiler = args.profiler;
   EvaluateWorker worker(args);
+  // Task streams of the fed entries that have not been yielded yet
+  std::deque<std::deque<TaskStream>> pending_task_streams;
+  auto push_outputs = [&]() {
+    std::tuple<IOItem, EvalWorkEntry> output_entry;
+    while (worker.yield(output_entry)) {
+      auto idle_push_start = now();
+      output_work.push(std::make_tuple(std::move(pending_task_streams.front()),
+                                       std::move(std::get<0>(output_entry)),
+                                       std::move(std::get<1>(output_entry))));
+      pending_task_streams.pop_front();
+      args.profiler.add_interval("idle_push", idle_push_start, now());
+    }
+  };
   while (true) {
     auto idle_pull_start = now();
 
     std::tuple<std::deque<TaskStream>, IOItem, EvalWorkEntry> entry;
-    input_work.pop(entry);
+    if (worker.has_held_rows()) {
+      // Wait for more rows to fill the batch, but only until the oldest held
+      // row has waited as long as the job allows
+      i32 waited_ms = nano_since(worker.held_since()) / 1000000;
+      if (!input_work.pop_for(
+              entry, std::max(args.coalesce_timeout_ms - waited_ms, 0))) {
+        args.profiler.add_interval("idle_pull", idle_pull_start, now());
+        auto work_start = now();
+        worker.flush();
+        profiler.add_interval("task", work_start, now());
+        push_outputs();
+        continue;
+      }
+    } else {
+      input_work.pop(entry);
+    }
 
     auto& task_streams = std::get<0>(entry);
     IOItem& io_item = std::get<1>(entry);
@@ -526,6 +272,8 @@ void evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
     args.profiler.add_interval("idle_pull", idle_pull_start, now());
 
     if (work_entry.io_item_index == -1) {
+      worker.flush();
+      push_outputs();
       break;
     }
 
@@ -545,26 +293,12 @@ void evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
       worker.new_task(streams);
     }
 
-    i32 work_item_size = 0;
-    for (size_t i = 0; i < work_entry.columns.size(); ++i) {
-      work_item_size =
-          std::max(work_item_size, (i32)work_entry.columns[i].size());
-    }
-
-    auto input_entry = std::make_tuple(io_item, work_entry);
-    worker.feed(input_entry);
-    std::tuple<IOItem, EvalWorkEntry> output_entry;
-    bool result = worker.yield(work_item_size, output_entry);
-    (void)result;
-    assert(result);
+    worker.feed(std::make_tuple(std::move(io_item), std::move(work_entry)));
+    pending_task_streams.push_back(std::move(task_streams));
 
     profiler.add_interval("task", work_start, now());
 
-    auto idle_push_start = now();
-    output_work.push(std::make_tuple(task_streams, std::get<0>(output_entry),
-                                     std::get<1>(output_entry)));
-    args.profiler.add_interval("idle_push", idle_push_start, now());
-
+    push_outputs();
   }
   VLOG(1) << "Evaluate (N/KI: " << args.node_id << "/" << args.ki
           << "): thread finished";
@@ -593,16 +327,15 @@ void post_evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
 
     auto work_start = now();
 
-    auto input_entry = std::make_tuple(io_item, work_entry);
-    worker.feed(input_entry);
+    worker.feed(std::make_tuple(std::move(io_item), std::move(work_entry)));
     std::tuple<IOItem, EvalWorkEntry> output_entry;
     bool result = worker.yield(output_entry);
     profiler.add_interval("task", work_start, now());
 
     if (result) {
-      output_work.push(std::make_tuple(std::get<0>(entry),
-                                       std::get<0>(output_entry),
-                                       std::get<1>(output_entry)));
+      output_work.push(std::make_tuple(std::move(std::get<0>(entry)),
+                                       std::move(std::get<0>(output_entry)),
+                                       std::move(std::get<1>(output_entry))));
     }
 
     if (std::getenv("NO_PIPELINING")) {
@@ -613,6 +346,119 @@ void post_evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
   VLOG(1) << "Post-evaluate (N/PU: " << args.node_id << "/" << args.id
           << "): thread finished ";
 }
+
+// Period between samples of the allocator counters while a job is running
+const i32 MEMORY_SAMPLE_INTERVAL_MS = 100;
+
+// Longest the work loop sleeps between checks for failed pipeline instances
+const i32 WORK_WAIT_INTERVAL_MS = 100;
+
+void record_memory_sample(Profiler& profiler) {
+  timepoint_t sample_time = now();
+  for (const AllocatorStats& stats : memory_allocator_stats()) {
+    std::stringstream prefix;
+    prefix << stats.device << "/" << stats.allocator << ":";
+    profiler.add_sample(prefix.str() + "live_bytes", sample_time,
+                        stats.live_bytes);
+    profiler.add_sample(prefix.str() + "peak_bytes", sample_time,
+                        stats.peak_bytes);
+    profiler.add_sample(prefix.str() + "allocations", sample_time,
+                        stats.num_allocations);
+  }
+}
+
+void memory_sampler(Profiler& profiler, Flag& done) {
+  while (!done.raised()) {
+    record_memory_sample(profiler);
+    done.wait_for(MEMORY_SAMPLE_INTERVAL_MS);
+  }
+  record_memory_sample(profiler);
+}
+
+void log_memory_pool_stats(i32 node_id, const std::vector<i32>& gpu_ids) {
+  std::vector<DeviceHandle> devices = {CPU_DEVICE};
+  for (i32 gpu_id : gpu_ids) {
+    devices.push_back(DeviceHandle{DeviceType::GPU, gpu_id});
+  }
+  for (DeviceHandle device : devices) {
+    MemoryPoolStats stats;
+    if (!memory_pool_stats(device, stats)) {
+      continue;
+    }
+    VLOG(1) << "Memory pool (N/D: " << node_id << "/" << device
+            << "): size " << stats.pool_size << ", used " << stats.used_bytes
+            << ", high water " << stats.high_water_bytes
+            << ", largest free block " << stats.largest_free_block
+            << ", fragmentation " << stats.fragmentation;
+  }
+}
+
+// CPUs and memory node a thread is bound to. An empty CPU set leaves the
+// thread to the OS scheduler.
+struct ThreadLayout {
+  i32 numa_node = -1;
+  std::vector<i32> cpus;
+};
+
+// One layout per pipeline instance for the requested placement policy
+std::vector<ThreadLayout> plan_pipeline_layouts(
+    proto::ThreadPlacement placement, i32 num_instances) {
+  std::vector<ThreadLayout> layouts(num_instances);
+  if (placement == proto::PLACEMENT_NONE) {
+    return layouts;
+  }
+  std::vector<NumaNode> nodes = numa_nodes();
+  if (placement == proto::PLACEMENT_NUMA) {
+    for (i32 ki = 0; ki < num_instances; ++ki) {
+      const NumaNode& node = nodes[ki % nodes.size()];
+      layouts[ki].numa_node = node.id;
+      layouts[ki].cpus = node.cpus;
+    }
+    return layouts;
+  }
+  // PLACEMENT_CORES: hand out contiguous slices of cores in node order so a
+  // slice only spans two nodes when the slices do not divide evenly
+  std::vector<std::tuple<i32, i32>> cpus;
+  for (const NumaNode& node : nodes) {
+    for (i32 cpu : node.cpus) {
+      cpus.push_back(std::make_tuple(cpu, node.id));
+    }
+  }
+  i32 cpus_per_instance = std::max(1, (i32)cpus.size() / num_instances);
+  for (i32 ki = 0; ki < num_instances; ++ki) {
+    for (i32 c = 0; c < cpus_per_instance; ++c) {
+      auto& cpu = cpus[(ki * cpus_per_instance + c) % cpus.size()];
+      if (c == 0) {
+        layouts[ki].numa_node = std::get<1>(cpu);
+      }
+      layouts[ki].cpus.push_back(std::get<0>(cpu));
+    }
+    std::sort(layouts[ki].cpus.begin(), layouts[ki].cpus.end());
+  }
+  return layouts;
+}
+
+void apply_thread_layout(const ThreadLayout& layout) {
+  if (layout.cpus.empty()) {
+    return;
+  }
+  LOG_IF(WARNING, !pin_thread_to_cpus(layout.cpus))
+      << "Could not pin thread to CPUs " << format_cpu_list(layout.cpus);
+  LOG_IF(WARNING, !prefer_numa_node(layout.numa_node))
+      << "Could not prefer memory from NUMA node " << layout.numa_node;
+}
+
+// Starts a thread that applies layout before running f(args...)
+template <typename Function, typename... Args>
+std::thread start_thread(const ThreadLayout& layout, Function f,
+                         Args... args) {
+  return std::thread(
+      [layout](Function f, Args... args) {
+        apply_thread_layout(layout);
+        f(args...);
+      },
+      f, args...);
+}
 }
 
 WorkerImpl::WorkerImpl(DatabaseParameters& db_params,
@@ -757,10 +603,14 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
     }
   }
 
+  // Filters and aggregates drop rows, so the saved rows need their input row
+  // ids
+  bool drops_rows = false;
   for (size_t i = 1; i < ops.size() - 1; ++i) {
     auto& op = ops.Get(i);
     const std::string& name = op.name();
     OpInfo* op_info = op_registry->get_op_info(name);
+    drops_rows |= op_info->drops_rows();
 
     DeviceType requested_device_type = op.device_type();
     if (requested_device_type == DeviceType::GPU && num_gpus == 0) {
@@ -821,6 +671,18 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
   std::vector<std::vector<std::vector<i32>>> kg_column_mapping;
   std::vector<std::vector<std::vector<i32>>> kg_stencils;
   std::vector<std::vector<i32>> kg_batch_sizes;
+  // Per group -> how long its last kernel may wait to fill a batch
+  std::vector<i32> kg_coalesce_timeouts;
+  // A kernel that fills its batches across work entries ends its group, so
+  // its outputs need not wait for kernels after it
+  i32 coalesce_timeout_ms = job_params->batch_coalesce_timeout_ms();
+  auto coalesces = [&](size_t i) {
+    const std::vector<i32>& stencil = analysis_results.stencils[i];
+    return coalesce_timeout_ms > 0 && analysis_results.batch_sizes[i] > 1 &&
+           stencil.size() == 1 && stencil[0] == 0 &&
+           !op_registry->get_op_info(kernel_factories[i]->get_op_name())
+                ->drops_rows();
+  };
   if (!kernel_factories.empty()) {
     DeviceType last_device_type = kernel_factories[0]->get_device_type();
     kernel_groups.emplace_back();
@@ -830,11 +692,13 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
     kg_column_mapping.emplace_back();
     kg_stencils.emplace_back();
     kg_batch_sizes.emplace_back();
+    kg_coalesce_timeouts.emplace_back();
     for (size_t i = 0; i < kernel_factories.size(); ++i) {
       KernelFactory* factory = kernel_factories[i];
-      if (factory->get_device_type() != last_device_type) {
-        // Does not use the same device as previous kernel, so push into new
-        // group
+      if (factory->get_device_type() != last_device_type ||
+          (i > 0 && coalesces(i - 1))) {
+        // Does not use the same device as previous kernel, or the previous
+        // kernel fills its batches across entries, so push into new group
         last_device_type = factory->get_device_type();
         kernel_groups.emplace_back();
         kg_live_columns.emplace_back();
@@ -843,6 +707,7 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
         kg_column_mapping.emplace_back();
         kg_stencils.emplace_back();
         kg_batch_sizes.emplace_back();
+        kg_coalesce_timeouts.emplace_back();
       }
       auto& group = kernel_groups.back();
       auto& lc = kg_live_columns.back();
@@ -858,11 +723,13 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
       cm.push_back(column_mapping[i]);
       st.push_back(analysis_results.stencils[i]);
       bt.push_back(analysis_results.batch_sizes[i]);
+      kg_coalesce_timeouts.back() = coalesces(i) ? coalesce_timeout_ms : 0;
     }
   }
 
+  // A job may have no kernels, e.g. when prune_task_set removed every op,
+  // and then the pre-evaluate worker feeds the post-evaluate worker directly
   i32 num_kernel_groups = static_cast<i32>(kernel_groups.size());
-  assert(num_kernel_groups > 0);  // is this actually necessary?
 
   i32 pipeline_instances_per_node = job_params->pipeline_instances_per_node();
   // If ki per node is -1, we set a smart default. Currently, we calculate the
@@ -891,6 +758,10 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
         }
       }
     }
+    // Without kernels, one pipeline only moves rows from load to save
+    if (num_kernel_groups == 0) {
+      pipeline_instances_per_node = 1;
+    }
   }
 
   if (pipeline_instances_per_node <= 0) {
@@ -926,16 +797,87 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
 
   omp_set_num_threads(std::thread::hardware_concurrency());
 
+  // Parallel kernels split their batches over one pool for the whole node.
+  // The evaluate thread running a kernel works on its batches too.
+  std::unique_ptr<ThreadPool> kernel_pool;
+  for (KernelFactory* factory : kernel_factories) {
+    if (factory->parallel() && !kernel_pool) {
+      kernel_pool.reset(new ThreadPool(std::max(num_cpus - 1, 0)));
+    }
+  }
+
+  // Bind each pipeline instance to a NUMA node or core set. Load threads
+  // serve the instances on their own node through a per-node queue, so the
+  // buffers they read are allocated on the node that decodes them.
+  i32 num_load_workers = db_params_.num_load_workers;
+  std::vector<ThreadLayout> instance_layouts = plan_pipeline_layouts(
+      job_params->thread_placement(), pipeline_instances_per_node);
+  std::vector<ThreadLayout> load_layouts;
+  std::vector<i32> instance_load_queue(pipeline_instances_per_node);
+  {
+    std::vector<i32> nodes;
+    for (const ThreadLayout& layout : instance_layouts) {
+      if (std::find(nodes.begin(), nodes.end(), layout.numa_node) ==
+          nodes.end()) {
+        nodes.push_back(layout.numa_node);
+      }
+    }
+    i32 num_load_queues =
+        std::max(1, std::min((i32)nodes.size(), num_load_workers));
+    load_layouts.resize(num_load_queues);
+    for (i32 ki = 0; ki < pipeline_instances_per_node; ++ki) {
+      const ThreadLayout& layout = instance_layouts[ki];
+      i32 queue_idx = (std::find(nodes.begin(), nodes.end(),
+                                 layout.numa_node) - nodes.begin()) %
+                      num_load_queues;
+      instance_load_queue[ki] = queue_idx;
+      ThreadLayout& load_layout = load_layouts[queue_idx];
+      if (load_layout.cpus.empty()) {
+        load_layout.numa_node = layout.numa_node;
+      }
+      load_layout.cpus.insert(load_layout.cpus.end(), layout.cpus.begin(),
+                              layout.cpus.end());
+    }
+    for (ThreadLayout& layout : load_layouts) {
+      std::sort(layout.cpus.begin(), layout.cpus.end());
+      layout.cpus.erase(std::unique(layout.cpus.begin(), layout.cpus.end()),
+                        layout.cpus.end());
+    }
+  }
+  for (i32 ki = 0; ki < pipeline_instances_per_node; ++ki) {
+    VLOG(1) << "Pipeline instance (N/KI: " << node_id_ << "/" << ki
+            << "): NUMA node " << instance_layouts[ki].numa_node << ", CPUs "
+            << format_cpu_list(instance_layouts[ki].cpus);
+  }
+
   // Setup shared resources for distributing work to processing threads
-  i64 accepted_items = 0;
-  LoadInputQueue load_work;
-  std::vector<EvalQueue> initial_eval_work(pipeline_instances_per_node);
+  std::vector<LoadInputQueue> load_work(load_layouts.size());
+  InitialEvalQueue initial_eval_work(pipeline_instances_per_node);
+  // Idle instances steal from instances on their own NUMA node first
+  for (i32 ki = 0; ki < pipeline_instances_per_node; ++ki) {
+    std::vector<i32> victims;
+    for (i32 pass = 0; pass < 2; ++pass) {
+      for (i32 i = 1; i < pipeline_instances_per_node; ++i) {
+        i32 victim = (ki + i) % pipeline_instances_per_node;
+        bool same_node = instance_layouts[victim].numa_node ==
+                         instance_layouts[ki].numa_node;
+        if (same_node == (pass == 0)) {
+          victims.push_back(victim);
+        }
+      }
+    }
+    initial_eval_work.set_steal_order(ki, victims);
+  }
   std::vector<std::vector<EvalQueue>> eval_work(pipeline_instances_per_node);
   EvalQueue save_work;
-  std::atomic<i64> retired_items{0};
+  EventCounter retired_items;
+  InFlightTarget in_flight(
+      pipeline_instances_per_node,
+      pipeline_instances_per_node * job_params->tasks_in_queue_per_pu());
+  // Sent to the master with every finished item
+  std::atomic<i32> in_flight_target(in_flight.target());
 
   // Setup load workers
-  i32 num_load_workers = db_params_.num_load_workers;
   std::vector<Profiler> load_thread_profilers;
   for (i32 i = 0; i < num_load_workers; ++i) {
     load_thread_profilers.emplace_back(Profiler(base_time));
@@ -948,8 +890,10 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
                         i, db_params_.storage_config, load_thread_profilers[i],
                         job_params->load_sparsity_threshold()};
 
-    load_threads.emplace_back(load_driver, std::ref(load_work),
-                              std::ref(initial_eval_work), args);
+    i32 queue_idx = i % load_work.size();
+    load_threads.push_back(start_thread(
+        load_layouts[queue_idx], load_driver, std::ref(load_work[queue_idx]),
+        std::ref(initial_eval_work), std::ref(in_flight), args));
   }
 
   // Setup evaluate workers
@@ -958,7 +902,7 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
   std::vector<std::vector<proto::Result>> eval_results(
       pipeline_instances_per_node);
 
-  std::vector<std::tuple<EvalQueue*, EvalQueue*>> pre_eval_queues;
+  std::vector<EvalQueue*> pre_eval_queues;
   std::vector<PreEvaluateWorkerArgs> pre_eval_args;
   std::vector<std::vector<std::tuple<EvalQueue*, EvalQueue*>>> eval_queues(
       pipeline_instances_per_node);
@@ -967,7 +911,6 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
   std::vector<std::tuple<EvalQueue*, EvalQueue*>> post_eval_queues;
   std::vector<PostEvaluateWorkerArgs> post_eval_args;
 
-  i32 next_cpu_num = 0;
   i32 next_gpu_idx = 0;
   for (i32 ki = 0; ki < pipeline_instances_per_node; ++ki) {
     auto& work_queues = eval_work[ki];
@@ -983,7 +926,8 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
     }
 
     // Evaluate worker
-    DeviceHandle first_kernel_type;
+    // Rows are decoded on the CPU if there is no kernel
+    DeviceHandle first_kernel_type = CPU_DEVICE;
     for (i32 kg = 0; kg < num_kernel_groups; ++kg) {
       auto& group = kernel_groups[kg];
       auto& lc = kg_live_columns[kg];
@@ -1003,7 +947,6 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
       if (device_type == DeviceType::CPU) {
         for (i32 i = 0; i < factory->get_max_devices(); ++i) {
           i32 device_id = 0;
-          next_cpu_num++ % num_cpus;
           for (size_t i = 0; i < group.size(); ++i) {
             KernelConfig& config = std::get<1>(group[i]);
             config.devices.clear();
@@ -1037,17 +980,16 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
           node_id_,
 
           // Per worker arguments
-          ki, kg, group, lc, dc, uo, cm, st, bt, eval_thread_profilers[kg + 1],
+          ki, kg, group, lc, dc, uo, cm, st, bt, kernel_pool.get(),
+          kg_coalesce_timeouts[kg], kg == num_kernel_groups - 1,
+          eval_thread_profilers[kg + 1],
           results[kg]});
     }
     // Pre evaluate worker
     {
-      EvalQueue* input_work_queue = &initial_eval_work[ki];
       EvalQueue* output_work_queue =
           &work_queues[0];
-      assert(kernel_groups.size() > 0);
-      pre_eval_queues.push_back(
-          std::make_tuple(input_work_queue, output_work_queue));
+      pre_eval_queues.push_back(output_work_queue);
       DeviceHandle decoder_type = std::getenv("FORCE_CPU_DECODE")
         ? CPU_DEVICE
         : first_kernel_type;
@@ -1092,21 +1034,23 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
   std::vector<std::thread> post_eval_threads;
   for (i32 pu = 0; pu < pipeline_instances_per_node; ++pu) {
     // Pre thread
-    pre_eval_threads.emplace_back(
-        pre_evaluate_driver, std::ref(*std::get<0>(pre_eval_queues[pu])),
-        std::ref(*std::get<1>(pre_eval_queues[pu])), pre_eval_args[pu]);
+    const ThreadLayout& layout = instance_layouts[pu];
+    pre_eval_threads.push_back(start_thread(
+        layout, pre_evaluate_driver, std::ref(initial_eval_work),
+        std::ref(*pre_eval_queues[pu]), pre_eval_args[pu]));
     // Op threads
     eval_threads.emplace_back();
     std::vector<std::thread>& threads = eval_threads.back();
     for (i32 kg = 0; kg < num_kernel_groups; ++kg) {
-      threads.emplace_back(
-          evaluate_driver, std::ref(*std::get<0>(eval_queues[pu][kg])),
-          std::ref(*std::get<1>(eval_queues[pu][kg])), eval_args[pu][kg]);
+      threads.push_back(start_thread(
+          layout, evaluate_driver, std::ref(*std::get<0>(eval_queues[pu][kg])),
+          std::ref(*std::get<1>(eval_queues[pu][kg])), eval_args[pu][kg]));
     }
     // Post threads
-    post_eval_threads.emplace_back(
-        post_evaluate_driver, std::ref(*std::get<0>(post_eval_queues[pu])),
-        std::ref(*std::get<1>(post_eval_queues[pu])), post_eval_args[pu]);
+    post_eval_threads.push_back(start_thread(
+        layout, post_evaluate_driver,
+        std::ref(*std::get<0>(post_eval_queues[pu])),
+        std::ref(*std::get<1>(post_eval_queues[pu])), post_eval_args[pu]));
   }
 
   // Setup save workers
@@ -1118,49 +1062,54 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
     // Create IO thread for reading and decoding data
     save_thread_args.emplace_back(SaveThreadArgs{
         // Uniform arguments
-        node_id_, job_params->job_name(),
+        node_id_, job_params->job_name(), job_params->job_id(), drops_rows,
 
         // Per worker arguments
         i, db_params_.storage_config, save_thread_profilers[i],
 
         // Queues
-        save_work, retired_items});
+        save_work, retired_items, in_flight_target, master_.get()});
   }
   std::vector<pthread_t> save_threads(num_save_workers);
   for (i32 i = 0; i < num_save_workers; ++i) {
     pthread_create(&save_threads[i], NULL, save_thread, &save_thread_args[i]);
   }
 
+  // Sample allocator usage for the memory timeline in the profile. Samples
+  // are only written out with the profile, so skip them otherwise.
+  Profiler memory_profiler(base_time);
+  Flag memory_sampler_done;
+  std::thread memory_sampler_thread;
+  if (job_params->profiling()) {
+    memory_sampler_thread =
+        std::thread(memory_sampler, std::ref(memory_profiler),
+                    std::ref(memory_sampler_done));
+  }
+
   if (job_params->profiling()) {
     sleep(10);
   }
   timepoint_t start_time = now();
 
-  // Monitor amount of work left and request more when running low
-
-  // Round robin work
-  i32 last_work_queue = 0;
-  while (true) {
-    i32 local_work = accepted_items - retired_items;
-    if (local_work < pipeline_instances_per_node * job_params->tasks_in_queue_per_pu()) {
-      grpc::ClientContext context;
-      proto::NodeInfo node_info;
-      proto::NewWork new_work;
-
-      node_info.set_node_id(node_id_);
-      grpc::Status status = master_->NextWork(&context, node_info, &new_work);
-      if (!status.ok()) {
-        RESULT_ERROR(job_result,
-                     "Worker %d could not get next work from master", node_id_);
-        break;
-      }
-
-      i32 next_item = new_work.io_item().item_id();
-      if (next_item == -1) {
-        // No more work left
-        VLOG(1) << "Node " << node_id_ << " received done signal.";
-        break;
-      } else {
+  // The master streams items to this node whenever it has fewer in flight than
+  // the target, which the save threads keep it up to date on. The stream is
+  // read on its own thread, since pushing into a full load queue blocks.
+
+  // Items are handed out round robin as a starting point. Pipeline instances
+  // that run out steal from the others, so slow items do not hold a backlog.
+  grpc::ClientContext stream_context;
+  proto::WorkRequest stream_request;
+  stream_request.set_node_id(node_id_);
+  stream_request.set_max_items(in_flight_target);
+  std::unique_ptr<grpc::ClientReader<proto::NewWorkBatch>> work_stream(
+      master_->StreamWork(&stream_context, stream_request));
+  bool job_finished = false;
+  Flag stream_done;
+  std::thread stream_thread([&]() {
+    i32 last_work_queue = 0;
+    proto::NewWorkBatch batch;
+    while (work_stream->Read(&batch)) {
+      for (const proto::NewWork& new_work : batch.work()) {
         // Perform analysis on load work entry to determine upstream
         // requirements and when to discard elements.
         std::deque<TaskStream> task_stream;
@@ -1170,13 +1119,25 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
                                     analysis_results.stencils, work_item_size,
                                     stenciled_entry, task_stream);
 
-        load_work.push(std::make_tuple(last_work_queue++, task_stream, new_work.io_item(),
-                                       stenciled_entry));
-        last_work_queue %= pipeline_instances_per_node;
-        accepted_items++;
+        load_work[instance_load_queue[last_work_queue]].push(
+            std::make_tuple(last_work_queue, std::move(task_stream),
+                            new_work.io_item(), std::move(stenciled_entry)));
+        last_work_queue = (last_work_queue + 1) % pipeline_instances_per_node;
+      }
+      if (batch.finished()) {
+        // No more work left
+        VLOG(1) << "Node " << node_id_ << " received done signal.";
+        job_finished = true;
       }
     }
+    stream_done.set();
+  });
 
+  // Watch for failed pipelines and the rate at which items are saved until
+  // the stream ends
+  i64 seen_retired = 0;
+  timepoint_t last_retire_time = now();
+  while (!stream_done.raised()) {
     for (size_t i = 0; i < eval_results.size(); ++i) {
       for (size_t j = 0; j < eval_results[i].size(); ++j) {
         auto& result = eval_results[i][j];
@@ -1194,17 +1155,47 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
     break;
   remain_loop:
 
-    std::this_thread::yield();
+    i64 retired = retired_items.wait_for(seen_retired, WORK_WAIT_INTERVAL_MS);
+    if (retired > seen_retired) {
+      // The first items retire after the pipeline has filled, which says
+      // nothing about its steady state rate
+      if (seen_retired > 0) {
+        in_flight.record_retired(retired - seen_retired,
+                                 nano_since(last_retire_time) / 1e9);
+      }
+      seen_retired = retired;
+      last_retire_time = now();
+      in_flight_target = in_flight.target();
+    }
+  }
+  if (!job_result->success()) {
+    // Nothing will drain the load queues, so keep emptying them until the
+    // stream thread has given up pushing into them
+    stream_context.TryCancel();
+    while (!stream_done.raised()) {
+      for (LoadInputQueue& q : load_work) {
+        q.clear();
+      }
+      stream_done.wait_for(WORK_WAIT_INTERVAL_MS);
+    }
+  }
+  stream_thread.join();
+  grpc::Status stream_status = work_stream->Finish();
+  if (job_result->success() && !job_finished) {
+    RESULT_ERROR(job_result, "Worker %d lost its work stream from master: %s",
+                 node_id_, stream_status.error_message().c_str());
   }
+  VLOG(1) << "Node " << node_id_ << " in-flight item target at end of job: "
+          << in_flight.target();
 
   // If the job failed, can't expect queues to have drained, so
   // attempt to flush all all queues here (otherwise we could block
   // on pushing into a queue)
   if (!job_result->success()) {
-    load_work.clear();
-    for (i32 pu = 0; pu < pipeline_instances_per_node; ++pu) {
-      initial_eval_work[pu].clear();
+    for (LoadInputQueue& q : load_work) {
+      q.clear();
     }
+    initial_eval_work.clear();
     for (i32 kg = 0; kg < num_kernel_groups; ++kg) {
       for (i32 pu = 0; pu < pipeline_instances_per_node; ++pu) {
         eval_work[pu][kg].clear();
@@ -1226,7 +1217,7 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
   for (i32 i = 0; i < num_load_workers; ++i) {
     LoadWorkEntry entry;
     entry.set_io_item_index(-1);
-    load_work.push(
+    load_work[i % load_work.size()].push(
         std::make_tuple(0, std::deque<TaskStream>(), IOItem{}, entry));
   }
 
@@ -1235,10 +1226,8 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
     load_threads[i].join();
   }
 
-  // Push sentinel work entries into queue to terminate eval threads
-  for (i32 i = 0; i < pipeline_instances_per_node; ++i) {
-    push_exit_message(initial_eval_work[i]);
-  }
+  // Pre eval threads exit once the remaining items have been taken
+  initial_eval_work.close();
 
   for (i32 i = 0; i < pipeline_instances_per_node; ++i) {
     // Wait until pre eval has finished
@@ -1276,6 +1265,12 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
     free(result);
   }
 
+  memory_sampler_done.set();
+  if (memory_sampler_thread.joinable()) {
+    memory_sampler_thread.join();
+  }
+  log_memory_pool_stats(node_id_, gpu_ids);
+
   // Ensure all files are flushed
   if (job_params->profiling()) {
     std::fflush(NULL);
@@ -1324,25 +1319,25 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
   // Evaluate worker profilers
   u8 eval_worker_count = pipeline_instances_per_node;
   s_write(profiler_output.get(), eval_worker_count);
-  u8 profilers_per_chain = 3;
+  // One for pre, one per kernel group and one for post, so jobs without
+  // kernels have just two
+  u8 profilers_per_chain = num_kernel_groups + 2;
   s_write(profiler_output.get(), profilers_per_chain);
   for (i32 pu = 0; pu < pipeline_instances_per_node; ++pu) {
     i32 i = pu;
-    {
-      std::string tag = "pre";
-      write_profiler_to_file(profiler_output.get(), out_rank, "eval", tag, i,
-                             eval_profilers[pu][0]);
-    }
-    {
+    std::vector<Profiler>& chain = eval_profilers[pu];
+    write_profiler_to_file(profiler_output.get(), out_rank, "eval", "pre", i,
+                           chain.front());
+    for (i32 kg = 0; kg < num_kernel_groups; ++kg) {
       std::string tag = "eval";
+      if (num_kernel_groups > 1) {
+        tag += std::to_string(kg);
+      }
       write_profiler_to_file(profiler_output.get(), out_rank, "eval", tag, i,
-                             eval_profilers[pu][1]);
-    }
-    {
-      std::string tag = "post";
-      write_profiler_to_file(profiler_output.get(), out_rank, "eval", tag, i,
-                             eval_profilers[pu][2]);
+                             chain[1 + kg]);
     }
+    write_profiler_to_file(profiler_output.get(), out_rank, "eval", "post", i,
+                           chain.back());
   }
 
   // Save worker profilers
@@ -1353,6 +1348,30 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
                            save_thread_profilers[i]);
   }
 
+  // Memory usage samples
+  u8 memory_profiler_count = 1;
+  s_write(profiler_output.get(), memory_profiler_count);
+  write_profiler_to_file(profiler_output.get(), out_rank, "memory", "", 0,
+                         memory_profiler);
+
+  // Thread placement: the NUMA node and CPUs of each load thread and
+  // pipeline instance. Save threads are left unpinned.
+  i32 placement_count = num_load_workers + pipeline_instances_per_node;
+  s_write(profiler_output.get(), placement_count);
+  auto write_layout = [&](const std::string& type, i32 worker_num,
+                          const ThreadLayout& layout) {
+    s_write(profiler_output.get(), type);
+    s_write(profiler_output.get(), worker_num);
+    s_write(profiler_output.get(), layout.numa_node);
+    s_write(profiler_output.get(), format_cpu_list(layout.cpus));
+  };
+  for (i32 i = 0; i < num_load_workers; ++i) {
+    write_layout("load", i, load_layouts[i % load_layouts.size()]);
+  }
+  for (i32 ki = 0; ki < pipeline_instances_per_node; ++ki) {
+    write_layout("eval", ki, instance_layouts[ki]);
+  }
+
   BACKOFF_FAIL(profiler_output->save());
 
   VLOG(1) << "Worker " << node_id_ << " finished NewJob";
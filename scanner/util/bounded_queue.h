@@ -0,0 +1,141 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+namespace scanner {
+
+/**
+ * @brief Bounded multi-producer multi-consumer queue.
+ *
+ * A lock-free ring buffer (Vyukov's bounded MPMC design): each slot carries a
+ * sequence number that tells producers and consumers whether it is ready for
+ * them, so the try_* operations are a single CAS on the head or tail index.
+ * The blocking and timed wrappers only fall back to a mutex and condition
+ * variable when the queue is full or empty, and only notify when a thread is
+ * actually waiting, so a queue that never blocks never touches a lock.
+ *
+ * The capacity is rounded up to a power of two.
+ */
+template <typename T>
+class BoundedQueue {
+ public:
+  BoundedQueue(i32 max_size = 4);
+  //! Only valid when o is empty and unused, e.g. when resizing a vector of
+  //! queues before starting threads.
+  BoundedQueue(BoundedQueue<T>&& o);
+  ~BoundedQueue();
+
+  BoundedQueue(const BoundedQueue<T>&) = delete;
+  BoundedQueue& operator=(const BoundedQueue<T>&) = delete;
+
+  //! Approximate number of elements, adjusted for blocked producers and
+  //! consumers like Queue::size.
+  i32 size();
+
+  i32 capacity() const;
+
+  template <typename... Args>
+  bool try_emplace(Args&&... args);
+
+  bool try_push(T&& item);
+
+  bool try_push(const T& item);
+
+  bool try_pop(T& item);
+
+  template <typename... Args>
+  void emplace(Args&&... args);
+
+  void push(T item);
+
+  void pop(T& item);
+
+  //! Returns false if no slot became free within timeout_ms.
+  bool push_for(T&& item, i32 timeout_ms);
+
+  //! Returns false if no element arrived within timeout_ms.
+  bool pop_for(T& item, i32 timeout_ms);
+
+  //! Pushes every element of items in order, blocking as needed, and clears
+  //! items.
+  void push_batch(std::vector<T>& items);
+
+  //! Blocks until at least one element is available, then pops up to
+  //! max_items elements into items. Returns the number popped.
+  i32 pop_batch(std::vector<T>& items, i32 max_items);
+
+  void clear();
+
+  void wait_until_empty();
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  static const size_t CACHE_LINE_SIZE = 64;
+  // Number of times the blocking operations retry before sleeping
+  static const i32 SPIN_COUNT = 16;
+
+  T* item_ptr(Cell& cell);
+
+  // Lock-free ring operations without waking blocked threads
+  template <typename... Args>
+  bool enqueue(Args&&... args);
+  bool dequeue(T& item);
+
+  template <typename Clock>
+  bool push_until(T&& item, std::chrono::time_point<Clock> deadline,
+                  bool timed);
+  template <typename Clock>
+  bool pop_until(T& item, std::chrono::time_point<Clock> deadline,
+                 bool timed);
+
+  void notify_pushed();
+  void notify_popped();
+
+  size_t mask_;
+  Cell* cells_;
+
+  // Producers and consumers each own a cache line
+  char pad0_[CACHE_LINE_SIZE];
+  std::atomic<size_t> enqueue_pos_;
+  char pad1_[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> dequeue_pos_;
+  char pad2_[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+  // Slow path state, only touched when a thread has to block
+  std::mutex wait_mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::condition_variable empty_;
+  std::atomic<i32> pop_waiters_{0};
+  std::atomic<i32> push_waiters_{0};
+  std::atomic<i32> empty_waiters_{0};
+};
+}
+
+#include "bounded_queue.inl"
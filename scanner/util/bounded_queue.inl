@@ -0,0 +1,319 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bounded_queue.h"
+
+#include <thread>
+
+namespace scanner {
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(i32 max_size) {
+  size_t capacity = 2;
+  while (capacity < (size_t)max_size) {
+    capacity <<= 1;
+  }
+  mask_ = capacity - 1;
+  cells_ = new Cell[capacity];
+  for (size_t i = 0; i < capacity; ++i) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  enqueue_pos_.store(0, std::memory_order_relaxed);
+  dequeue_pos_.store(0, std::memory_order_relaxed);
+}
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(BoundedQueue<T>&& o)
+  : BoundedQueue(o.capacity()) {}
+
+template <typename T>
+BoundedQueue<T>::~BoundedQueue() {
+  // Destroy elements that were pushed but never popped
+  size_t end = enqueue_pos_.load();
+  for (size_t pos = dequeue_pos_.load(); pos != end; ++pos) {
+    Cell& cell = cells_[pos & mask_];
+    if (cell.sequence.load() == pos + 1) {
+      item_ptr(cell)->~T();
+    }
+  }
+  delete[] cells_;
+}
+
+template <typename T>
+i32 BoundedQueue<T>::size() {
+  i64 queued = (i64)enqueue_pos_.load() - (i64)dequeue_pos_.load();
+  return (i32)queued - pop_waiters_ + push_waiters_;
+}
+
+template <typename T>
+i32 BoundedQueue<T>::capacity() const {
+  return (i32)(mask_ + 1);
+}
+
+template <typename T>
+template <typename... Args>
+bool BoundedQueue<T>::try_emplace(Args&&... args) {
+  if (!enqueue(std::forward<Args>(args)...)) {
+    return false;
+  }
+  notify_pushed();
+  return true;
+}
+
+template <typename T>
+bool BoundedQueue<T>::try_push(T&& item) {
+  return try_emplace(std::move(item));
+}
+
+template <typename T>
+bool BoundedQueue<T>::try_push(const T& item) {
+  return try_emplace(item);
+}
+
+template <typename T>
+bool BoundedQueue<T>::try_pop(T& item) {
+  if (!dequeue(item)) {
+    return false;
+  }
+  notify_popped();
+  return true;
+}
+
+template <typename T>
+template <typename... Args>
+void BoundedQueue<T>::emplace(Args&&... args) {
+  push(T(std::forward<Args>(args)...));
+}
+
+template <typename T>
+void BoundedQueue<T>::push(T item) {
+  push_until(std::move(item), std::chrono::steady_clock::now(), false);
+}
+
+template <typename T>
+void BoundedQueue<T>::pop(T& item) {
+  pop_until(item, std::chrono::steady_clock::now(), false);
+}
+
+template <typename T>
+bool BoundedQueue<T>::push_for(T&& item, i32 timeout_ms) {
+  return push_until(std::move(item),
+                    std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeout_ms),
+                    true);
+}
+
+template <typename T>
+bool BoundedQueue<T>::pop_for(T& item, i32 timeout_ms) {
+  return pop_until(item,
+                   std::chrono::steady_clock::now() +
+                       std::chrono::milliseconds(timeout_ms),
+                   true);
+}
+
+template <typename T>
+void BoundedQueue<T>::push_batch(std::vector<T>& items) {
+  for (T& item : items) {
+    push(std::move(item));
+  }
+  items.clear();
+}
+
+template <typename T>
+i32 BoundedQueue<T>::pop_batch(std::vector<T>& items, i32 max_items) {
+  if (max_items <= 0) {
+    return 0;
+  }
+  items.emplace_back();
+  pop(items.back());
+  i32 popped = 1;
+  while (popped < max_items) {
+    items.emplace_back();
+    if (!try_pop(items.back())) {
+      items.pop_back();
+      break;
+    }
+    popped++;
+  }
+  return popped;
+}
+
+template <typename T>
+void BoundedQueue<T>::clear() {
+  T item;
+  while (try_pop(item)) {
+  }
+}
+
+template <typename T>
+void BoundedQueue<T>::wait_until_empty() {
+  std::unique_lock<std::mutex> lock(wait_mutex_);
+  empty_waiters_++;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  empty_.wait(lock, [this] {
+    return enqueue_pos_.load() == dequeue_pos_.load();
+  });
+  empty_waiters_--;
+}
+
+template <typename T>
+T* BoundedQueue<T>::item_ptr(Cell& cell) {
+  return reinterpret_cast<T*>(&cell.storage);
+}
+
+template <typename T>
+template <typename... Args>
+bool BoundedQueue<T>::enqueue(Args&&... args) {
+  Cell* cell;
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &cells_[pos & mask_];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Slot still holds an element from the previous lap, so we are full
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  new (item_ptr(*cell)) T(std::forward<Args>(args)...);
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+bool BoundedQueue<T>::dequeue(T& item) {
+  Cell* cell;
+  size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &cells_[pos & mask_];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Slot has not been filled for this lap yet, so we are empty
+      return false;
+    } else {
+      pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  T* slot = item_ptr(*cell);
+  item = std::move(*slot);
+  slot->~T();
+  cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+template <typename Clock>
+bool BoundedQueue<T>::push_until(T&& item,
+                                 std::chrono::time_point<Clock> deadline,
+                                 bool timed) {
+  for (i32 i = 0; i < SPIN_COUNT; ++i) {
+    if (try_push(std::move(item))) {
+      return true;
+    }
+    std::this_thread::yield();
+  }
+  bool pushed = true;
+  {
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    push_waiters_++;
+    // Pairs with the fence in notify_popped: either the consumer sees our
+    // waiter count or we see its free slot
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!enqueue(std::move(item))) {
+      if (!timed) {
+        not_full_.wait(lock);
+      } else if (not_full_.wait_until(lock, deadline) ==
+                 std::cv_status::timeout) {
+        pushed = enqueue(std::move(item));
+        break;
+      }
+    }
+    push_waiters_--;
+  }
+  if (pushed) {
+    notify_pushed();
+  }
+  return pushed;
+}
+
+template <typename T>
+template <typename Clock>
+bool BoundedQueue<T>::pop_until(T& item,
+                                std::chrono::time_point<Clock> deadline,
+                                bool timed) {
+  for (i32 i = 0; i < SPIN_COUNT; ++i) {
+    if (try_pop(item)) {
+      return true;
+    }
+    std::this_thread::yield();
+  }
+  bool popped = true;
+  {
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    pop_waiters_++;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!dequeue(item)) {
+      if (!timed) {
+        not_empty_.wait(lock);
+      } else if (not_empty_.wait_until(lock, deadline) ==
+                 std::cv_status::timeout) {
+        popped = dequeue(item);
+        break;
+      }
+    }
+    pop_waiters_--;
+  }
+  if (popped) {
+    notify_popped();
+  }
+  return popped;
+}
+
+template <typename T>
+void BoundedQueue<T>::notify_pushed() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (pop_waiters_.load() > 0) {
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    not_empty_.notify_one();
+  }
+}
+
+template <typename T>
+void BoundedQueue<T>::notify_popped() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (push_waiters_.load() > 0) {
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    not_full_.notify_one();
+  }
+  if (empty_waiters_.load() > 0 &&
+      enqueue_pos_.load() == dequeue_pos_.load()) {
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    empty_.notify_all();
+  }
+}
+}
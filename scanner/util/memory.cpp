@@ -16,11 +16,18 @@
 #include "scanner/util/memory.h"
 #include "scanner/util/cuda.h"
 
+#include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/sysinfo.h>
 #include <unistd.h>
+#include <atomic>
 #include <cassert>
+#include <map>
 #include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
 
 #ifdef HAVE_CUDA
 #include <cuda.h>
@@ -65,18 +72,59 @@ namespace scanner {
 // or block memory segments, the former of which is allocated by the system
 // and the latter by the pool if it exists.
 
+// Usage counters kept by every allocator. Updates are lock free so they can
+// be sampled from a telemetry thread while the pipeline is running.
+class AllocatorCounters {
+ public:
+  void allocated(size_t size) {
+    i64 live = live_bytes_ += size;
+    i64 peak = peak_bytes_.load();
+    while (live > peak && !peak_bytes_.compare_exchange_weak(peak, live)) {
+    }
+    num_allocations_++;
+  }
+
+  void freed(size_t size) { live_bytes_ -= size; }
+
+  AllocatorStats stats(DeviceHandle device, const std::string& name) const {
+    AllocatorStats stats;
+    stats.device = device;
+    stats.allocator = name;
+    stats.live_bytes = live_bytes_.load();
+    stats.peak_bytes = peak_bytes_.load();
+    stats.num_allocations = num_allocations_.load();
+    return stats;
+  }
+
+ private:
+  std::atomic<i64> live_bytes_{0};
+  std::atomic<i64> peak_bytes_{0};
+  std::atomic<i64> num_allocations_{0};
+};
+
 class Allocator {
  public:
   virtual ~Allocator(){};
 
   virtual u8* allocate(size_t size) = 0;
   virtual void free(u8* buffer) = 0;
+
+  const AllocatorCounters& counters() const { return counters_; }
+
+ protected:
+  AllocatorCounters counters_;
 };
 
+// Size of a huge page on x86-64. CPU allocations smaller than this are not
+// worth mapping with huge pages.
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
 class SystemAllocator : public Allocator {
  public:
-  SystemAllocator(DeviceHandle device, bool pinned = false)
-    : device_(device), pinned_(pinned) {
+  SystemAllocator(DeviceHandle device, bool pinned = false,
+                  MemoryPoolConfig::HugePages huge_pages =
+                      MemoryPoolConfig::HUGE_PAGES_NONE)
+    : device_(device), pinned_(pinned), huge_pages_(huge_pages) {
   }
 
   ~SystemAllocator() {
@@ -90,12 +138,65 @@ class SystemAllocator : public Allocator {
   }
 
   u8* allocate(size_t size) {
+    u8* buffer;
+    if (device_.type == DeviceType::CPU) {
+      // CPU allocations carry their size in a header just before the buffer,
+      // so allocating and freeing share no state besides the counters
+      u8* base = allocate_device(size + HEADER_SIZE);
+      AllocationHeader* header = (AllocationHeader*)base;
+      header->size = size;
+      header->magic = HEADER_MAGIC;
+      buffer = base + HEADER_SIZE;
+    } else {
+      buffer = allocate_device(size);
+      SizeShard& shard = shard_for(buffer);
+      std::lock_guard<std::mutex> guard(shard.lock);
+      shard.sizes[buffer] = size;
+    }
+    counters_.allocated(size);
+    return buffer;
+  }
+
+  void free(u8* buffer) {
+    size_t size = 0;
+    if (device_.type == DeviceType::CPU) {
+      AllocationHeader* header = header_of(buffer);
+      size = header->size;
+      header->magic = 0;
+      free_device((u8*)header, size + HEADER_SIZE);
+    } else {
+      {
+        SizeShard& shard = shard_for(buffer);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto it = shard.sizes.find(buffer);
+        if (it != shard.sizes.end()) {
+          size = it->second;
+          shard.sizes.erase(it);
+        }
+      }
+      free_device(buffer, size);
+    }
+    counters_.freed(size);
+  }
+
+  size_t alignment() {
+    if (device_.type == DeviceType::CPU) {
+      return 16;
+    } else if (device_.type == DeviceType::GPU) {
+      return 256;
+    }
+  }
+
+ private:
+  u8* allocate_device(size_t size) {
     if (device_.type == DeviceType::CPU) {
       try {
         if (pinned_) {
           u8* buff;
           CUDA_PROTECT({ CU_CHECK(cudaMallocHost((void**)&buff, size)); });
           return buff;
+        } else if (uses_huge_pages(size)) {
+          return map_huge_pages(size);
         } else {
           return new u8[size];
         }
@@ -112,10 +213,12 @@ class SystemAllocator : public Allocator {
     }
   }
 
-  void free(u8* buffer) {
+  void free_device(u8* buffer, size_t size) {
     if (device_.type == DeviceType::CPU) {
       if (pinned_) {
         CUDA_PROTECT({ CU_CHECK(cudaFreeHost(buffer)); });
+      } else if (uses_huge_pages(size)) {
+        munmap(buffer, huge_page_length(size));
       } else {
         delete[] buffer;
       }
@@ -127,76 +230,143 @@ class SystemAllocator : public Allocator {
     }
   }
 
-  size_t alignment() {
-    if (device_.type == DeviceType::CPU) {
-      return 16;
-    } else if (device_.type == DeviceType::GPU) {
-      return 256;
+  bool uses_huge_pages(size_t size) {
+    return !pinned_ && huge_pages_ != MemoryPoolConfig::HUGE_PAGES_NONE &&
+           size >= HUGE_PAGE_SIZE;
+  }
+
+  static size_t huge_page_length(size_t size) {
+    return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  }
+
+  // Maps size bytes rounded up to whole huge pages. Explicit huge pages come
+  // from the hugetlbfs reservation; otherwise, or once that is exhausted, we
+  // ask for transparent huge pages on a normal anonymous mapping.
+  u8* map_huge_pages(size_t size) {
+    size_t length = huge_page_length(size);
+    void* buffer = MAP_FAILED;
+    if (huge_pages_ == MemoryPoolConfig::HUGE_PAGES_EXPLICIT) {
+      buffer = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      LOG_IF(WARNING, buffer == MAP_FAILED && !warned_hugetlb_.exchange(true))
+          << "Explicit huge page allocation of " << length
+          << " bytes failed (" << strerror(errno)
+          << "), falling back to transparent huge pages";
+    }
+    if (buffer == MAP_FAILED) {
+      buffer = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (buffer == MAP_FAILED) {
+        throw std::bad_alloc();
+      }
+      madvise(buffer, length, MADV_HUGEPAGE);
     }
+    return (u8*)buffer;
+  }
+
+  // Sits in the HEADER_SIZE bytes in front of each CPU allocation. Keeping
+  // it a full alignment unit keeps the returned buffer aligned.
+  struct AllocationHeader {
+    u64 size;
+    u64 magic;
+  };
+  static const size_t HEADER_SIZE = 16;
+  static const u64 HEADER_MAGIC = 0x5343414e4e455221ULL;
+  static_assert(sizeof(AllocationHeader) <= HEADER_SIZE,
+                "Allocation header must fit in one alignment unit");
+
+  static AllocationHeader* header_of(u8* buffer) {
+    return (AllocationHeader*)(buffer - HEADER_SIZE);
+  }
+
+  // GPU memory cannot hold a header, so sizes of GPU allocations live in maps
+  // sharded by address to keep concurrent frees from serializing
+  static const i32 NUM_SIZE_SHARDS = 16;
+  struct SizeShard {
+    std::mutex lock;
+    std::unordered_map<u8*, size_t> sizes;
+  };
+
+  SizeShard& shard_for(u8* buffer) {
+    // GPU allocations are at least 256 byte aligned
+    return size_shards_[((uintptr_t)buffer >> 8) % NUM_SIZE_SHARDS];
   }
 
- private:
   DeviceHandle device_;
   bool pinned_;
+  MemoryPoolConfig::HugePages huge_pages_;
+  std::atomic<bool> warned_hugetlb_{false};
+  SizeShard size_shards_[NUM_SIZE_SHARDS];
 };
 
 bool pointer_in_buffer(u8* ptr, u8* buf_start, u8* buf_end) {
   return (size_t)ptr >= (size_t)buf_start && (size_t)ptr < (size_t)buf_end;
 }
 
+// The pool allocator is a two-level segregated fit (TLSF) allocator. Free
+// blocks are binned by size into FL_COUNT power-of-two classes, each split
+// into SL_COUNT linear subclasses, and a bitmap per level records which bins
+// are non-empty. Finding a fitting block is then two find-first-set
+// operations, and freeing merges with the physical neighbours through
+// explicit links, so both are O(1) regardless of how many allocations are
+// live. Block descriptors are kept out of band because the pool may live in
+// GPU memory.
 class PoolAllocator : public Allocator {
  public:
   PoolAllocator(DeviceHandle device, SystemAllocator* allocator,
                 size_t pool_size)
     : device_(device), system_allocator(allocator), pool_size_(pool_size) {
     pool_ = system_allocator->allocate(pool_size_);
+
+    fl_bitmap_ = 0;
+    for (i32 i = 0; i < FL_COUNT; ++i) {
+      sl_bitmap_[i] = 0;
+      for (i32 j = 0; j < SL_COUNT; ++j) {
+        free_lists_[i][j] = nullptr;
+      }
+    }
+
+    Block* block = new Block;
+    block->offset = 0;
+    block->size = pool_size_ - (pool_size_ % system_allocator->alignment());
+    block->free = true;
+    block->prev_phys = nullptr;
+    block->next_phys = nullptr;
+    insert_free_block(block);
+    free_bytes_ = block->size;
   }
 
   ~PoolAllocator() {
+    Block* block = first_block();
+    while (block != nullptr) {
+      Block* next = block->next_phys;
+      delete block;
+      block = next;
+    }
     system_allocator->free(pool_);
   }
 
   u8* allocate(size_t size) {
-    Allocation alloc;
-    alloc.length = size;
+    size = align(std::max(size, (size_t)1));
 
     std::lock_guard<std::mutex> guard(lock_);
-    bool found = false;
-    i32 num_alloc = allocations_.size();
-    for (i32 i = 0; i < num_alloc; ++i) {
-      Allocation lower;
-      if (i == 0) {
-        lower.offset = 0;
-        lower.length = 0;
-      } else {
-        lower = allocations_[i - 1];
-      }
-      Allocation higher = allocations_[i];
-      assert(higher.offset >= lower.offset + lower.length);
-      size_t base = align(lower.offset + lower.length);
-      if ((higher.offset - base) >= size) {
-        alloc.offset = base;
-        allocations_.insert(allocations_.begin() + i, alloc);
-        found = true;
-        break;
-      }
-    }
-
-    if (!found) {
-      if (num_alloc > 0) {
-        Allocation& last = allocations_[num_alloc - 1];
-        alloc.offset = align(last.offset + last.length);
-      } else {
-        alloc.offset = 0;
-      }
-      allocations_.push_back(alloc);
-    }
-
-    LOG_IF(FATAL, alloc.offset + alloc.length >= pool_size_)
-        << "Exceeded pool size";
-
-    u8* buffer = pool_ + alloc.offset;
-    return buffer;
+    Block* block = find_free_block(size);
+    LOG_IF(FATAL, block == nullptr)
+        << "Exceeded pool size: requested " << size << " bytes with "
+        << free_bytes_ << " bytes free, largest free block "
+        << largest_free_block() << " bytes";
+    remove_free_block(block);
+    split_block(block, size);
+    block->free = false;
+    used_blocks_[block->offset] = block;
+
+    counters_.allocated(block->size);
+    used_bytes_ += block->size;
+    free_bytes_ -= block->size;
+    high_water_bytes_ = std::max(high_water_bytes_, used_bytes_);
+    num_allocations_++;
+
+    return pool_ + block->offset;
   }
 
   size_t align(size_t ptr) {
@@ -214,112 +384,344 @@ class PoolAllocator : public Allocator {
         << "Pool allocator tried to free buffer not in pool";
 
     std::lock_guard<std::mutex> guard(lock_);
-    i32 index;
-    bool found = find_buffer(buffer, index);
-    LOG_IF(FATAL, !found) << "Attempted to free unallocated buffer in pool";
+    auto it = used_blocks_.find((size_t)(buffer - pool_));
+    LOG_IF(FATAL, it == used_blocks_.end())
+        << "Attempted to free unallocated buffer in pool";
+    Block* block = it->second;
+    used_blocks_.erase(it);
+
+    counters_.freed(block->size);
+    used_bytes_ -= block->size;
+    free_bytes_ += block->size;
+    num_allocations_--;
+
+    block->free = true;
+    Block* prev = block->prev_phys;
+    if (prev != nullptr && prev->free) {
+      remove_free_block(prev);
+      block = merge_blocks(prev, block);
+    }
+    Block* next = block->next_phys;
+    if (next != nullptr && next->free) {
+      remove_free_block(next);
+      block = merge_blocks(block, next);
+    }
+    insert_free_block(block);
+  }
+
+  //! Writes to every page of a CPU pool so the kernel backs the whole pool
+  //! now instead of on first touch in the decode and kernel loops. Large
+  //! pools take seconds to fault in, so the work is split across all cores.
+  void prefault() {
+    assert(device_.type == DeviceType::CPU);
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    i32 num_threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t pages = (pool_size_ + page_size - 1) / page_size;
+    size_t pages_per_thread = (pages + num_threads - 1) / num_threads;
+    std::vector<std::thread> threads;
+    for (i32 t = 0; t < num_threads; ++t) {
+      threads.emplace_back([=]() {
+        size_t end = std::min(pages, (t + 1) * pages_per_thread);
+        for (size_t p = t * pages_per_thread; p < end; ++p) {
+          pool_[p * page_size] = 0;
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
 
-    Allocation& alloc = allocations_[index];
-    allocations_.erase(allocations_.begin() + index);
+  MemoryPoolStats stats() {
+    std::lock_guard<std::mutex> guard(lock_);
+    MemoryPoolStats stats;
+    stats.pool_size = pool_size_;
+    stats.used_bytes = used_bytes_;
+    stats.free_bytes = free_bytes_;
+    stats.largest_free_block = largest_free_block();
+    stats.high_water_bytes = high_water_bytes_;
+    stats.num_allocations = num_allocations_;
+    stats.fragmentation =
+        free_bytes_ == 0
+            ? 0.0
+            : 1.0 - (f64)stats.largest_free_block / (f64)free_bytes_;
+    return stats;
   }
 
  private:
-  bool find_buffer(u8* buffer, i32& index) {
-    i32 num_alloc = allocations_.size();
-    for (i32 i = 0; i < num_alloc; ++i) {
-      Allocation alloc = allocations_[i];
-      if ((size_t)buffer == (size_t)pool_ + alloc.offset) {
-        index = i;
-        return true;
+  // Each power-of-two size class is split into 2^SL_LOG2 linear bins
+  static const i32 SL_LOG2 = 4;
+  static const i32 SL_COUNT = 1 << SL_LOG2;
+  static const i32 FL_COUNT = 64;
+
+  struct Block {
+    size_t offset;
+    size_t size;
+    bool free;
+    Block* prev_phys;
+    Block* next_phys;
+    Block* prev_free;
+    Block* next_free;
+  };
+
+  static i32 fls(u64 word) { return 63 - __builtin_clzll(word); }
+
+  static i32 ffs(u64 word) { return __builtin_ctzll(word); }
+
+  // Bins are indexed by the highest set bit (fl) and the next SL_LOG2 bits
+  // (sl) of the size. Sizes are at least the alignment, which is >= 16, so
+  // fl >= SL_LOG2 always holds.
+  static void mapping_insert(size_t size, i32& fl, i32& sl) {
+    fl = fls(size);
+    sl = (i32)((size >> (fl - SL_LOG2)) ^ (1 << SL_LOG2));
+  }
+
+  // Rounds size up to the next bin boundary so that any block in the
+  // resulting bin (or above) is large enough.
+  static void mapping_search(size_t size, i32& fl, i32& sl) {
+    size_t round = ((size_t)1 << (fls(size) - SL_LOG2)) - 1;
+    mapping_insert(size + round, fl, sl);
+  }
+
+  void insert_free_block(Block* block) {
+    i32 fl, sl;
+    mapping_insert(block->size, fl, sl);
+    Block* head = free_lists_[fl][sl];
+    block->prev_free = nullptr;
+    block->next_free = head;
+    if (head != nullptr) {
+      head->prev_free = block;
+    }
+    free_lists_[fl][sl] = block;
+    fl_bitmap_ |= (u64)1 << fl;
+    sl_bitmap_[fl] |= (u32)1 << sl;
+  }
+
+  void remove_free_block(Block* block) {
+    i32 fl, sl;
+    mapping_insert(block->size, fl, sl);
+    if (block->prev_free != nullptr) {
+      block->prev_free->next_free = block->next_free;
+    } else {
+      free_lists_[fl][sl] = block->next_free;
+    }
+    if (block->next_free != nullptr) {
+      block->next_free->prev_free = block->prev_free;
+    }
+    if (free_lists_[fl][sl] == nullptr) {
+      sl_bitmap_[fl] &= ~((u32)1 << sl);
+      if (sl_bitmap_[fl] == 0) {
+        fl_bitmap_ &= ~((u64)1 << fl);
       }
     }
-    return false;
   }
 
-  typedef struct {
-    size_t offset;
-    size_t length;
-  } Allocation;
+  Block* find_free_block(size_t size) {
+    i32 fl, sl;
+    mapping_search(size, fl, sl);
+    if (fl >= FL_COUNT) {
+      return nullptr;
+    }
+    u32 sl_map = sl_bitmap_[fl] & (~(u32)0 << sl);
+    if (sl_map == 0) {
+      u64 fl_map = fl + 1 < FL_COUNT ? fl_bitmap_ & (~(u64)0 << (fl + 1)) : 0;
+      if (fl_map == 0) {
+        return nullptr;
+      }
+      fl = ffs(fl_map);
+      sl_map = sl_bitmap_[fl];
+    }
+    sl = ffs(sl_map);
+    return free_lists_[fl][sl];
+  }
+
+  // Carves the tail of block off into a new free block if the remainder is
+  // large enough to be useful.
+  void split_block(Block* block, size_t size) {
+    size_t remaining = block->size - size;
+    if (remaining < system_allocator->alignment()) {
+      return;
+    }
+    Block* rest = new Block;
+    rest->offset = block->offset + size;
+    rest->size = remaining;
+    rest->free = true;
+    rest->prev_phys = block;
+    rest->next_phys = block->next_phys;
+    if (rest->next_phys != nullptr) {
+      rest->next_phys->prev_phys = rest;
+    }
+    block->next_phys = rest;
+    block->size = size;
+    insert_free_block(rest);
+  }
+
+  Block* merge_blocks(Block* left, Block* right) {
+    left->size += right->size;
+    left->next_phys = right->next_phys;
+    if (left->next_phys != nullptr) {
+      left->next_phys->prev_phys = left;
+    }
+    delete right;
+    return left;
+  }
+
+  // The largest free block lives in the highest non-empty first level bin.
+  // Only that bin's list has to be scanned, which is only done for stats and
+  // error reporting.
+  size_t largest_free_block() {
+    if (fl_bitmap_ == 0) {
+      return 0;
+    }
+    i32 fl = fls(fl_bitmap_);
+    i32 sl = fls(sl_bitmap_[fl]);
+    size_t largest = 0;
+    for (Block* b = free_lists_[fl][sl]; b != nullptr; b = b->next_free) {
+      largest = std::max(largest, b->size);
+    }
+    return largest;
+  }
+
+  Block* first_block() {
+    Block* block = nullptr;
+    if (!used_blocks_.empty()) {
+      block = used_blocks_.begin()->second;
+    } else if (fl_bitmap_ != 0) {
+      i32 fl = ffs(fl_bitmap_);
+      block = free_lists_[fl][ffs(sl_bitmap_[fl])];
+    }
+    while (block != nullptr && block->prev_phys != nullptr) {
+      block = block->prev_phys;
+    }
+    return block;
+  }
 
   DeviceHandle device_;
   u8* pool_ = nullptr;
   size_t pool_size_;
   std::mutex lock_;
-  std::vector<Allocation> allocations_;
+  u64 fl_bitmap_;
+  u32 sl_bitmap_[FL_COUNT];
+  Block* free_lists_[FL_COUNT][SL_COUNT];
+  std::unordered_map<size_t, Block*> used_blocks_;
+
+  size_t used_bytes_ = 0;
+  size_t free_bytes_ = 0;
+  size_t high_water_bytes_ = 0;
+  i64 num_allocations_ = 0;
 
   SystemAllocator* system_allocator;
 };
 
+// Block lookups happen on every add_buffer_ref/delete_buffer, so the block
+// allocator keeps an address-ordered index (start address -> block) instead of
+// scanning every live block. The index is striped across shards by address so
+// that pipeline instances freeing different blocks take different locks. A
+// block is registered in every shard whose address stripe it overlaps, which
+// guarantees that the greatest start <= ptr in the shard for ptr is the block
+// containing ptr, if any. Reference counts are atomic, so add_ref and
+// non-final frees only ever take a shared lock.
+//
+// Decoders and kernels allocate blocks of the same few shapes over and over,
+// e.g. one batch of decoded frames per work item. When the blocks come
+// straight from the system allocator, the BlockAllocator keeps up to
+// cache_size bytes of freed blocks and hands them back to allocations of
+// exactly the same size, which skips new/cudaMalloc and the page faults on
+// fresh memory. A pool allocator is already O(1), so nothing is cached in
+// front of one and the cache never eats into the pool.
 class BlockAllocator {
  public:
-  BlockAllocator(Allocator* allocator) : allocator_(allocator) {}
+  BlockAllocator(Allocator* allocator, size_t cache_size = 0)
+    : allocator_(allocator), cache_size_(cache_size) {}
 
   ~BlockAllocator() {
-    std::lock_guard<std::mutex> guard(lock_);
-
-    for (Allocation& alloc : allocations_) {
-      assert(alloc.refs > 0);
-      allocator_->free(alloc.buffer);
+    std::set<Block*> blocks;
+    for (Shard& shard : shards_) {
+      std::unique_lock<std::shared_timed_mutex> guard(shard.lock);
+      for (auto& kv : shard.blocks) {
+        blocks.insert(kv.second);
+      }
+      shard.blocks.clear();
+    }
+    for (Block* block : blocks) {
+      assert(block->refs > 0);
+      release_block(block);
+    }
+    for (auto& kv : cache_) {
+      for (Block* block : kv.second) {
+        release_block(block);
+      }
     }
   }
 
   u8* allocate(size_t size, i32 refs) {
-    u8* buffer = allocator_->allocate(size);
-
-    Allocation alloc;
-    alloc.buffer = buffer;
-    alloc.size = size;
-    alloc.refs = refs;
-
-    std::lock_guard<std::mutex> guard(lock_);
-    allocations_.push_back(alloc);
-
-    return buffer;
+    Block* block = take_cached_block(size);
+    if (block == nullptr) {
+      block = new Block;
+      block->buffer = allocator_->allocate(size);
+      block->size = size;
+    }
+    block->refs = refs;
+    register_block(block);
+    return block->buffer;
   }
 
   void add_ref(u8* buffer) {
-    std::lock_guard<std::mutex> guard(lock_);
-
-    i32 index;
-    bool found = find_buffer(buffer, index);
+    bool found = try_add_ref(buffer);
     LOG_IF(FATAL, !found)
         << "Block allocator tried to add ref to non-block buffer";
+  }
 
-    Allocation& alloc = allocations_[index];
-    alloc.refs += 1;
+  //! Adds a reference to the block containing buffer. Returns false without
+  //! doing anything if buffer is not in a block.
+  bool try_add_ref(u8* buffer) {
+    Block* block = find_block(buffer);
+    if (block == nullptr) {
+      return false;
+    }
+    block->refs += 1;
+    return true;
   }
 
   void free(u8* buffer) {
-    std::lock_guard<std::mutex> guard(lock_);
-
-    i32 index;
-    bool found = find_buffer(buffer, index);
+    bool found = try_free(buffer);
     LOG_IF(FATAL, !found) << "Block allocator freed non-block buffer";
+  }
 
-    Allocation& alloc = allocations_[index];
-    assert(alloc.refs > 0);
-    alloc.refs -= 1;
+  //! Drops a reference to the block containing buffer. Returns false without
+  //! doing anything if buffer is not in a block.
+  bool try_free(u8* buffer) {
+    Block* block = find_block(buffer);
+    if (block == nullptr) {
+      return false;
+    }
 
-    if (alloc.refs == 0) {
-      allocator_->free(alloc.buffer);
-      allocations_.erase(allocations_.begin() + index);
-      return;
+    i32 prev_refs = block->refs.fetch_sub(1);
+    assert(prev_refs > 0);
+    if (prev_refs == 1) {
+      for_each_shard(block, [block](Shard& shard) {
+        std::unique_lock<std::shared_timed_mutex> guard(shard.lock);
+        shard.blocks.erase((size_t)block->buffer);
+      });
+      counters_.freed(block->size);
+      if (!cache_block(block)) {
+        release_block(block);
+      }
     }
+    return true;
   }
 
   bool buffers_in_same_block(std::vector<u8*> buffers) {
     assert(buffers.size() > 0);
 
-    std::lock_guard<std::mutex> guard(lock_);
-    i32 base_index;
-    bool found = find_buffer(buffers[0], base_index);
-    if (!found) {
+    Block* block = find_block(buffers[0]);
+    if (block == nullptr) {
       return false;
     }
 
+    u8* block_end = block->buffer + block->size;
     for (i32 i = 1; i < buffers.size(); ++i) {
-      i32 index;
-      found = find_buffer(buffers[i], index);
-      if (!found || base_index != index) {
+      if (!pointer_in_buffer(buffers[i], block->buffer, block_end)) {
         return false;
       }
     }
@@ -328,35 +730,148 @@ class BlockAllocator {
   }
 
   bool buffer_in_block(u8* buffer) {
-    std::lock_guard<std::mutex> guard(lock_);
-    i32 index;
-    return find_buffer(buffer, index);
+    return find_block(buffer) != nullptr;
   }
 
+  const AllocatorCounters& counters() const { return counters_; }
+
  private:
-  bool find_buffer(u8* buffer, i32& index) {
-    i32 num_alloc = allocations_.size();
-    for (i32 i = 0; i < num_alloc; ++i) {
-      Allocation alloc = allocations_[i];
-      if (pointer_in_buffer(buffer, alloc.buffer, alloc.buffer + alloc.size)) {
-        index = i;
-        return true;
+  struct Block {
+    u8* buffer;
+    size_t size;
+    std::atomic<i32> refs;
+  };
+
+  struct Shard {
+    std::shared_timed_mutex lock;
+    std::map<size_t, Block*> blocks;
+  };
+
+  static const i32 NUM_SHARDS = 16;
+  // Address stripes are 16MB, about the size of a batch of decoded frames
+  static const i32 STRIPE_SHIFT = 24;
+
+  static size_t stripe_of(size_t address) { return address >> STRIPE_SHIFT; }
+
+  Shard& shard_for(size_t address) {
+    return shards_[stripe_of(address) % NUM_SHARDS];
+  }
+
+  template <typename F>
+  void for_each_shard(Block* block, F f) {
+    size_t first = stripe_of((size_t)block->buffer);
+    size_t last = stripe_of((size_t)block->buffer + block->size - 1);
+    size_t num_stripes = std::min(last - first + 1, (size_t)NUM_SHARDS);
+    for (size_t i = 0; i < num_stripes; ++i) {
+      f(shards_[(first + i) % NUM_SHARDS]);
+    }
+  }
+
+  void register_block(Block* block) {
+    counters_.allocated(block->size);
+
+    for_each_shard(block, [block](Shard& shard) {
+      std::unique_lock<std::shared_timed_mutex> guard(shard.lock);
+      shard.blocks[(size_t)block->buffer] = block;
+    });
+  }
+
+  void release_block(Block* block) {
+    allocator_->free(block->buffer);
+    delete block;
+  }
+
+  Block* take_cached_block(size_t size) {
+    if (cache_size_ == 0) {
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> guard(cache_lock_);
+    auto it = cache_.find(size);
+    if (it == cache_.end() || it->second.empty()) {
+      return nullptr;
+    }
+    Block* block = it->second.back();
+    it->second.pop_back();
+    cached_bytes_ -= size;
+    return block;
+  }
+
+  // Keeps a freed block for reuse. Returns false if the caller should
+  // release it instead.
+  bool cache_block(Block* block) {
+    if (block->size > cache_size_) {
+      return false;
+    }
+    std::vector<Block*> evicted;
+    bool cached = true;
+    {
+      std::lock_guard<std::mutex> guard(cache_lock_);
+      if (cached_bytes_ + block->size > cache_size_) {
+        // The cache is full of other shapes, most likely left over from an
+        // earlier job or table, so start over with the shape in use now
+        for (auto& kv : cache_) {
+          if (kv.first == block->size) {
+            continue;
+          }
+          cached_bytes_ -= kv.first * kv.second.size();
+          evicted.insert(evicted.end(), kv.second.begin(), kv.second.end());
+          kv.second.clear();
+        }
+        cached = cached_bytes_ + block->size <= cache_size_;
+      }
+      if (cached) {
+        cache_[block->size].push_back(block);
+        cached_bytes_ += block->size;
       }
     }
-    return false;
+    for (Block* evicted_block : evicted) {
+      release_block(evicted_block);
+    }
+    return cached;
   }
 
-  typedef struct {
-    u8* buffer;
-    size_t size;
-    i32 refs;
-  } Allocation;
+  Block* find_block(u8* buffer) {
+    size_t address = (size_t)buffer;
+    Shard& shard = shard_for(address);
+    std::shared_lock<std::shared_timed_mutex> guard(shard.lock);
+    auto it = shard.blocks.upper_bound(address);
+    if (it == shard.blocks.begin()) {
+      return nullptr;
+    }
+    --it;
+    Block* block = it->second;
+    if (!pointer_in_buffer(buffer, block->buffer,
+                           block->buffer + block->size)) {
+      return nullptr;
+    }
+    return block;
+  }
 
-  std::mutex lock_;
-  std::vector<Allocation> allocations_;
+  Shard shards_[NUM_SHARDS];
   Allocator* allocator_;
+  AllocatorCounters counters_;
+
+  // Freed blocks by size, most recently freed last
+  size_t cache_size_;
+  std::mutex cache_lock_;
+  std::unordered_map<size_t, std::vector<Block*>> cache_;
+  size_t cached_bytes_ = 0;
 };
 
+// Bytes of freed blocks each device keeps for reuse when it has no pool and
+// the config leaves block_cache_size unset
+const size_t CPU_BLOCK_CACHE_SIZE = 512 * 1024 * 1024;
+const size_t GPU_BLOCK_CACHE_SIZE = 256 * 1024 * 1024;
+
+size_t block_cache_size(const MemoryPoolConfig::Pool& config,
+                        size_t default_size) {
+  if (config.use_pool() || config.block_cache_size() < 0) {
+    return 0;
+  }
+  return config.block_cache_size() == 0 ? default_size
+                                        : config.block_cache_size();
+}
+
 static SystemAllocator* cpu_system_allocator = nullptr;
 static std::map<i32, SystemAllocator*> gpu_system_allocators;
 static PoolAllocator* cpu_pool_allocator = nullptr;
@@ -366,7 +881,8 @@ static std::map<i32, BlockAllocator*> gpu_block_allocators;
 
 void init_memory_allocators(MemoryPoolConfig config,
                             std::vector<i32> gpu_device_ids) {
-  cpu_system_allocator = new SystemAllocator(CPU_DEVICE, config.pinned_cpu());
+  cpu_system_allocator = new SystemAllocator(CPU_DEVICE, config.pinned_cpu(),
+                                             config.cpu_huge_pages());
   Allocator* cpu_block_allocator_base = cpu_system_allocator;
   if (config.cpu().use_pool()) {
     struct sysinfo info;
@@ -379,9 +895,14 @@ void init_memory_allocators(MemoryPoolConfig config,
     cpu_pool_allocator =
         new PoolAllocator(CPU_DEVICE, cpu_system_allocator,
                           total_mem - config.cpu().free_space());
+    if (config.prefault_cpu_pool()) {
+      cpu_pool_allocator->prefault();
+    }
     cpu_block_allocator_base = cpu_pool_allocator;
   }
-  cpu_block_allocator = new BlockAllocator(cpu_block_allocator_base);
+  cpu_block_allocator = new BlockAllocator(
+      cpu_block_allocator_base,
+      block_cache_size(config.cpu(), CPU_BLOCK_CACHE_SIZE));
 
 #ifdef HAVE_CUDA
   for (i32 device_id : gpu_device_ids) {
@@ -401,19 +922,22 @@ void init_memory_allocators(MemoryPoolConfig config,
           device, gpu_system_allocator, total_mem - config.gpu().free_space());
       gpu_block_allocator_base = gpu_pool_allocators[device.id];
     }
-    gpu_block_allocators[device.id] =
-        new BlockAllocator(gpu_block_allocator_base);
+    gpu_block_allocators[device.id] = new BlockAllocator(
+        gpu_block_allocator_base,
+        block_cache_size(config.gpu(), GPU_BLOCK_CACHE_SIZE));
   }
 #endif
 }
 
 void destroy_memory_allocators() {
   delete cpu_block_allocator;
+  cpu_block_allocator = nullptr;
   if (cpu_pool_allocator) {
     delete cpu_pool_allocator;
     cpu_pool_allocator = nullptr;
   }
   delete cpu_system_allocator;
+  cpu_system_allocator = nullptr;
 
 #ifdef HAVE_CUDA
   for (auto entry : gpu_block_allocators) {
@@ -453,6 +977,50 @@ BlockAllocator* block_allocator_for_device(DeviceHandle device) {
   }
 }
 
+bool memory_pool_stats(DeviceHandle device, MemoryPoolStats& stats) {
+  PoolAllocator* allocator = nullptr;
+  if (device.type == DeviceType::CPU) {
+    allocator = cpu_pool_allocator;
+  } else if (device.type == DeviceType::GPU) {
+    auto it = gpu_pool_allocators.find(device.id);
+    if (it != gpu_pool_allocators.end()) {
+      allocator = it->second;
+    }
+  }
+  if (allocator == nullptr) {
+    return false;
+  }
+  stats = allocator->stats();
+  return true;
+}
+
+std::vector<AllocatorStats> memory_allocator_stats() {
+  std::vector<AllocatorStats> stats;
+  if (cpu_system_allocator != nullptr) {
+    stats.push_back(
+        cpu_system_allocator->counters().stats(CPU_DEVICE, "system"));
+  }
+  if (cpu_pool_allocator != nullptr) {
+    stats.push_back(cpu_pool_allocator->counters().stats(CPU_DEVICE, "pool"));
+  }
+  if (cpu_block_allocator != nullptr) {
+    stats.push_back(cpu_block_allocator->counters().stats(CPU_DEVICE, "block"));
+  }
+  for (auto& kv : gpu_system_allocators) {
+    DeviceHandle device = {DeviceType::GPU, kv.first};
+    stats.push_back(kv.second->counters().stats(device, "system"));
+  }
+  for (auto& kv : gpu_pool_allocators) {
+    DeviceHandle device = {DeviceType::GPU, kv.first};
+    stats.push_back(kv.second->counters().stats(device, "pool"));
+  }
+  for (auto& kv : gpu_block_allocators) {
+    DeviceHandle device = {DeviceType::GPU, kv.first};
+    stats.push_back(kv.second->counters().stats(device, "block"));
+  }
+  return stats;
+}
+
 u8* new_buffer(DeviceHandle device, size_t size) {
   assert(size > 0);
   SystemAllocator* allocator = system_allocator_for_device(device);
@@ -471,12 +1039,16 @@ void add_buffer_ref(DeviceHandle device, u8* buffer) {
   block_allocator->add_ref(buffer);
 }
 
+bool try_add_buffer_ref(DeviceHandle device, u8* buffer) {
+  assert(buffer != nullptr);
+  BlockAllocator* block_allocator = block_allocator_for_device(device);
+  return block_allocator->try_add_ref(buffer);
+}
+
 void delete_buffer(DeviceHandle device, u8* buffer) {
   assert(buffer != nullptr);
   BlockAllocator* block_allocator = block_allocator_for_device(device);
-  if (block_allocator->buffer_in_block(buffer)) {
-    block_allocator->free(buffer);
-  } else {
+  if (!block_allocator->try_free(buffer)) {
     SystemAllocator* system_allocator = system_allocator_for_device(device);
     system_allocator->free(buffer);
   }
@@ -23,17 +23,51 @@ namespace scanner {
 
 static const i64 DEFAULT_POOL_SIZE = 2L * 1024L * 1024L * 1024L;
 
+//! Occupancy statistics for a device memory pool.
+struct MemoryPoolStats {
+  size_t pool_size;
+  size_t used_bytes;
+  size_t free_bytes;
+  size_t largest_free_block;
+  size_t high_water_bytes;  //!< Peak used_bytes since the pool was created.
+  i64 num_allocations;      //!< Live allocations in the pool.
+  f64 fragmentation;        //!< 1 - largest_free_block / free_bytes.
+};
+
+//! Usage counters for one allocator on one device. Block allocations are
+//! carved out of the pool allocator (or the system allocator when there is no
+//! pool), so their bytes also show up in that allocator's counters.
+struct AllocatorStats {
+  DeviceHandle device;
+  std::string allocator;  //!< "system", "pool" or "block".
+  i64 live_bytes;
+  i64 peak_bytes;
+  i64 num_allocations;  //!< Allocations made since initialization.
+};
+
 void init_memory_allocators(MemoryPoolConfig config,
                             std::vector<i32> gpu_device_ids);
 
 void destroy_memory_allocators();
 
+//! Fills stats for the memory pool of device. Returns false if the device is
+//! not using a memory pool.
+bool memory_pool_stats(DeviceHandle device, MemoryPoolStats& stats);
+
+//! Snapshot of the usage counters of every initialized allocator.
+std::vector<AllocatorStats> memory_allocator_stats();
+
 u8* new_buffer(DeviceHandle device, size_t size);
 
 u8* new_block_buffer(DeviceHandle device, size_t size, i32 refs);
 
 void add_buffer_ref(DeviceHandle device, u8* buffer);
 
+//! Adds a reference to buffer if it is in a block, so it takes one more
+//! delete_buffer call to free it. Returns false for buffers from new_buffer,
+//! which have no reference count.
+bool try_add_buffer_ref(DeviceHandle device, u8* buffer);
+
 void delete_buffer(DeviceHandle device, u8* buffer);
 
 void memcpy_buffer(u8* dest_buffer, DeviceHandle dest_device,
@@ -0,0 +1,125 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures decoded frame throughput through the CPU block allocator with and
+// without huge pages. Each thread plays a decoder and a kernel: it allocates
+// a block of 1080p RGB frames, writes every byte, reads them back and frees
+// them, which is the allocation pattern of PreEvaluateWorker.
+//
+// Usage: MemoryBenchmark [frames per thread] [threads] [pool MB]
+
+#include "scanner/util/common.h"
+#include "scanner/util/memory.h"
+#include "scanner/util/util.h"
+
+#include <sys/sysinfo.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace scanner;
+
+namespace {
+
+const size_t FRAME_SIZE = 1920 * 1080 * 3;
+const i32 FRAMES_PER_BLOCK = 8;
+
+struct BenchmarkConfig {
+  const char* name;
+  bool use_pool;
+  MemoryPoolConfig::HugePages huge_pages;
+  bool prefault;
+};
+
+f64 run(const BenchmarkConfig& bench, i64 frames_per_thread, i32 num_threads,
+        size_t pool_size) {
+  MemoryPoolConfig config;
+  config.set_cpu_huge_pages(bench.huge_pages);
+  config.set_prefault_cpu_pool(bench.prefault);
+  if (bench.use_pool) {
+    struct sysinfo info;
+    sysinfo(&info);
+    config.mutable_cpu()->set_use_pool(true);
+    config.mutable_cpu()->set_free_space(info.totalram - pool_size);
+  }
+  auto init_start = now();
+  init_memory_allocators(config, {});
+  f64 init_seconds = nano_since(init_start) / 1e9;
+
+  auto start = now();
+  std::vector<std::thread> threads;
+  std::vector<u64> checksums(num_threads);
+  for (i32 t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      u64 sum = 0;
+      for (i64 f = 0; f < frames_per_thread; f += FRAMES_PER_BLOCK) {
+        u8* block = new_block_buffer(
+            CPU_DEVICE, FRAMES_PER_BLOCK * FRAME_SIZE, FRAMES_PER_BLOCK);
+        for (i32 i = 0; i < FRAMES_PER_BLOCK; ++i) {
+          u8* frame = block + i * FRAME_SIZE;
+          // Decode
+          memset(frame, (u8)(f + i), FRAME_SIZE);
+          // Kernel: touch one byte per cache line
+          for (size_t b = 0; b < FRAME_SIZE; b += 64) {
+            sum += frame[b];
+          }
+        }
+        for (i32 i = 0; i < FRAMES_PER_BLOCK; ++i) {
+          delete_buffer(CPU_DEVICE, block + i * FRAME_SIZE);
+        }
+      }
+      checksums[t] = sum;
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  f64 seconds = nano_since(start) / 1e9;
+  destroy_memory_allocators();
+
+  if (init_seconds > 0.01) {
+    printf("  (%s: init took %.2fs)\n", bench.name, init_seconds);
+  }
+  return num_threads * frames_per_thread / seconds;
+}
+}
+
+int main(int argc, char** argv) {
+  i64 frames_per_thread = argc > 1 ? std::atol(argv[1]) : 2000;
+  i32 num_threads = argc > 2 ? std::atoi(argv[2]) : 4;
+  size_t pool_size = (argc > 3 ? std::atol(argv[3]) : 2048) * 1024 * 1024;
+
+  std::vector<BenchmarkConfig> configs = {
+      {"system", false, MemoryPoolConfig::HUGE_PAGES_NONE, false},
+      {"system+thp", false, MemoryPoolConfig::HUGE_PAGES_TRANSPARENT, false},
+      {"pool", true, MemoryPoolConfig::HUGE_PAGES_NONE, false},
+      {"pool+prefault", true, MemoryPoolConfig::HUGE_PAGES_NONE, true},
+      {"pool+thp+prefault", true, MemoryPoolConfig::HUGE_PAGES_TRANSPARENT,
+       true},
+      {"pool+hugetlb+prefault", true, MemoryPoolConfig::HUGE_PAGES_EXPLICIT,
+       true},
+  };
+  std::vector<f64> results;
+  for (const BenchmarkConfig& config : configs) {
+    results.push_back(run(config, frames_per_thread, num_threads, pool_size));
+  }
+  printf("%24s %14s %8s\n", "config", "frames/s", "speedup");
+  for (size_t i = 0; i < configs.size(); ++i) {
+    printf("%24s %14.0f %7.2fx\n", configs[i].name, results[i],
+           results[i] / results[0]);
+  }
+  return 0;
+}
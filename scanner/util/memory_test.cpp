@@ -0,0 +1,276 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/memory.h"
+
+#include <gtest/gtest.h>
+
+#include <sys/sysinfo.h>
+#include <algorithm>
+#include <random>
+#include <thread>
+
+namespace scanner {
+
+TEST(BlockAllocator, InteriorPointers) {
+  MemoryPoolConfig config;
+  init_memory_allocators(config, {});
+
+  const i32 num_elements = 8;
+  const size_t element_size = 1024;
+  u8* block = new_block_buffer(CPU_DEVICE, num_elements * element_size,
+                               num_elements);
+  std::vector<u8*> dest;
+  std::vector<size_t> sizes;
+  for (i32 i = 0; i < num_elements; ++i) {
+    dest.push_back(block + i * element_size);
+    sizes.push_back(element_size);
+    memset(dest.back(), i, element_size);
+  }
+
+  // Copying out of a single block should see every element
+  u8* copy = new_block_buffer(CPU_DEVICE, num_elements * element_size,
+                              num_elements);
+  std::vector<u8*> copy_dest;
+  for (i32 i = 0; i < num_elements; ++i) {
+    copy_dest.push_back(copy + i * element_size);
+  }
+  memcpy_vec(copy_dest, CPU_DEVICE, dest, CPU_DEVICE, sizes);
+  for (i32 i = 0; i < num_elements; ++i) {
+    EXPECT_EQ(copy_dest[i][element_size - 1], i);
+  }
+
+  // Extra refs keep the block alive past the original element count
+  add_buffer_ref(CPU_DEVICE, dest[3]);
+  for (i32 i = 0; i < num_elements; ++i) {
+    delete_buffer(CPU_DEVICE, dest[i]);
+    delete_buffer(CPU_DEVICE, copy_dest[i]);
+  }
+  EXPECT_EQ(dest[3][0], 3);
+  delete_buffer(CPU_DEVICE, dest[3]);
+
+  // Non-block buffers fall through to the system allocator
+  u8* buffer = new_buffer(CPU_DEVICE, element_size);
+  delete_buffer(CPU_DEVICE, buffer);
+
+  // Only block buffers can take extra refs
+  buffer = new_buffer(CPU_DEVICE, element_size);
+  EXPECT_FALSE(try_add_buffer_ref(CPU_DEVICE, buffer));
+  delete_buffer(CPU_DEVICE, buffer);
+
+  destroy_memory_allocators();
+}
+
+TEST(BlockAllocator, ConcurrentFrees) {
+  MemoryPoolConfig config;
+  init_memory_allocators(config, {});
+
+  const i32 num_threads = 8;
+  const i32 num_iterations = 1000;
+  std::vector<std::thread> threads;
+  for (i32 t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&]() {
+      for (i32 i = 0; i < num_iterations; ++i) {
+        const i32 refs = 4;
+        u8* block = new_block_buffer(CPU_DEVICE, refs * 4096, refs);
+        for (i32 r = 0; r < refs; ++r) {
+          delete_buffer(CPU_DEVICE, block + r * 4096);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  destroy_memory_allocators();
+}
+
+TEST(BlockAllocator, RecyclesFreedBlocks) {
+  MemoryPoolConfig config;
+  init_memory_allocators(config, {});
+
+  const size_t size = 4 * 1024 * 1024;
+  u8* block = new_block_buffer(CPU_DEVICE, size, 2);
+  delete_buffer(CPU_DEVICE, block);
+  delete_buffer(CPU_DEVICE, block + size / 2);
+
+  // A block of the same size gets the freed memory back
+  u8* same = new_block_buffer(CPU_DEVICE, size, 1);
+  EXPECT_EQ(same, block);
+  // Other sizes do not
+  u8* other = new_block_buffer(CPU_DEVICE, size / 2, 1);
+  EXPECT_NE(other, block);
+
+  // Recycled blocks are tracked like fresh ones
+  add_buffer_ref(CPU_DEVICE, same);
+  delete_buffer(CPU_DEVICE, same);
+  delete_buffer(CPU_DEVICE, same);
+  delete_buffer(CPU_DEVICE, other);
+
+  destroy_memory_allocators();
+}
+
+TEST(BlockAllocator, BlockCacheSize) {
+  auto system_live_bytes = []() {
+    for (const AllocatorStats& stats : memory_allocator_stats()) {
+      if (stats.device.type == DeviceType::CPU &&
+          stats.allocator == "system") {
+        return stats.live_bytes;
+      }
+    }
+    return (i64)-1;
+  };
+
+  const size_t size = 4 * 1024 * 1024;
+  // A cache smaller than the block cannot hold it, and a disabled cache
+  // holds nothing, so freed blocks go straight back to the system
+  for (i64 cache_size : {(i64)size / 2, (i64)-1}) {
+    MemoryPoolConfig config;
+    config.mutable_cpu()->set_block_cache_size(cache_size);
+    init_memory_allocators(config, {});
+    u8* block = new_block_buffer(CPU_DEVICE, size, 1);
+    EXPECT_EQ(system_live_bytes(), size);
+    delete_buffer(CPU_DEVICE, block);
+    EXPECT_EQ(system_live_bytes(), 0);
+    destroy_memory_allocators();
+  }
+
+  // The default cache keeps it
+  MemoryPoolConfig config;
+  init_memory_allocators(config, {});
+  u8* block = new_block_buffer(CPU_DEVICE, size, 1);
+  delete_buffer(CPU_DEVICE, block);
+  EXPECT_EQ(system_live_bytes(), size);
+  destroy_memory_allocators();
+}
+
+TEST(PoolAllocator, ReusesAndCoalesces) {
+  // Leave a 64MB pool
+  const size_t pool_size = 64 * 1024 * 1024;
+  struct sysinfo info;
+  ASSERT_EQ(sysinfo(&info), 0);
+  MemoryPoolConfig config;
+  config.mutable_cpu()->set_use_pool(true);
+  config.mutable_cpu()->set_free_space(info.totalram - pool_size);
+  init_memory_allocators(config, {});
+
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<size_t> size_dist(1, 512 * 1024);
+  std::vector<u8*> buffers;
+  size_t requested = 0;
+  for (i32 i = 0; i < 64; ++i) {
+    size_t size = size_dist(gen);
+    requested += size;
+    buffers.push_back(new_block_buffer(CPU_DEVICE, size, 1));
+  }
+
+  MemoryPoolStats stats;
+  ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+  EXPECT_EQ(stats.num_allocations, 64);
+  EXPECT_GE(stats.used_bytes, requested);
+  EXPECT_EQ(stats.used_bytes + stats.free_bytes, stats.pool_size);
+
+  // Free in random order; every hole must merge back into one free block
+  std::shuffle(buffers.begin(), buffers.end(), gen);
+  for (u8* buffer : buffers) {
+    delete_buffer(CPU_DEVICE, buffer);
+  }
+  ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+  EXPECT_EQ(stats.num_allocations, 0);
+  EXPECT_EQ(stats.used_bytes, 0);
+  EXPECT_EQ(stats.largest_free_block, stats.free_bytes);
+  EXPECT_EQ(stats.fragmentation, 0.0);
+  EXPECT_GE(stats.high_water_bytes, requested);
+
+  // Half the pool is far larger than any single freed buffer, so this only
+  // fits once the holes have coalesced
+  u8* big = new_block_buffer(CPU_DEVICE, pool_size / 2, 1);
+  delete_buffer(CPU_DEVICE, big);
+
+  destroy_memory_allocators();
+}
+
+TEST(SystemAllocator, HugePages) {
+  // Without a hugetlbfs reservation explicit pages fall back to transparent
+  // ones, so both modes must work on any machine
+  for (auto mode : {MemoryPoolConfig::HUGE_PAGES_TRANSPARENT,
+                    MemoryPoolConfig::HUGE_PAGES_EXPLICIT}) {
+    MemoryPoolConfig config;
+    config.set_cpu_huge_pages(mode);
+    init_memory_allocators(config, {});
+
+    // Large enough to be mapped with huge pages, but not a multiple of them
+    const size_t size = 5 * 1024 * 1024 + 3;
+    u8* buffer = new_buffer(CPU_DEVICE, size);
+    memset(buffer, 7, size);
+    EXPECT_EQ(buffer[size - 1], 7);
+    u8* small = new_buffer(CPU_DEVICE, 64);
+    delete_buffer(CPU_DEVICE, small);
+    delete_buffer(CPU_DEVICE, buffer);
+
+    destroy_memory_allocators();
+  }
+}
+
+TEST(PoolAllocator, PrefaultedHugePagePool) {
+  const size_t pool_size = 64 * 1024 * 1024;
+  struct sysinfo info;
+  ASSERT_EQ(sysinfo(&info), 0);
+  MemoryPoolConfig config;
+  config.mutable_cpu()->set_use_pool(true);
+  config.mutable_cpu()->set_free_space(info.totalram - pool_size);
+  config.set_cpu_huge_pages(MemoryPoolConfig::HUGE_PAGES_TRANSPARENT);
+  config.set_prefault_cpu_pool(true);
+  init_memory_allocators(config, {});
+
+  u8* block = new_block_buffer(CPU_DEVICE, pool_size / 2, 1);
+  memset(block, 1, pool_size / 2);
+  delete_buffer(CPU_DEVICE, block);
+
+  destroy_memory_allocators();
+}
+
+TEST(MemoryTelemetry, CountsLiveAndPeakBytes) {
+  MemoryPoolConfig config;
+  init_memory_allocators(config, {});
+
+  auto block_stats = []() {
+    for (const AllocatorStats& stats : memory_allocator_stats()) {
+      if (stats.device.type == DeviceType::CPU && stats.allocator == "block") {
+        return stats;
+      }
+    }
+    return AllocatorStats{};
+  };
+
+  u8* a = new_block_buffer(CPU_DEVICE, 1000, 1);
+  u8* b = new_block_buffer(CPU_DEVICE, 3000, 2);
+  AllocatorStats stats = block_stats();
+  EXPECT_EQ(stats.live_bytes, 4000);
+  EXPECT_EQ(stats.peak_bytes, 4000);
+  EXPECT_EQ(stats.num_allocations, 2);
+
+  delete_buffer(CPU_DEVICE, a);
+  delete_buffer(CPU_DEVICE, b);
+  EXPECT_EQ(block_stats().live_bytes, 3000);
+  delete_buffer(CPU_DEVICE, b);
+  stats = block_stats();
+  EXPECT_EQ(stats.live_bytes, 0);
+  EXPECT_EQ(stats.peak_bytes, 4000);
+
+  destroy_memory_allocators();
+}
+}
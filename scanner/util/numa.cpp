@@ -0,0 +1,153 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/numa.h"
+
+#include <glog/logging.h>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace scanner {
+
+namespace {
+
+const char* NODE_SYSFS_PATH = "/sys/devices/system/node";
+
+// From linux/mempolicy.h, which is not always installed
+const int MPOL_PREFERRED_MODE = 1;
+
+std::vector<i32> allowed_cpus() {
+  std::vector<i32> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    LOG(WARNING) << "sched_getaffinity failed: " << strerror(errno);
+    return cpus;
+  }
+  for (i32 cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+}
+
+std::vector<NumaNode> numa_nodes() {
+  std::vector<i32> allowed = allowed_cpus();
+  std::vector<NumaNode> nodes;
+  DIR* dir = opendir(NODE_SYSFS_PATH);
+  if (dir != nullptr) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      i32 id;
+      char rest;
+      if (sscanf(entry->d_name, "node%d%c", &id, &rest) != 1) {
+        continue;
+      }
+      std::ifstream cpulist(std::string(NODE_SYSFS_PATH) + "/" +
+                            entry->d_name + "/cpulist");
+      std::string list;
+      std::getline(cpulist, list);
+      NumaNode node{id, {}};
+      for (i32 cpu : parse_cpu_list(list)) {
+        if (std::binary_search(allowed.begin(), allowed.end(), cpu)) {
+          node.cpus.push_back(cpu);
+        }
+      }
+      if (!node.cpus.empty()) {
+        nodes.push_back(node);
+      }
+    }
+    closedir(dir);
+  }
+  if (nodes.empty()) {
+    nodes.push_back(NumaNode{0, allowed});
+  }
+  std::sort(nodes.begin(), nodes.end(),
+            [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+  return nodes;
+}
+
+std::vector<i32> parse_cpu_list(const std::string& list) {
+  std::vector<i32> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    size_t dash = range.find('-');
+    i32 first = std::atoi(range.substr(0, dash).c_str());
+    i32 last = dash == std::string::npos
+                   ? first
+                   : std::atoi(range.substr(dash + 1).c_str());
+    for (i32 cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::string format_cpu_list(const std::vector<i32>& cpus) {
+  std::stringstream ss;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+      j++;
+    }
+    if (i > 0) {
+      ss << ",";
+    }
+    ss << cpus[i];
+    if (j > i) {
+      ss << "-" << cpus[j];
+    }
+    i = j + 1;
+  }
+  return ss.str();
+}
+
+bool pin_thread_to_cpus(const std::vector<i32>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (i32 cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool prefer_numa_node(i32 node) {
+  const size_t bits_per_word = sizeof(unsigned long) * 8;
+  unsigned long mask[1024 / bits_per_word] = {};
+  if (node < 0 || node >= 1024) {
+    return false;
+  }
+  mask[node / bits_per_word] = 1UL << (node % bits_per_word);
+  return syscall(SYS_set_mempolicy, MPOL_PREFERRED_MODE, mask,
+                 sizeof(mask) * 8) == 0;
+}
+}
@@ -0,0 +1,48 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+
+#include <string>
+#include <vector>
+
+namespace scanner {
+
+struct NumaNode {
+  i32 id;
+  std::vector<i32> cpus;
+};
+
+//! NUMA nodes that have at least one CPU this process is allowed to run on,
+//! ordered by node id. Falls back to a single node 0 holding every allowed
+//! CPU when the kernel exposes no node topology.
+std::vector<NumaNode> numa_nodes();
+
+//! Parses a kernel cpulist such as "0-3,8,10-11".
+std::vector<i32> parse_cpu_list(const std::string& list);
+
+//! Inverse of parse_cpu_list. Expects cpus to be sorted.
+std::string format_cpu_list(const std::vector<i32>& cpus);
+
+//! Restricts the calling thread to cpus. Returns false if the kernel rejects
+//! the mask.
+bool pin_thread_to_cpus(const std::vector<i32>& cpus);
+
+//! Makes node the preferred node for pages the calling thread faults in from
+//! now on. The kernel still falls back to other nodes when node is full.
+bool prefer_numa_node(i32 node);
+}
@@ -0,0 +1,54 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/numa.h"
+
+#include <gtest/gtest.h>
+
+#include <sched.h>
+#include <algorithm>
+#include <thread>
+
+namespace scanner {
+
+TEST(Numa, CpuLists) {
+  std::vector<i32> cpus = parse_cpu_list("0-3,8,10-11\n");
+  EXPECT_EQ(cpus, std::vector<i32>({0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(format_cpu_list(cpus), "0-3,8,10-11");
+  EXPECT_TRUE(parse_cpu_list("").empty());
+  EXPECT_EQ(format_cpu_list({}), "");
+}
+
+TEST(Numa, PinsToNodeCpus) {
+  std::vector<NumaNode> nodes = numa_nodes();
+  ASSERT_GT(nodes.size(), 0);
+  for (const NumaNode& node : nodes) {
+    EXPECT_GT(node.cpus.size(), 0);
+  }
+
+  // Pin a fresh thread so the test process keeps its own mask
+  const NumaNode& node = nodes.back();
+  std::thread thread([&]() {
+    ASSERT_TRUE(pin_thread_to_cpus(node.cpus));
+    i32 cpu = sched_getcpu();
+    EXPECT_NE(std::find(node.cpus.begin(), node.cpus.end(), cpu),
+              node.cpus.end());
+    // Preferring a node has no visible effect without NUMA hardware, but the
+    // kernel must accept it
+    prefer_numa_node(node.id);
+  });
+  thread.join();
+}
+}
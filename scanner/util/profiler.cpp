@@ -26,7 +26,10 @@ namespace scanner {
 Profiler::Profiler(timepoint_t base_time) : base_time_(base_time), lock_(0) {}
 
 Profiler::Profiler(const Profiler& other)
-  : base_time_(other.base_time_), records_(other.records_), lock_(0) {}
+  : base_time_(other.base_time_),
+    records_(other.records_),
+    samples_(other.samples_),
+    lock_(0) {}
 
 const std::vector<Profiler::TaskRecord>& Profiler::get_records() const {
   return records_;
@@ -36,6 +39,10 @@ const std::map<std::string, int64_t>& Profiler::get_counters() const {
   return counters_;
 }
 
+const std::vector<Profiler::SampleRecord>& Profiler::get_samples() const {
+  return samples_;
+}
+
 void write_profiler_to_file(storehouse::WriteFile* file, int64_t node,
                             std::string type_name, std::string tag,
                             int64_t worker_num, const Profiler& profiler) {
@@ -96,5 +103,31 @@ void write_profiler_to_file(storehouse::WriteFile* file, int64_t node,
     s_write(file, kv.first);
     s_write(file, kv.second);
   }
+  // Samples, with the same dictionary compression as intervals
+  const std::vector<scanner::Profiler::SampleRecord>& samples =
+      profiler.get_samples();
+  uint8_t sample_key_id = 0;
+  std::map<std::string, uint8_t> sample_key_names;
+  for (size_t j = 0; j < samples.size(); j++) {
+    const std::string& key = samples[j].key;
+    if (sample_key_names.count(key) == 0) {
+      sample_key_names.insert({key, sample_key_id++});
+    }
+  }
+  int64_t num_sample_keys = static_cast<int64_t>(sample_key_names.size());
+  s_write(file, num_sample_keys);
+  for (auto& kv : sample_key_names) {
+    s_write(file, kv.first);
+    s_write(file, kv.second);
+  }
+  int64_t num_samples = static_cast<int64_t>(samples.size());
+  s_write(file, num_samples);
+  for (size_t j = 0; j < samples.size(); j++) {
+    const scanner::Profiler::SampleRecord& sample = samples[j];
+    uint8_t key_index = sample_key_names[sample.key];
+    s_write(file, key_index);
+    s_write(file, sample.time);
+    s_write(file, sample.value);
+  }
 }
 }
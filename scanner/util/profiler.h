@@ -39,16 +39,26 @@ class Profiler {
 
   void increment(const std::string& key, int64_t value);
 
+  void add_sample(const std::string& key, timepoint_t time, int64_t value);
+
   struct TaskRecord {
     std::string key;
     int64_t start;
     int64_t end;
   };
 
+  struct SampleRecord {
+    std::string key;
+    int64_t time;
+    int64_t value;
+  };
+
   const std::vector<TaskRecord>& get_records() const;
 
   const std::map<std::string, int64_t>& get_counters() const;
 
+  const std::vector<SampleRecord>& get_samples() const;
+
  protected:
   void spin_lock();
   void unlock();
@@ -57,6 +67,7 @@ class Profiler {
   std::atomic_flag lock_;
   std::vector<TaskRecord> records_;
   std::map<std::string, int64_t> counters_;
+  std::vector<SampleRecord> samples_;
 };
 
 void write_profiler_to_file(storehouse::WriteFile* file, int64_t node,
@@ -40,6 +40,17 @@ inline void Profiler::increment(const std::string& key, int64_t value) {
   unlock();
 }
 
+inline void Profiler::add_sample(const std::string& key, timepoint_t time,
+                                 int64_t value) {
+  spin_lock();
+  samples_.emplace_back(SampleRecord{
+    key,
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      time - base_time_).count(),
+    value});
+  unlock();
+}
+
 inline void Profiler::spin_lock() {
   while (lock_.test_and_set(std::memory_order_acquire));
 }
@@ -0,0 +1,87 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares throughput of the mutex based Queue with the lock-free
+// BoundedQueue under the thread counts a pipeline runs with: one producer and
+// one consumer per pipeline stage hop.
+//
+// Usage: QueueBenchmark [items per producer] [queue size]
+
+#include "scanner/util/common.h"
+#include "scanner/util/bounded_queue.h"
+#include "scanner/util/queue.h"
+#include "scanner/util/util.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace scanner;
+
+template <typename QueueType>
+f64 run(i32 num_threads, i64 items_per_producer, i32 queue_size) {
+  QueueType queue(queue_size);
+  i32 num_producers = num_threads / 2;
+  i32 num_consumers = num_threads - num_producers;
+
+  auto start = now();
+  std::vector<std::thread> threads;
+  for (i32 c = 0; c < num_consumers; ++c) {
+    threads.emplace_back([&]() {
+      while (true) {
+        i64 v;
+        queue.pop(v);
+        if (v < 0) {
+          break;
+        }
+      }
+    });
+  }
+  std::vector<std::thread> producers;
+  for (i32 p = 0; p < num_producers; ++p) {
+    producers.emplace_back([&]() {
+      for (i64 i = 0; i < items_per_producer; ++i) {
+        queue.push(i);
+      }
+    });
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+  for (i32 c = 0; c < num_consumers; ++c) {
+    queue.push(-1);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  f64 seconds = nano_since(start) / 1e9;
+  return num_producers * items_per_producer / seconds;
+}
+
+int main(int argc, char** argv) {
+  i64 items_per_producer = argc > 1 ? std::atol(argv[1]) : 100000;
+  i32 queue_size = argc > 2 ? std::atoi(argv[2]) : 4;
+
+  printf("%8s %20s %20s %8s\n", "threads", "Queue items/s",
+         "BoundedQueue items/s", "speedup");
+  for (i32 num_threads : {2, 4, 8, 16, 32, 64}) {
+    f64 locked = run<Queue<i64>>(num_threads, items_per_producer, queue_size);
+    f64 lock_free =
+        run<BoundedQueue<i64>>(num_threads, items_per_producer, queue_size);
+    printf("%8d %20.0f %20.0f %8.2fx\n", num_threads, locked, lock_free,
+           lock_free / locked);
+  }
+  return 0;
+}
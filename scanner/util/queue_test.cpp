@@ -0,0 +1,202 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/bounded_queue.h"
+#include "scanner/util/queue.h"
+#include "scanner/util/work_stealing_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+
+namespace scanner {
+
+TEST(BoundedQueue, FifoAndCapacity) {
+  BoundedQueue<i32> queue(3);
+  EXPECT_EQ(queue.capacity(), 4);
+  for (i32 i = 0; i < 4; ++i) {
+    EXPECT_TRUE(queue.try_push(i));
+  }
+  EXPECT_FALSE(queue.try_push(4));
+  EXPECT_EQ(queue.size(), 4);
+
+  for (i32 i = 0; i < 4; ++i) {
+    i32 v;
+    EXPECT_TRUE(queue.try_pop(v));
+    EXPECT_EQ(v, i);
+  }
+  i32 v;
+  EXPECT_FALSE(queue.try_pop(v));
+  EXPECT_FALSE(queue.pop_for(v, 10));
+
+  EXPECT_TRUE(queue.push_for(7, 10));
+  EXPECT_TRUE(queue.pop_for(v, 10));
+  EXPECT_EQ(v, 7);
+}
+
+TEST(BoundedQueue, Batches) {
+  BoundedQueue<i32> queue(8);
+  std::vector<i32> in = {1, 2, 3, 4, 5};
+  queue.push_batch(in);
+  EXPECT_TRUE(in.empty());
+
+  std::vector<i32> out;
+  EXPECT_EQ(queue.pop_batch(out, 3), 3);
+  EXPECT_EQ(queue.pop_batch(out, 8), 2);
+  EXPECT_EQ(out, std::vector<i32>({1, 2, 3, 4, 5}));
+}
+
+TEST(BoundedQueue, ManyProducersManyConsumers) {
+  const i32 num_producers = 8;
+  const i32 num_consumers = 8;
+  const i64 items_per_producer = 20000;
+  BoundedQueue<i64> queue(4);
+
+  std::atomic<i64> sum{0};
+  std::atomic<i64> count{0};
+  std::vector<std::thread> threads;
+  for (i32 c = 0; c < num_consumers; ++c) {
+    threads.emplace_back([&]() {
+      while (true) {
+        i64 v;
+        queue.pop(v);
+        if (v < 0) {
+          break;
+        }
+        sum += v;
+        count++;
+      }
+    });
+  }
+  std::vector<std::thread> producers;
+  for (i32 p = 0; p < num_producers; ++p) {
+    producers.emplace_back([&, p]() {
+      for (i64 i = 0; i < items_per_producer; ++i) {
+        queue.push(p * items_per_producer + i);
+      }
+    });
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+  for (i32 c = 0; c < num_consumers; ++c) {
+    queue.push(-1);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  i64 n = num_producers * items_per_producer;
+  EXPECT_EQ(count.load(), n);
+  EXPECT_EQ(sum.load(), n * (n - 1) / 2);
+}
+
+template <typename QueueType>
+void pass_move_only_items() {
+  QueueType queue(2);
+  std::thread producer([&]() {
+    for (i32 i = 0; i < 100; ++i) {
+      queue.push(std::unique_ptr<i32>(new i32(i)));
+    }
+  });
+  for (i32 i = 0; i < 100; ++i) {
+    std::unique_ptr<i32> item;
+    queue.pop(item);
+    ASSERT_TRUE(item != nullptr);
+    EXPECT_EQ(*item, i);
+  }
+  producer.join();
+}
+
+TEST(Queue, MoveOnlyItems) {
+  pass_move_only_items<Queue<std::unique_ptr<i32>>>();
+}
+
+TEST(BoundedQueue, MoveOnlyItems) {
+  pass_move_only_items<BoundedQueue<std::unique_ptr<i32>>>();
+}
+
+TEST(WorkStealingQueue, OwnerTakesOldestThiefTakesNewest) {
+  WorkStealingQueue<i32> queue(3);
+  queue.push(0, 1);
+  queue.push(0, 2);
+  queue.push(0, 3);
+
+  i32 v;
+  bool stolen;
+  ASSERT_TRUE(queue.pop(0, v, stolen));
+  EXPECT_EQ(v, 1);
+  EXPECT_FALSE(stolen);
+  ASSERT_TRUE(queue.pop(1, v, stolen));
+  EXPECT_EQ(v, 3);
+  EXPECT_TRUE(stolen);
+  EXPECT_EQ(queue.size(0), 1);
+}
+
+TEST(WorkStealingQueue, StealOrder) {
+  WorkStealingQueue<i32> queue(3);
+  queue.set_steal_order(0, {2, 1});
+  queue.push(1, 10);
+  queue.push(2, 20);
+
+  i32 v;
+  bool stolen;
+  ASSERT_TRUE(queue.pop(0, v, stolen));
+  EXPECT_EQ(v, 20);
+  ASSERT_TRUE(queue.pop(0, v, stolen));
+  EXPECT_EQ(v, 10);
+  EXPECT_TRUE(stolen);
+}
+
+TEST(WorkStealingQueue, CloseDrainsRemainingItems) {
+  const i32 num_workers = 4;
+  const i32 num_items = 1000;
+  WorkStealingQueue<i32> queue(num_workers);
+
+  // Only worker 0 is ever given work, so the others must steal all of theirs
+  std::vector<i64> sums(num_workers);
+  std::vector<i32> steals(num_workers);
+  std::vector<std::thread> consumers;
+  for (i32 w = 0; w < num_workers; ++w) {
+    consumers.emplace_back([&, w]() {
+      i32 v;
+      bool stolen;
+      while (queue.pop(w, v, stolen)) {
+        sums[w] += v;
+        steals[w] += stolen;
+      }
+    });
+  }
+  for (i32 i = 1; i <= num_items; ++i) {
+    queue.push(0, i);
+  }
+  queue.close();
+  for (auto& consumer : consumers) {
+    consumer.join();
+  }
+
+  i64 total = 0;
+  for (i32 w = 0; w < num_workers; ++w) {
+    total += sums[w];
+  }
+  EXPECT_EQ(total, (i64)num_items * (num_items + 1) / 2);
+  EXPECT_EQ(steals[0], 0);
+
+  i32 v;
+  bool stolen;
+  EXPECT_FALSE(queue.pop(1, v, stolen));
+}
+}
@@ -0,0 +1,282 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/row_set.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace scanner {
+
+namespace {
+
+// Floor of a / b for b > 0
+i64 floor_div(i64 a, i64 b) { return a >= 0 ? a / b : -((-a + b - 1) / b); }
+
+// Walks the rows of a RowSet a run at a time
+class RunCursor {
+ public:
+  RunCursor(const std::vector<RowSet::Run>& runs) : runs_(runs) {}
+
+  bool done() const { return run_ >= runs_.size(); }
+
+  i64 row() const { return runs_[run_].start + runs_[run_].stride * pos_; }
+
+  i64 last() const { return runs_[run_].last(); }
+
+  i64 stride() const { return runs_[run_].stride; }
+
+  i64 remaining() const { return runs_[run_].count - pos_; }
+
+  void advance() {
+    if (++pos_ == runs_[run_].count) {
+      next_run();
+    }
+  }
+
+  void next_run() {
+    run_++;
+    pos_ = 0;
+  }
+
+  // Moves to the first row greater than row
+  void advance_past(i64 row) {
+    while (!done() && last() <= row) {
+      next_run();
+    }
+    if (!done() && this->row() <= row) {
+      const RowSet::Run& run = runs_[run_];
+      pos_ = (row - run.start) / run.stride + 1;
+    }
+  }
+
+ private:
+  const std::vector<RowSet::Run>& runs_;
+  size_t run_ = 0;
+  i64 pos_ = 0;
+};
+
+// True if the rest of both current runs step through the same rows
+bool aligned(const RunCursor& a, const RunCursor& b) {
+  return a.remaining() > 1 && b.remaining() > 1 && a.stride() == b.stride() &&
+         (a.row() - b.row()) % a.stride() == 0;
+}
+}
+
+RowSet::RowSet(const std::vector<i64>& rows) {
+  for (i64 row : rows) {
+    append(row);
+  }
+}
+
+RowSet RowSet::range(i64 begin, i64 end, i64 stride) {
+  RowSet set;
+  if (end > begin) {
+    set.append_run(begin, stride, (end - begin + stride - 1) / stride);
+  }
+  return set;
+}
+
+void RowSet::append(i64 row) { append_run(row, 1, 1); }
+
+void RowSet::append_run(i64 start, i64 stride, i64 count) {
+  if (count <= 0) {
+    return;
+  }
+  assert(empty() || start > back());
+  if (count == 1) {
+    // A single row may set the stride of a run of one, or continue a run
+    stride = runs_.empty() ? 1 : start - runs_.back().last();
+  }
+  size_ += count;
+  if (!runs_.empty()) {
+    Run& tail = runs_.back();
+    if (tail.count == 1 && start - tail.start == stride) {
+      tail.stride = stride;
+      tail.count += count;
+      return;
+    }
+    if (tail.stride == stride && start == tail.last() + stride) {
+      tail.count += count;
+      return;
+    }
+    if (count == 1) {
+      stride = 1;
+    }
+  }
+  offsets_.push_back(size_ - count);
+  runs_.push_back(Run{start, stride, count});
+}
+
+i64 RowSet::operator[](i64 index) const {
+  size_t r = run_of_index(index);
+  return runs_[r].start + runs_[r].stride * (index - offsets_[r]);
+}
+
+bool RowSet::contains(i64 row) const {
+  i64 r = run_at_or_before(row);
+  if (r < 0) {
+    return false;
+  }
+  const Run& run = runs_[r];
+  i64 delta = row - run.start;
+  return delta % run.stride == 0 && delta / run.stride < run.count;
+}
+
+i64 RowSet::upper_index(i64 row) const {
+  i64 r = run_at_or_before(row);
+  if (r < 0) {
+    return 0;
+  }
+  const Run& run = runs_[r];
+  return offsets_[r] + std::min(run.count, (row - run.start) / run.stride + 1);
+}
+
+i64 RowSet::next_row(i64 row) const {
+  i64 index = upper_index(row - 1);
+  return index < size_ ? (*this)[index] : -1;
+}
+
+RowSet RowSet::slice(i64 begin, i64 end) const {
+  RowSet set;
+  end = std::min(end, size_);
+  if (begin >= end) {
+    return set;
+  }
+  for (size_t r = run_of_index(begin); r < runs_.size(); ++r) {
+    const Run& run = runs_[r];
+    i64 first = std::max(begin - offsets_[r], (i64)0);
+    i64 last = std::min(end - offsets_[r], run.count);
+    if (first >= last) {
+      break;
+    }
+    set.append_run(run.start + run.stride * first, run.stride, last - first);
+  }
+  return set;
+}
+
+RowSet RowSet::unite(const RowSet& other) const {
+  RowSet set;
+  RunCursor a(runs_);
+  RunCursor b(other.runs_);
+  while (!a.done() && !b.done()) {
+    if (a.last() < b.row()) {
+      set.append_run(a.row(), a.stride(), a.remaining());
+      a.next_run();
+    } else if (b.last() < a.row()) {
+      set.append_run(b.row(), b.stride(), b.remaining());
+      b.next_run();
+    } else if (aligned(a, b)) {
+      i64 start = std::min(a.row(), b.row());
+      i64 end = std::min(a.last(), b.last());
+      set.append_run(start, a.stride(), (end - start) / a.stride() + 1);
+      a.advance_past(end);
+      b.advance_past(end);
+    } else {
+      // The runs interleave, so merge them a row at a time
+      i64 row = std::min(a.row(), b.row());
+      set.append(row);
+      if (a.row() == row) a.advance();
+      if (b.row() == row) b.advance();
+    }
+  }
+  for (RunCursor* rest : {&a, &b}) {
+    for (; !rest->done(); rest->next_run()) {
+      set.append_run(rest->row(), rest->stride(), rest->remaining());
+    }
+  }
+  return set;
+}
+
+RowSet RowSet::intersect(const RowSet& other) const {
+  RowSet set;
+  RunCursor a(runs_);
+  RunCursor b(other.runs_);
+  while (!a.done() && !b.done()) {
+    if (a.last() < b.row()) {
+      a.next_run();
+    } else if (b.last() < a.row()) {
+      b.next_run();
+    } else if (aligned(a, b)) {
+      i64 start = std::max(a.row(), b.row());
+      i64 end = std::min(a.last(), b.last());
+      set.append_run(start, a.stride(), (end - start) / a.stride() + 1);
+      a.advance_past(end);
+      b.advance_past(end);
+    } else if (a.row() == b.row()) {
+      set.append(a.row());
+      a.advance();
+      b.advance();
+    } else if (a.row() < b.row()) {
+      a.advance_past(b.row() - 1);
+    } else {
+      b.advance_past(a.row() - 1);
+    }
+  }
+  return set;
+}
+
+RowSet RowSet::expand(const std::vector<i32>& stencil, i64 num_rows) const {
+  // Keep the rows whose whole stencil fits in the table
+  RowSet fits;
+  for (const Run& run : runs_) {
+    i64 first = std::max(
+        (i64)0, -floor_div(run.start + stencil.front(), run.stride));
+    i64 last = std::min(
+        run.count - 1,
+        floor_div(num_rows - 1 - stencil.back() - run.start, run.stride));
+    if (first <= last) {
+      fits.append_run(run.start + run.stride * first, run.stride,
+                      last - first + 1);
+    }
+  }
+  RowSet set;
+  for (i32 offset : stencil) {
+    RowSet shifted;
+    for (const Run& run : fits.runs_) {
+      shifted.append_run(run.start + offset, run.stride, run.count);
+    }
+    set = set.unite(shifted);
+  }
+  return set;
+}
+
+std::vector<i64> RowSet::to_vector() const { return to_vector(0, size_); }
+
+std::vector<i64> RowSet::to_vector(i64 begin, i64 end) const {
+  std::vector<i64> rows;
+  RowSet part = slice(begin, end);
+  rows.reserve(part.size());
+  for (const Run& run : part.runs_) {
+    for (i64 i = 0; i < run.count; ++i) {
+      rows.push_back(run.start + run.stride * i);
+    }
+  }
+  return rows;
+}
+
+size_t RowSet::run_of_index(i64 index) const {
+  assert(index >= 0 && index < size_);
+  return std::upper_bound(offsets_.begin(), offsets_.end(), index) -
+         offsets_.begin() - 1;
+}
+
+i64 RowSet::run_at_or_before(i64 row) const {
+  auto it = std::upper_bound(
+      runs_.begin(), runs_.end(), row,
+      [](i64 row, const Run& run) { return row < run.start; });
+  return (i64)(it - runs_.begin()) - 1;
+}
+}
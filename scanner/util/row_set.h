@@ -0,0 +1,108 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+
+#include <vector>
+
+namespace scanner {
+
+/**
+ * @brief Sorted set of row ids stored as strided runs.
+ *
+ * The rows an op needs are almost always a few contiguous ranges, or every
+ * n-th row of a table, so sets of rows are kept as runs of evenly spaced rows
+ * and operations on them cost in the number of runs rather than rows. Rows
+ * that fit no run, e.g. where runs with different strides interleave, are
+ * stored as runs of one or two rows and handled one at a time.
+ */
+class RowSet {
+ public:
+  //! count rows start, start + stride, ...
+  struct Run {
+    i64 start;
+    i64 stride;
+    i64 count;
+
+    i64 last() const { return start + stride * (count - 1); }
+  };
+
+  RowSet() = default;
+
+  //! rows must be sorted and unique
+  explicit RowSet(const std::vector<i64>& rows);
+
+  //! Rows begin, begin + stride, ... below end
+  static RowSet range(i64 begin, i64 end, i64 stride = 1);
+
+  //! Adds a row larger than any already in the set
+  void append(i64 row);
+
+  //! Adds count rows start, start + stride, ..., all larger than any already
+  //! in the set
+  void append_run(i64 start, i64 stride, i64 count);
+
+  i64 size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  const std::vector<Run>& runs() const { return runs_; }
+
+  //! The index-th smallest row
+  i64 operator[](i64 index) const;
+
+  i64 front() const { return runs_.front().start; }
+
+  i64 back() const { return runs_.back().last(); }
+
+  bool contains(i64 row) const;
+
+  //! Number of rows less than or equal to row
+  i64 upper_index(i64 row) const;
+
+  //! Smallest row greater than or equal to row, or -1 if there is none
+  i64 next_row(i64 row) const;
+
+  //! Rows with indices in [begin, end)
+  RowSet slice(i64 begin, i64 end) const;
+
+  RowSet unite(const RowSet& other) const;
+
+  RowSet intersect(const RowSet& other) const;
+
+  //! Rows r + s for every row r and offset s in stencil, skipping rows whose
+  //! stencil does not fit in [0, num_rows). stencil must be sorted.
+  RowSet expand(const std::vector<i32>& stencil, i64 num_rows) const;
+
+  std::vector<i64> to_vector() const;
+
+  //! Rows with indices in [begin, end)
+  std::vector<i64> to_vector(i64 begin, i64 end) const;
+
+ private:
+  // Index of the run holding the index-th row
+  size_t run_of_index(i64 index) const;
+
+  // Index of the last run starting at or before row, or -1
+  i64 run_at_or_before(i64 row) const;
+
+  std::vector<Run> runs_;
+  // Number of rows before each run
+  std::vector<i64> offsets_;
+  i64 size_ = 0;
+};
+}
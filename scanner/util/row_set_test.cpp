@@ -0,0 +1,98 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/row_set.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <set>
+
+namespace scanner {
+
+TEST(RowSet, CompressesIntoRuns) {
+  RowSet rows({0, 1, 2, 3, 10, 20, 30, 31});
+  EXPECT_EQ(rows.size(), 8);
+  EXPECT_EQ(rows.runs().size(), 3);
+  EXPECT_EQ(rows[4], 10);
+  EXPECT_EQ(rows[7], 31);
+  EXPECT_TRUE(rows.contains(20));
+  EXPECT_FALSE(rows.contains(15));
+  EXPECT_EQ(rows.upper_index(-1), 0);
+  EXPECT_EQ(rows.upper_index(3), 4);
+  EXPECT_EQ(rows.upper_index(25), 6);
+  EXPECT_EQ(rows.upper_index(100), 8);
+  EXPECT_EQ(rows.next_row(4), 10);
+  EXPECT_EQ(rows.next_row(32), -1);
+  EXPECT_EQ(rows.slice(2, 6).to_vector(), std::vector<i64>({2, 3, 10, 20}));
+  EXPECT_EQ(rows.to_vector(5, 7), std::vector<i64>({20, 30}));
+}
+
+TEST(RowSet, DenseStencilStaysOneRun) {
+  RowSet rows = RowSet::range(0, 250);
+  RowSet needed = rows.expand({-2, -1, 0, 1, 2}, 1000);
+  EXPECT_EQ(needed.runs().size(), 1);
+  EXPECT_EQ(needed.front(), 0);
+  // Rows 0 and 1 can not reach two rows back, so are not expanded
+  EXPECT_EQ(needed.back(), 251);
+  EXPECT_EQ(needed.size(), 252);
+}
+
+TEST(RowSet, StridedRowsKeepTheirStride) {
+  RowSet rows = RowSet::range(0, 1000, 10);
+  EXPECT_EQ(rows.runs().size(), 1);
+  EXPECT_EQ(rows.size(), 100);
+  RowSet shifted = rows.expand({5}, 1000);
+  EXPECT_EQ(shifted.runs().size(), 1);
+  EXPECT_EQ(shifted.front(), 5);
+  EXPECT_EQ(rows.unite(RowSet::range(500, 2000, 10)).runs().size(), 1);
+  EXPECT_EQ(rows.intersect(RowSet::range(500, 2000, 5)).size(), 50);
+}
+
+TEST(RowSet, MatchesStdSet) {
+  // Runs of different strides that overlap and interleave
+  std::vector<RowSet> sets = {RowSet::range(0, 100, 3), RowSet::range(50, 80),
+                              RowSet::range(7, 200, 7),
+                              RowSet({1, 2, 3, 90, 95, 150})};
+  for (const RowSet& a : sets) {
+    for (const RowSet& b : sets) {
+      std::vector<i64> av = a.to_vector();
+      std::vector<i64> bv = b.to_vector();
+      std::set<i64> united(av.begin(), av.end());
+      united.insert(bv.begin(), bv.end());
+      std::set<i64> common;
+      for (i64 r : av) {
+        if (std::find(bv.begin(), bv.end(), r) != bv.end()) {
+          common.insert(r);
+        }
+      }
+      EXPECT_EQ(a.unite(b).to_vector(),
+                std::vector<i64>(united.begin(), united.end()));
+      EXPECT_EQ(a.intersect(b).to_vector(),
+                std::vector<i64>(common.begin(), common.end()));
+    }
+    std::vector<i32> stencil = {-3, 0, 2};
+    std::set<i64> expanded;
+    for (i64 r : a.to_vector()) {
+      if (r - 3 < 0 || r + 2 >= 120) continue;
+      for (i32 s : stencil) {
+        expanded.insert(r + s);
+      }
+    }
+    EXPECT_EQ(a.expand(stencil, 120).to_vector(),
+              std::vector<i64>(expanded.begin(), expanded.end()));
+  }
+}
+}
@@ -0,0 +1,92 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/thread_pool.h"
+
+#include <algorithm>
+
+namespace scanner {
+
+ThreadPool::ThreadPool(i32 num_threads) {
+  for (i32 i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(&ThreadPool::thread_main, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    stop_ = true;
+  }
+  work_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::parallel_for(i32 n, const std::function<void(i32)>& fn) {
+  if (n <= 0) {
+    return;
+  }
+  if (n == 1 || threads_.empty()) {
+    for (i32 i = 0; i < n; ++i) {
+      fn(i);
+    }
+    return;
+  }
+  auto loop = std::make_shared<Loop>();
+  loop->fn = &fn;
+  loop->count = n;
+
+  std::unique_lock<std::mutex> lk(mutex_);
+  loops_.push_back(loop);
+  work_.notify_all();
+  while (loop->next < loop->count) {
+    run(lk, loop, claim(loop));
+  }
+  loop->done.wait(lk, [&] { return loop->finished == loop->count; });
+}
+
+i32 ThreadPool::claim(const std::shared_ptr<Loop>& loop) {
+  i32 i = loop->next++;
+  if (loop->next == loop->count) {
+    loops_.erase(std::find(loops_.begin(), loops_.end(), loop));
+  }
+  return i;
+}
+
+void ThreadPool::run(std::unique_lock<std::mutex>& lk,
+                     const std::shared_ptr<Loop>& loop, i32 i) {
+  lk.unlock();
+  (*loop->fn)(i);
+  lk.lock();
+  if (++loop->finished == loop->count) {
+    loop->done.notify_all();
+  }
+}
+
+void ThreadPool::thread_main() {
+  std::unique_lock<std::mutex> lk(mutex_);
+  while (true) {
+    work_.wait(lk, [&] { return stop_ || !loops_.empty(); });
+    if (loops_.empty()) {
+      return;
+    }
+    // Hold a reference, since the loop leaves loops_ once fully claimed
+    std::shared_ptr<Loop> loop = loops_.front();
+    run(lk, loop, claim(loop));
+  }
+}
+}
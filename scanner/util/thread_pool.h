@@ -0,0 +1,77 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace scanner {
+
+/**
+ * @brief Fixed set of threads that run the iterations of parallel loops.
+ *
+ * Any number of threads may call parallel_for at once. Their loops are
+ * served in the order they were started, and each caller runs iterations of
+ * its own loop while it waits, so a loop always makes progress even when
+ * every pool thread is busy with someone else's.
+ */
+class ThreadPool {
+ public:
+  ThreadPool(i32 num_threads);
+
+  ~ThreadPool();
+
+  //! Number of pool threads, not counting callers
+  i32 num_threads() const { return threads_.size(); }
+
+  //! Runs fn(0), ..., fn(n - 1) on the pool and the calling thread and
+  //! returns once all of them have finished
+  void parallel_for(i32 n, const std::function<void(i32)>& fn);
+
+ private:
+  struct Loop {
+    const std::function<void(i32)>* fn;
+    i32 count;
+    i32 next = 0;
+    i32 finished = 0;
+    std::condition_variable done;
+  };
+
+  // Requires mutex_. Claims the next iteration of loop, retiring the loop
+  // from loops_ once its last iteration is claimed.
+  i32 claim(const std::shared_ptr<Loop>& loop);
+
+  // Requires lk to hold mutex_. Runs iteration i of loop without the lock.
+  void run(std::unique_lock<std::mutex>& lk, const std::shared_ptr<Loop>& loop,
+           i32 i);
+
+  void thread_main();
+
+  std::mutex mutex_;
+  std::condition_variable work_;
+  // Loops with iterations nobody has claimed yet
+  std::list<std::shared_ptr<Loop>> loops_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+}
@@ -0,0 +1,69 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/thread_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <set>
+
+namespace scanner {
+
+TEST(ThreadPool, RunsEveryIterationOnce) {
+  ThreadPool pool(4);
+  std::vector<std::atomic<i32>> runs(1000);
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+  pool.parallel_for(runs.size(), [&](i32 i) {
+    runs[i]++;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    std::unique_lock<std::mutex> lk(mutex);
+    threads.insert(std::this_thread::get_id());
+  });
+  for (auto& r : runs) {
+    EXPECT_EQ(r.load(), 1);
+  }
+  EXPECT_GT(threads.size(), 1);
+
+  // No pool threads, so the caller runs everything
+  ThreadPool empty(0);
+  i32 sum = 0;
+  empty.parallel_for(10, [&](i32 i) { sum += i; });
+  EXPECT_EQ(sum, 45);
+}
+
+TEST(ThreadPool, ManyCallers) {
+  ThreadPool pool(2);
+  const i32 num_callers = 8;
+  std::vector<i64> sums(num_callers);
+  std::vector<std::thread> callers;
+  for (i32 c = 0; c < num_callers; ++c) {
+    callers.emplace_back([&, c]() {
+      for (i32 rep = 0; rep < 50; ++rep) {
+        std::atomic<i64> sum{0};
+        pool.parallel_for(100, [&](i32 i) { sum += i; });
+        sums[c] += sum;
+      }
+    });
+  }
+  for (auto& caller : callers) {
+    caller.join();
+  }
+  for (i64 sum : sums) {
+    EXPECT_EQ(sum, 50 * 4950);
+  }
+}
+}
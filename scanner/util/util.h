@@ -123,6 +123,33 @@ class Flag {
   std::condition_variable cv_;
   std::atomic<bool> bit_{false};
 };
+
+//! Counter that other threads can block on until it moves past a value
+class EventCounter {
+ public:
+  void increment() {
+    std::unique_lock<std::mutex> lock(m_);
+    value_++;
+    lock.unlock();
+    cv_.notify_all();
+  }
+
+  int64_t value() { return value_.load(); }
+
+  //! Waits up to ms milliseconds for the counter to exceed seen and returns
+  //! its value
+  int64_t wait_for(int64_t seen, int ms) {
+    std::unique_lock<std::mutex> lock(m_);
+    cv_.wait_for(lock, std::chrono::milliseconds(ms),
+                 [&] { return value_.load() > seen; });
+    return value_.load();
+  }
+
+ private:
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::atomic<int64_t> value_{0};
+};
 ///////////////////////////////////////////////////////////////////////////////
 /// Debugging utils
 
@@ -0,0 +1,82 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace scanner {
+
+/**
+ * @brief Per-worker deques where idle workers steal from their neighbours.
+ *
+ * Producers push to a worker's own deque. The worker pops its oldest item,
+ * and when its deque is empty it steals the newest item of the first
+ * non-empty deque in its steal order, i.e. the item the owner would have
+ * reached last.
+ *
+ * Items are whole IO items, which arrive at a few per second, so every deque
+ * shares one lock rather than using a lock-free deque.
+ */
+template <typename T>
+class WorkStealingQueue {
+ public:
+  WorkStealingQueue(i32 num_workers, i32 max_size_per_worker = 4);
+
+  WorkStealingQueue(const WorkStealingQueue<T>&) = delete;
+  WorkStealingQueue& operator=(const WorkStealingQueue<T>&) = delete;
+
+  i32 num_workers() const;
+
+  //! Order in which worker looks at other deques when its own is empty.
+  //! Defaults to worker + 1, worker + 2, ... wrapping around.
+  void set_steal_order(i32 worker, const std::vector<i32>& victims);
+
+  //! Blocks while worker's deque is full.
+  void push(i32 worker, T item);
+
+  //! Blocks until worker has an item of its own or one it can steal. Sets
+  //! stolen if the item came from another worker's deque. Returns false once
+  //! the queue is closed and there is nothing left for worker to take.
+  bool pop(i32 worker, T& item, bool& stolen);
+
+  //! Lets blocked pops drain what is left and then return false.
+  void close();
+
+  void clear();
+
+  //! Number of items waiting in worker's own deque.
+  i32 size(i32 worker);
+
+ private:
+  // Requires lock_
+  bool take(i32 worker, T& item, bool& stolen);
+
+  i32 max_size_;
+  std::mutex lock_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::vector<std::deque<T>> deques_;
+  std::vector<std::vector<i32>> steal_order_;
+  bool closed_ = false;
+};
+}
+
+#include "work_stealing_queue.inl"
@@ -0,0 +1,115 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "work_stealing_queue.h"
+
+namespace scanner {
+
+template <typename T>
+WorkStealingQueue<T>::WorkStealingQueue(i32 num_workers,
+                                        i32 max_size_per_worker)
+  : max_size_(max_size_per_worker),
+    deques_(num_workers),
+    steal_order_(num_workers) {
+  for (i32 w = 0; w < num_workers; ++w) {
+    for (i32 i = 1; i < num_workers; ++i) {
+      steal_order_[w].push_back((w + i) % num_workers);
+    }
+  }
+}
+
+template <typename T>
+i32 WorkStealingQueue<T>::num_workers() const {
+  return (i32)deques_.size();
+}
+
+template <typename T>
+void WorkStealingQueue<T>::set_steal_order(i32 worker,
+                                           const std::vector<i32>& victims) {
+  std::unique_lock<std::mutex> lock(lock_);
+  steal_order_[worker] = victims;
+}
+
+template <typename T>
+void WorkStealingQueue<T>::push(i32 worker, T item) {
+  std::unique_lock<std::mutex> lock(lock_);
+  not_full_.wait(lock,
+                 [&] { return (i32)deques_[worker].size() < max_size_; });
+  deques_[worker].push_back(std::move(item));
+  lock.unlock();
+  // Any idle worker may be the one to take it
+  not_empty_.notify_all();
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::pop(i32 worker, T& item, bool& stolen) {
+  std::unique_lock<std::mutex> lock(lock_);
+  bool found = false;
+  not_empty_.wait(lock, [&] {
+    found = take(worker, item, stolen);
+    return found || closed_;
+  });
+  lock.unlock();
+  if (found) {
+    not_full_.notify_all();
+  }
+  return found;
+}
+
+template <typename T>
+void WorkStealingQueue<T>::close() {
+  std::unique_lock<std::mutex> lock(lock_);
+  closed_ = true;
+  lock.unlock();
+  not_empty_.notify_all();
+}
+
+template <typename T>
+void WorkStealingQueue<T>::clear() {
+  std::unique_lock<std::mutex> lock(lock_);
+  for (auto& deque : deques_) {
+    deque.clear();
+  }
+  lock.unlock();
+  not_full_.notify_all();
+}
+
+template <typename T>
+i32 WorkStealingQueue<T>::size(i32 worker) {
+  std::unique_lock<std::mutex> lock(lock_);
+  return (i32)deques_[worker].size();
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::take(i32 worker, T& item, bool& stolen) {
+  std::deque<T>& own = deques_[worker];
+  if (!own.empty()) {
+    item = std::move(own.front());
+    own.pop_front();
+    stolen = false;
+    return true;
+  }
+  for (i32 victim : steal_order_[worker]) {
+    std::deque<T>& other = deques_[victim];
+    if (!other.empty()) {
+      item = std::move(other.back());
+      other.pop_back();
+      stolen = true;
+      return true;
+    }
+  }
+  return false;
+}
+}
@@ -92,5 +92,8 @@ class BlurKernel : public Kernel, public VideoKernel {
 
 REGISTER_OP(Blur).frame_input("frame").frame_output("frame");
 
-REGISTER_KERNEL(Blur, BlurKernel).device(DeviceType::CPU).num_devices(1);
+REGISTER_KERNEL(Blur, BlurKernel)
+    .device(DeviceType::CPU)
+    .num_devices(1)
+    .parallel();
 }
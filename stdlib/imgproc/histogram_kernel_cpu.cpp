@@ -52,5 +52,6 @@ REGISTER_OP(Histogram).frame_input("frame").output("histogram");
 REGISTER_KERNEL(Histogram, HistogramKernelCPU)
     .device(DeviceType::CPU)
     .batch()
-    .num_devices(1);
+    .num_devices(1)
+    .parallel();
 }
@@ -35,5 +35,6 @@ REGISTER_OP(ImageEncoder).frame_input("frame").output("img");
 
 REGISTER_KERNEL(ImageEncoder, ImageEncoderKernel)
     .device(DeviceType::CPU)
-    .num_devices(1);
+    .num_devices(1)
+    .parallel();
 }
@@ -76,7 +76,10 @@ class ResizeKernel : public BatchedKernel {
 
 REGISTER_OP(Resize).frame_input("frame").frame_output("frame");
 
-REGISTER_KERNEL(Resize, ResizeKernel).device(DeviceType::CPU).num_devices(1);
+REGISTER_KERNEL(Resize, ResizeKernel)
+    .device(DeviceType::CPU)
+    .num_devices(1)
+    .parallel();
 
 #ifdef HAVE_CUDA
 REGISTER_KERNEL(Resize, ResizeKernel).device(DeviceType::GPU).num_devices(1);
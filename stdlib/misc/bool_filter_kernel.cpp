@@ -0,0 +1,33 @@
+#include "scanner/api/kernel.h"
+#include "scanner/api/op.h"
+#include "scanner/util/memory.h"
+
+namespace scanner {
+
+// Keeps the rows whose mask element starts with a nonzero byte, e.g. a mask
+// column that an earlier job saved
+class BoolFilterKernel : public BatchedKernel {
+ public:
+  BoolFilterKernel(const KernelConfig& config)
+    : BatchedKernel(config), device_(config.devices[0]) {}
+
+  void execute(const BatchedColumns& input_columns,
+               BatchedColumns& output_columns) override {
+    for (const Element& element : input_columns[0]) {
+      u8* keep = new_buffer(device_, 1);
+      *keep = element.size > 0 && element.buffer[0] != 0;
+      insert_element(output_columns[0], keep, 1);
+    }
+  }
+
+ private:
+  DeviceHandle device_;
+};
+
+REGISTER_OP(BoolFilter).input("mask").output("keep").filter();
+
+REGISTER_KERNEL(BoolFilter, BoolFilterKernel)
+    .device(DeviceType::CPU)
+    .batch()
+    .num_devices(1);
+}
@@ -0,0 +1,51 @@
+#include "scanner/api/kernel.h"
+#include "scanner/api/op.h"
+#include "scanner/util/memory.h"
+
+#include <cstring>
+
+namespace scanner {
+
+// Counts the rows of each item, and combines the items' counts into the
+// count of the table
+class RowCountKernel : public AggregateKernel {
+ public:
+  RowCountKernel(const KernelConfig& config)
+    : AggregateKernel(config), device_(config.devices[0]), count_(0) {}
+
+  void combine(const BatchedColumns& partial_columns,
+               Columns& output_columns) override {
+    i64 total = 0;
+    for (const Element& element : partial_columns[0]) {
+      i64 count;
+      std::memcpy(&count, element.buffer, sizeof(i64));
+      total += count;
+    }
+    write_count(total, output_columns[0]);
+  }
+
+ protected:
+  void aggregate(const Columns& input_columns) override { count_++; }
+
+  void finish(Columns& output_columns) override {
+    write_count(count_, output_columns[0]);
+    count_ = 0;
+  }
+
+ private:
+  void write_count(i64 count, Element& element) {
+    u8* buffer = new_buffer(device_, sizeof(i64));
+    std::memcpy(buffer, &count, sizeof(i64));
+    insert_element(element, buffer, sizeof(i64));
+  }
+
+  DeviceHandle device_;
+  i64 count_;
+};
+
+REGISTER_OP(RowCount).input("row").output("count").aggregate();
+
+REGISTER_KERNEL(RowCount, RowCountKernel)
+    .device(DeviceType::CPU)
+    .num_devices(1);
+}
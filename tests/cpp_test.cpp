@@ -1,12 +1,70 @@
 #include "scanner/api/database.h"
+#include "scanner/api/kernel.h"
 #include "scanner/api/op.h"
 #include "scanner/util/fs.h"
+#include "scanner/util/memory.h"
 #include "stdlib/stdlib.pb.h"
 
 #include <gtest/gtest.h>
+#include <atomic>
 
 namespace scanner {
 
+// Number of rows each of the counting ops below computed
+static std::atomic<i64> computed_rows[3];
+
+template <int Counter>
+class CountRowsKernel : public Kernel {
+ public:
+  CountRowsKernel(const KernelConfig& config)
+    : Kernel(config), device_(config.devices[0]) {}
+
+  void execute(const Columns& input_columns, Columns& output_columns) override {
+    computed_rows[Counter]++;
+    insert_element(output_columns[0], new_buffer(device_, 1), 1);
+  }
+
+ private:
+  DeviceHandle device_;
+};
+
+template <int Counter>
+class CountStencilRowsKernel : public StenciledKernel {
+ public:
+  CountStencilRowsKernel(const KernelConfig& config)
+    : StenciledKernel(config), device_(config.devices[0]) {}
+
+  void execute(const StenciledColumns& input_columns,
+               Columns& output_columns) override {
+    computed_rows[Counter]++;
+    insert_element(output_columns[0], new_buffer(device_, 1), 1);
+  }
+
+ private:
+  DeviceHandle device_;
+};
+
+REGISTER_OP(CountRows).input("row").output("counted");
+
+REGISTER_OP(CountRowsAgain).input("row").output("counted_again");
+
+REGISTER_OP(CountStencilRows)
+    .input("row")
+    .output("counted_stencil")
+    .stencil({-1, 0, 1});
+
+REGISTER_KERNEL(CountRows, CountRowsKernel<0>)
+    .device(DeviceType::CPU)
+    .num_devices(1);
+
+REGISTER_KERNEL(CountRowsAgain, CountRowsKernel<1>)
+    .device(DeviceType::CPU)
+    .num_devices(1);
+
+REGISTER_KERNEL(CountStencilRows, CountStencilRowsKernel<2>)
+    .device(DeviceType::CPU)
+    .num_devices(1);
+
 // Fixtures are taken down after every test, so to avoid-redownloading and
 // ingesting the files, we use static globals.
 static bool downloaded = false;
@@ -99,6 +157,15 @@ class ScannerTest : public ::testing::Test {
   }
 
   scanner::Task range_task(std::string output_table_name) {
+    std::vector<i64> rows;
+    for (int i = 0; i < 100; i += 1) {
+      rows.push_back(i);
+    }
+    return gather_task(output_table_name, rows);
+  }
+
+  scanner::Task gather_task(std::string output_table_name,
+                            const std::vector<i64>& rows) {
     scanner::Task task;
     task.output_table_name = output_table_name;
     scanner::TableSample sample;
@@ -107,8 +174,8 @@ class ScannerTest : public ::testing::Test {
     sample.sampling_function = "Gather";
     scanner::proto::GatherSamplerArgs args;
     auto& gather_sample = *args.add_samples();
-    for (int i = 0; i < 100; i += 1) {
-      gather_sample.add_rows(i);
+    for (i64 r : rows) {
+      gather_sample.add_rows(r);
     }
     std::vector<scanner::u8> args_data(args.ByteSize());
     args.SerializeToArray(args_data.data(), args_data.size());
@@ -131,11 +198,38 @@ TEST_F(ScannerTest, NonLinearDAG) {
       {scanner::OpInput(blur_op(input, DeviceType::CPU), {"frame"})},
       scanner::DeviceType::CPU);
 
-  scanner::Op* output =
-      scanner::make_output_op({scanner::OpInput(input, {"index"}),
-                               scanner::OpInput(hist, {"histogram"})});
+  // One branch reads the neighbours of each row through a stencil, the other
+  // reads only the row itself
+  scanner::Op* counted = new scanner::Op(
+      "CountRows", {scanner::OpInput(input, {"index"})},
+      scanner::DeviceType::CPU);
+  scanner::Op* counted_stencil = new scanner::Op(
+      "CountStencilRows", {scanner::OpInput(counted, {"counted"})},
+      scanner::DeviceType::CPU);
+  scanner::Op* counted_again = new scanner::Op(
+      "CountRowsAgain", {scanner::OpInput(input, {"index"})},
+      scanner::DeviceType::CPU);
+
+  scanner::Op* output = scanner::make_output_op(
+      {scanner::OpInput(input, {"index"}),
+       scanner::OpInput(hist, {"histogram"}),
+       scanner::OpInput(counted_stencil, {"counted_stencil"}),
+       scanner::OpInput(counted_again, {"counted_again"})});
+
+  std::vector<i64> rows;
+  for (i64 i = 10; i < 100; i += 10) {
+    rows.push_back(i);
+  }
+  for (auto& count : computed_rows) {
+    count = 0;
+  }
+  run_task(gather_task("NonLinearDAG", rows), output);
 
-  run_task(range_task("NonLinearDAG"), output);
+  // Only the op under the stencil computes the neighbours of the sampled rows
+  i64 num_rows = rows.size();
+  EXPECT_EQ(computed_rows[0].load(), num_rows * 3);
+  EXPECT_EQ(computed_rows[1].load(), num_rows);
+  EXPECT_EQ(computed_rows[2].load(), num_rows);
 }
 
 #ifdef HAVE_CUDA
@@ -8,6 +8,7 @@ import requests
 import imp
 import os.path
 import socket
+import struct
 import numpy as np
 
 try:
@@ -208,6 +209,16 @@ def test_blur(db):
     assert frame_array.shape[1] == 640
     assert frame_array.shape[2] == 3
 
+def test_no_ops(db):
+    # The job has no kernels, so rows go straight from load to save
+    frame = db.table('test1').as_op().range(0, 30)
+    job = Job(columns = [frame], name = 'test_no_ops')
+    table = db.run(job, force=True, show_progress=False, work_item_size=25)
+    assert table.num_rows() == 30
+    fid, frames = next(table.load(['frame']))
+    assert fid == 0
+    assert frames[0].shape == (480, 640, 3)
+
 def test_lossless(db):
     frame = db.table('test1').as_op().range(0, 30)
     blurred_frame = db.ops.Blur(frame = frame, kernel_size = 3, sigma = 0.1)
@@ -216,6 +227,178 @@ def test_lossless(db):
     table = db.run(job, force=True, show_progress=False)
     next(table.load(['frame']))
 
+def test_fused_kernels(db):
+    # Blur and Histogram are both parallel CPU kernels, so they run as one
+    # fused group; compare against running them as two separate jobs
+    def blur(frame):
+        return db.ops.Blur(frame = frame, kernel_size = 3, sigma = 0.1)
+
+    frame = db.table('test1').as_op().range(0, 30)
+    job = Job(columns = [db.ops.Histogram(frame = blur(frame))],
+              name = 'test_fused_hist')
+    fused = db.run(job, force=True, show_progress=False)
+
+    job = Job(columns = [blur(frame).lossless()],
+              name = 'test_fused_blur')
+    blurred = db.run(job, force=True, show_progress=False)
+    frame = blurred.as_op().all()
+    job = Job(columns = [db.ops.Histogram(frame = frame)],
+              name = 'test_unfused_hist')
+    unfused = db.run(job, force=True, show_progress=False)
+
+    fused_rows = list(fused.load([1], parsers.histograms))
+    unfused_rows = list(unfused.load([1], parsers.histograms))
+    assert len(fused_rows) == 30
+    assert len(fused_rows) == len(unfused_rows)
+    for (fi, fh), (ui, uh) in zip(fused_rows, unfused_rows):
+        assert fi == ui
+        for a, b in zip(fh, uh):
+            assert np.array_equal(a, b)
+
+def test_filter(db):
+    # The mask keeps every third row
+    rows = [[struct.pack('=B', i % 3 == 0), str(i)] for i in range(20)]
+    db.new_table('test_filter_input', ['mask', 'value'], rows, force=True)
+    mask, value = db.table('test_filter_input').as_op().all(task_size=8)
+    keep = db.ops.BoolFilter(mask = mask)
+    job = Job(columns = [value, keep], name = 'test_filter')
+    table = db.run(job, force=True, show_progress=False)
+
+    kept = [i for i in range(20) if i % 3 == 0]
+    assert table.num_rows() == len(kept)
+    # Each item of 8 rows ends where the rows it kept do
+    assert list(table._descriptor.end_rows) == [3, 6, 7]
+    assert table.filtered_rows() == kept
+    assert [v for _, [v] in table.load(['value'])] == [str(i) for i in kept]
+    assert all(k == '\x01' for _, [k] in table.load(['keep']))
+
+def test_aggregate(db):
+    rows = [[str(i)] for i in range(20)]
+    db.new_table('test_aggregate_input', ['value'], rows, force=True)
+    def parse_count(buf):
+        return struct.unpack('=q', buf)[0]
+
+    # Next to other columns, the aggregate leaves one row per item of 8 rows,
+    # taken from the item's last row
+    value = db.table('test_aggregate_input').as_op().all(task_size=8)
+    count = db.ops.RowCount(row = value)
+    job = Job(columns = [count, value], name = 'test_aggregate_items')
+    table = db.run(job, force=True, show_progress=False)
+    assert list(table._descriptor.end_rows) == [1, 2, 3]
+    assert [parse_count(c) for _, [c] in table.load(['count'])] == [8, 8, 4]
+    assert [v for _, [v] in table.load(['value'])] == ['7', '15', '19']
+    assert table.filtered_rows() == [7, 15, 19]
+
+    # On its own, the items' rows are combined into one row in an item after
+    # them, which leaves the partial items empty
+    def check_combined(table):
+        assert list(table._descriptor.end_rows) == [0, 0, 0, 1]
+        assert [parse_count(c) for _, [c] in table.load(['count'])] == [20]
+        assert table.filtered_rows() == [19]
+
+    def combined_job():
+        value = db.table('test_aggregate_input').as_op().all(task_size=8)
+        return Job(columns = [db.ops.RowCount(row = value)],
+                   name = 'test_aggregate')
+
+    check_combined(db.run(combined_job(), force=True, show_progress=False))
+    # A resumed run combines the same partial rows again
+    check_combined(db.run(combined_job(), resume=True, show_progress=False))
+
+def test_memoize(db):
+    def job(name):
+        frame = db.table('test2').as_op().all()
+        return Job(columns = [db.ops.Histogram(frame = frame)], name = name)
+
+    computed = db.run(job('test_memoize'), force=True, show_progress=False,
+                      memoize=True)
+    # Every op output is loaded from the first table, so the rerun has no
+    # kernels left
+    loaded = db.run(job('test_memoize_rerun'), force=True,
+                    show_progress=False, memoize=True)
+    assert loaded.num_rows() == computed.num_rows()
+    for (ci, ch), (li, lh) in zip(computed.load([1], parsers.histograms),
+                                  loaded.load([1], parsers.histograms)):
+        assert ci == li
+        for a, b in zip(ch, lh):
+            assert np.array_equal(a, b)
+
+def test_truncate_task(db):
+    from scannerpy.autotune import truncate_task
+
+    def truncate(fn, args, num_items, parsed_cls):
+        task = db.protobufs.Task()
+        sample = task.samples.add()
+        sample.table_name = 'test1'
+        sample.sampling_function = fn
+        sample.sampling_args = args.SerializeToString()
+        sample = truncate_task(db, task, num_items).samples[0]
+        parsed = parsed_cls()
+        parsed.ParseFromString(sample.sampling_args)
+        return sample.sampling_function, parsed
+
+    # All becomes the StridedRange of its first items, stopping at the end
+    # of the table's 720 rows
+    args = db.protobufs.AllSamplerArgs()
+    args.sample_size = 300
+    args.warmup_size = 10
+    fn, strided = truncate('All', args, 2,
+                           db.protobufs.StridedRangeSamplerArgs)
+    assert fn == 'StridedRange'
+    assert strided.stride == 1
+    assert list(strided.warmup_starts) == [0, 290]
+    assert list(strided.starts) == [0, 300]
+    assert list(strided.ends) == [300, 600]
+    fn, strided = truncate('All', args, 4,
+                           db.protobufs.StridedRangeSamplerArgs)
+    assert list(strided.starts) == [0, 300, 600]
+    assert list(strided.ends) == [300, 600, 720]
+
+    args = db.protobufs.StridedRangeSamplerArgs()
+    args.stride = 2
+    args.warmup_starts.extend([0, 8, 18])
+    args.starts.extend([0, 10, 20])
+    args.ends.extend([5, 15, 25])
+    fn, strided = truncate('StridedRange', args, 2,
+                           db.protobufs.StridedRangeSamplerArgs)
+    assert fn == 'StridedRange'
+    assert strided.stride == 2
+    assert list(strided.warmup_starts) == [0, 8]
+    assert list(strided.starts) == [0, 10]
+    assert list(strided.ends) == [5, 15]
+
+    args = db.protobufs.StencilSamplerArgs()
+    args.stride = 1
+    args.stencil.extend([-1, 0, 1])
+    args.starts.extend([1, 11, 21])
+    args.ends.extend([5, 15, 25])
+    fn, stencil = truncate('Stencil', args, 2,
+                           db.protobufs.StencilSamplerArgs)
+    assert fn == 'Stencil'
+    assert list(stencil.stencil) == [-1, 0, 1]
+    assert list(stencil.starts) == [1, 11]
+    assert list(stencil.ends) == [5, 15]
+
+    args = db.protobufs.GatherSamplerArgs()
+    for rows in [[0, 1], [5], [7, 9]]:
+        args.samples.add().rows.extend(rows)
+    fn, gather = truncate('Gather', args, 2, db.protobufs.GatherSamplerArgs)
+    assert fn == 'Gather'
+    assert [list(s.rows) for s in gather.samples] == [[0, 1], [5]]
+
+def test_autotune(db):
+    frame = db.table('test1').as_op().range(0, 30)
+    job = Job(columns = [db.ops.Histogram(frame = frame)],
+              name = 'test_autotune')
+    table = db.run(job, force=True, show_progress=False, autotune=True)
+    assert table.num_rows() == 30
+    next(table.load([1], parsers.histograms))
+
+    # Calibration passes leave no scratch jobs or tables behind
+    meta = db._load_db_metadata()
+    assert not [j for j in meta.jobs if j.name.startswith('__autotune')]
+    assert not [t for t in meta.tables if t.name.startswith('__autotune')]
+
 def test_compress(db):
     frame = db.table('test1').as_op().range(0, 30)
     blurred_frame = db.ops.Blur(frame = frame, kernel_size = 3, sigma = 0.1)